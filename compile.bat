@@ -33,6 +33,10 @@ if "%dbg%"=="1" (
 	set ldflags=-O2
 )
 
+:: count up lock contention for the sst_lockstats command, at a small cost
+set lockstats=0
+if "%lockstats%"=="1" set cflags=%cflags% -DFASTSPIN_STATS
+
 set objs=
 goto :main
 
@@ -69,6 +73,7 @@ setlocal DisableDelayedExpansion
 :+ chunklets/fastspin.c
 :+ chunklets/msg.c
 :+ crypto.c
+:+ democache.c
 :+ democustom.c
 :+ demorec.c
 :+ engineapi.c
@@ -90,6 +95,8 @@ setlocal DisableDelayedExpansion
 :+ l4dmm.c
 :+ l4dreset.c
 :+ l4dwarp.c
+:+ listdemos.c
+:+ lz.c
 :+ nomute.c
 :+ nosleep.c
 :+ os.c
@@ -103,6 +110,7 @@ setlocal DisableDelayedExpansion
 if "%dbg%"=="1" set src=%src% src/dbg.c
 if "%dbg%"=="1" set src=%src% src/udis86.c
 if "%dbg%"=="0" set src=%src% src/wincrt.c
+if "%lockstats%"=="1" set src=%src% src/lockstats.c
 
 %CC% -fuse-ld=lld -shared -O0 -w -o .build/bcryptprimitives.dll -Wl,-def:src/stubs/bcryptprimitives.def src/stubs/bcryptprimitives.c
 set lbcryptprimitives_host=-lbcryptprimitives
@@ -120,6 +128,26 @@ if %host64%==1 (
 -L.build %lbcryptprimitives_host% -o .build/mkgamedata.exe src/build/mkgamedata.c src/os.c || goto :end
 %HOSTCC% -fuse-ld=lld -O2 %warnings% %stdflags% -include stdbool.h ^
 -L.build %lbcryptprimitives_host% -o .build/mkentprops.exe src/build/mkentprops.c src/os.c || goto :end
+%HOSTCC% -fuse-ld=lld -O2 %warnings% %stdflags% -include stdbool.h ^
+-L.build %lbcryptprimitives_host% -o .build/mkrecords.exe src/build/mkrecords.c src/os.c || goto :end
+:: run this one straight away, since some of the tools below use its output too
+.build\mkrecords.exe src/demorecords.txt || goto :end
+%HOSTCC% -fuse-ld=lld -O2 %warnings% %stdflags% -include stdbool.h ^
+-L.build %lbcryptprimitives_host% -o .build/demostat.exe tools/demostat.c tools/demofile.c src/os.c || goto :end
+%HOSTCC% -fuse-ld=lld -O2 %warnings% %stdflags% -include stdbool.h -I.build/include ^
+-L.build %lbcryptprimitives_host% -o .build/sstdump.exe tools/sstdump.c tools/sstdata.c tools/demofile.c src/chunklets/msgdec.c src/lz.c src/os.c || goto :end
+%HOSTCC% -fuse-ld=lld -O2 %warnings% %stdflags% -include stdbool.h ^
+-L.build %lbcryptprimitives_host% -lntdll -o .build/demobatch.exe tools/demobatch.c tools/demolist.c src/chunklets/pool.c tools/sstdata.c tools/demofile.c src/chunklets/fastspin.c src/lz.c src/os.c || goto :end
+%HOSTCC% -fuse-ld=lld -O2 %warnings% %stdflags% -include stdbool.h ^
+-L.build %lbcryptprimitives_host% -o .build/demoidx.exe tools/demoidx.c tools/demoindex.c tools/sstdata.c tools/demofile.c src/3p/monocypher/monocypher.c src/lz.c src/os.c || goto :end
+%HOSTCC% -fuse-ld=lld -O2 %warnings% %stdflags% -include stdbool.h -I.build/include ^
+-L.build %lbcryptprimitives_host% -lntdll -o .build/sstverify.exe tools/sstverify.c tools/demolist.c src/chunklets/pool.c tools/sstdata.c tools/demofile.c src/crypto.c src/chunklets/fastspin.c src/chunklets/msgdec.c src/lz.c src/os.c || goto :end
+%HOSTCC% -fuse-ld=lld -O2 %warnings% %stdflags% -include stdbool.h ^
+-L.build %lbcryptprimitives_host% -o .build/lsdemos.exe tools/lsdemos.c src/democache.c src/os.c || goto :end
+%HOSTCC% -fuse-ld=lld -O2 %warnings% %stdflags% -include stdbool.h ^
+-L.build %lbcryptprimitives_host% -o .build/demorun.exe tools/demorun.c tools/demofile.c src/3p/monocypher/monocypher.c src/os.c || goto :end
+%HOSTCC% -fuse-ld=lld -O2 %warnings% %stdflags% -include stdbool.h -I.build/include ^
+-L.build %lbcryptprimitives_host% -o .build/gendemo.exe tools/gendemo.c src/chunklets/msg.c src/crypto.c src/lz.c src/os.c || goto :end
 .build\gluegen.exe%src% || goto :end
 .build\mkgamedata.exe gamedata/engine.txt gamedata/gamelib.txt gamedata/inputsystem.txt ^
 gamedata/matchmaking.txt gamedata/vgui2.txt gamedata/vguimatsurface.txt || goto :end
@@ -162,6 +190,14 @@ if exist .build\sst.old.dll del .build\sst.old.dll >nul 2>nul
 :: special case: test must be 32-bit
 %HOSTCC% -fuse-ld=lld -m32 -O2 -g %warnings% %stdflags% -L.build -lbcryptprimitives -include test/test.h -o .build/hook.test.exe test/hook.test.c || goto :end
 .build\hook.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g %warnings% %stdflags% -include test/test.h -o .build/lz.test.exe test/lz.test.c || goto :end
+.build\lz.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g %warnings% %stdflags% -include test/test.h -o .build/msgbuild.test.exe test/msgbuild.test.c || goto :end
+.build\msgbuild.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g %warnings% %stdflags% -include test/test.h -o .build/msgdec.test.exe test/msgdec.test.c || goto :end
+.build\msgdec.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g %warnings% %stdflags% -lntdll -include test/test.h -o .build/pool.test.exe test/pool.test.c || goto :end
+.build\pool.test.exe || goto :end
 %HOSTCC% -fuse-ld=lld -O2 -g %warnings% %stdflags% -include test/test.h -o .build/x86.test.exe test/x86.test.c || goto :end
 .build\x86.test.exe || goto :end
 
@@ -15,6 +15,7 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdatomic.h>
 #include <stdlib.h>
 
 #ifdef _WIN32
@@ -48,6 +49,8 @@
 #include "x86.h"
 #include "x86util.h"
 
+#include <demorecords.gen.h> // generated by build/mkrecords.c
+
 FEATURE()
 GAMESPECIFIC(L4D) // TODO(compat): wanna add support for more stuff, obviously!
 REQUIRE(bind)
@@ -63,7 +66,7 @@ static struct keybox {
 	union { uchar prv[32], shr[32]; };
 	uchar tmp[32], pub[32], lbpub[32]; // NOTE: these 3 must be kept contiguous!
 	union { u64 nonce; uchar nonce_bytes[8]; };
-	crypto_rng_ctx rng; // NOTE: keep this at the end, for wipesessionkeys()
+	crypto_rng_ctx rng;
 } *keybox;
 
 enum {
@@ -77,6 +80,10 @@ const uchar lbpubkeys[1][32] = {
 	0x40, 0x05, 0xE9, 0x60, 0x43, 0xE8, 0xE2, 0x03
 };
 
+static bool havekeys = false;
+// set when there's a new session public key that still needs to go in the demo
+static bool wantpubkey = false;
+
 static void newsessionkeys() {
 	crypto_rng_read(&keybox->rng, keybox->prv, sizeof(keybox->prv));
 	crypto_x25519_public_key(keybox->pub, keybox->prv);
@@ -87,19 +94,61 @@ static void newsessionkeys() {
 	crypto_blake2b(keybox->shr, sizeof(keybox->tmp), keybox->tmp, 96);
 	crypto_wipe(keybox->tmp, sizeof(keybox->tmp));
 	keybox->nonce = 0;
+	havekeys = true;
+	wantpubkey = true;
 }
 
 static void wipesessionkeys() {
-	crypto_wipe(keybox->prv, offsetof(struct keybox, rng));
+	// lbpub only gets set once, in INIT, so it has to survive this!
+	crypto_wipe(keybox->prv, offsetof(struct keybox, lbpub));
+	crypto_wipe(keybox->nonce_bytes, sizeof(keybox->nonce_bytes));
+	havekeys = false;
+	wantpubkey = false;
+}
+
+// the leaderboard needs our public key to derive the shared key and check the
+// sealed records. each demo file gets its own keys, so that it can be verified
+// without needing the rest of the demos from the session
+static void writepubkey() {
+	uchar buf[DEMOREC_SessionKey_MAXSZ];
+	democustom_queue(buf, demorec_put_SessionKey(buf, keybox->pub));
+	wantpubkey = false;
+}
+
+// Records posted by the input hook thread get sealed here, on the main thread,
+// as they're taken off the ring. That way the hook thread never touches the
+// keys, and every record is sealed with the key of the file it's written into.
+static void sealpost(const void *rec, int len) {
+	if_cold (!havekeys) return; // posted after recording stopped; nowhere to go
+	if (wantpubkey) writepubkey(); // the key has to come before the records!
+	// the sealed message goes in a msgpack bin so that it's still possible to
+	// find where it ends without decrypting it (MAXSZ + 16 is well under 256,
+	// so the bin size is 2 bytes)
+	uchar buf[2 + DEMOREC_FakeKey_MAXSZ + 16];
+	if_cold (len > DEMOREC_FakeKey_MAXSZ) return; // shouldn't ever happen
+	msg_putbsz8(buf, len + 16);
+	++keybox->nonce;
+	// append mac at end of message
+	crypto_aead_lock_djb(buf + 2, buf + 2 + len, keybox->shr,
+			keybox->nonce_bytes, 0, 0, rec, len);
+	democustom_queue(buf, 2 + len + 16);
 }
 
 HANDLE_EVENT(DemoRecordStarting) { if (enabled) newsessionkeys(); }
+HANDLE_EVENT(DemoFileClosing) {
+	if (!enabled) return;
+	// anything still in flight belongs to the file that's closing, so get that
+	// sealed and written out with the old key before switching to new ones
+	democustom_flush();
+	newsessionkeys();
+}
 HANDLE_EVENT(DemoRecordStopped, int ndemos) { if (enabled) wipesessionkeys(); }
 
 #ifdef _WIN32
 
 static void *gamewin, *inhookwin, *inhookthr;
 static ulong inhooktid;
+static u64 qpcfreq;
 
 static ssize __stdcall kproc(int code, usize wp, ssize lp) {
 	KBDLLHOOKSTRUCT *data = (KBDLLHOOKSTRUCT *)lp;
@@ -107,21 +156,17 @@ static ssize __stdcall kproc(int code, usize wp, ssize lp) {
 		// fast-path the next branch because alt-tabbed speed is irrelevant
 		if_hot (GetForegroundWindow() == gamewin) {
 			// maybe this input is reasonable, but log it for closer inspection
-			// TODO(rta): figure out what to do with this stuff
-			// something like the following, but with a proper abstraction...
-			//uchar buf[28 + 16], *p = buf;
-			//msg_putasz4(p, 2); p += 1;
-			//	msg_putssz5(p, 8); memcpy(p + 1, "FakeKey", 7); p += 8;
-			//	msg_putmsz4(p, 2); p += 1;
-			//		msg_putssz5(p, 3); memcpy(p + 1, "vk", 2); p += 3;
-			//			p += msg_putu32(p, data->vkCode);
-			//		msg_putssz5(p, 3); memcpy(p + 1, "scan", 4); p += 5;
-			//			p += msg_putu32(p, data->scanCode);
-			//++keybox->nonce;
-			//// append mac at end of message
-			//crypto_aead_lock_djb(buf, p, keybox->shr, keybox->nonce_bytes, 0,
-			//		0, buf, p - buf);
-			//democustom_write(buf, p - buf + 16);
+			// TODO(rta): figure out what else to do with this stuff
+			LARGE_INTEGER t;
+			QueryPerformanceCounter(&t);
+			u64 us = t.QuadPart / qpcfreq * 1000000 +
+					t.QuadPart % qpcfreq * 1000000 / qpcfreq;
+			// we can't touch the demo (or the keys) from this thread, so this
+			// gets passed to the main thread, which seals it (see sealpost())
+			uchar buf[DEMOREC_FakeKey_MAXSZ];
+			int len = demorec_put_FakeKey(buf, data->vkCode, data->scanCode,
+					us);
+			democustom_post(buf, len);
 		}
 	}
 	return CallNextHookEx(0, code, wp, lp);
@@ -140,13 +185,33 @@ static ssize __stdcall mproc(int code, usize wp, ssize lp) {
 
 // this is its own thread to meet the strict timing deadline, otherwise the
 // hook gets silently removed. plus, we don't wanna incur latency anyway.
+// If ac_enable() times out waiting for the thread to start, it abandons it by
+// changing this from STARTING to ABANDONED. Otherwise, the thread changes it to
+// RUNNING once its hooks are in. Whoever gets there first decides the outcome,
+// so the thread always knows whether to keep going or clean up after itself.
+enum { STARTING, RUNNING, ABANDONED };
+static _Atomic int inhookstate;
+// an abandoned thread that may still be stuck; see ac_enable()
+static void *stuckthr = 0;
+
 static ulong __stdcall inhookthrmain(void *param) {
 	volatile int *sig = param;
-	if_cold (!SetWindowsHookExW(WH_KEYBOARD_LL, (HOOKPROC)&kproc, 0, 0) ||
-			!SetWindowsHookExW(WH_MOUSE_LL, (HOOKPROC)&mproc, 0, 0)) {
+	void *khook = SetWindowsHookExW(WH_KEYBOARD_LL, (HOOKPROC)&kproc, 0, 0);
+	void *mhook = khook ?
+			SetWindowsHookExW(WH_MOUSE_LL, (HOOKPROC)&mproc, 0, 0) : 0;
+	if_cold (!mhook) {
+		if (khook) UnhookWindowsHookEx(khook);
 		fastspin_raise(sig, 2);
 		return -1;
 	}
+	if_cold (!atomic_compare_exchange_strong(&inhookstate, &(int){STARTING},
+			RUNNING)) {
+		// we took too long and nobody's waiting for us anymore. just remove
+		// the hooks again and go away quietly
+		UnhookWindowsHookEx(mhook);
+		UnhookWindowsHookEx(khook);
+		return 0;
+	}
 	fastspin_raise(sig, 1);
 	MSG m; int ret;
 	while ((ret = GetMessageW(&m, inhookwin, 0, 0)) > 0) DispatchMessage(&m);
@@ -170,6 +235,9 @@ static inline bool win32_init() {
 		errmsg_errorsys("failed to find window");
 		return false;
 	}
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq); // "will never fail" on XP or later
+	qpcfreq = freq.QuadPart;
 	orig_wndproc = SetWindowLongPtrA(gamewin, GWLP_WNDPROC,
 			(ssize)&hook_wndproc);
 	if_cold (!orig_wndproc) { // XXX: assuming 0 won't be legitimately returned
@@ -232,13 +300,43 @@ static void inhook_stop() {
 bool ac_enable() {
 	if (!enabled) {
 #ifdef _WIN32
-		volatile int sig = 0;
+		// if an earlier attempt got abandoned, don't start another thread (or
+		// reuse the static state below) until that one's definitely gone
+		if_cold (stuckthr) {
+			if (WaitForSingleObject(stuckthr, 0) == WAIT_TIMEOUT) {
+				con_warn("** sst: ERROR: previous message loop is still "
+						"stuck, can't continue! **");
+				return false;
+			}
+			CloseHandle(stuckthr);
+			stuckthr = 0;
+		}
+		// static because the thread might still raise this after we give up
+		static volatile int sig;
+		sig = 0;
+		atomic_store(&inhookstate, STARTING);
 		inhook_start(&sig);
-		fastspin_wait(&sig);
-		if_cold (sig == 2) { // else 1 for success
+		// this should take a few ms at most. if it doesn't, something is badly
+		// wrong, and it's better to just not do RTA mode than hang the game
+		int ret = fastspin_wait_timeout(&sig, 2000);
+		if_cold (!ret) {
+			// the thread might not even have a message queue yet, so there's
+			// no point posting it WM_QUIT. instead, tell it to give up by
+			// itself once it gets going. if it beat us to it, though, it's
+			// about to raise the signal, so just carry on as normal
+			if (atomic_compare_exchange_strong(&inhookstate,
+					&(int){STARTING}, ABANDONED)) {
+				stuckthr = inhookthr;
+			}
+			else {
+				ret = fastspin_wait(&sig);
+			}
+		}
+		if_cold (ret != 1) { // 2 for failure, 0 for timeout
 			con_warn("** sst: ERROR starting message loop, "
 					"can't continue! **");
-			CloseHandle(inhookthr);
+			// (an abandoned thread's handle is kept in stuckthr instead)
+			if (ret) CloseHandle(inhookthr);
 			return false;
 		}
 #endif
@@ -248,6 +346,7 @@ bool ac_enable() {
 }
 
 HANDLE_EVENT(Tick, bool simulating) {
+	if (wantpubkey && demorec_demonum() != -1) writepubkey();
 #ifdef _WIN32
 	static uint fewticks = 0;
 	// just check this every so often (roughly 0.1-0.3s depending on game)
@@ -424,6 +523,7 @@ INIT {
 		// run of bytes
 		memcpy(keybox->lbpub, lbpubkeys[LBPK_L4D], 32);
 	}
+	democustom_setposthandler(&sealpost);
 	hook_inline_commit(h.prologue, (void *)hook_Key_Event);
 	return FEAT_OK;
 
@@ -438,6 +538,8 @@ e:	munmap(keybox, 4096);
 END {
 	// TODO(opt): *maybe* do the skip-on-quit stuff here. feels a bit scary...
 	ac_disable();
+	democustom_setposthandler(0); // the keys are about to go away
+	havekeys = false;
 #if defined(_WIN32)
 	VirtualFree(keybox, 4096, MEM_RELEASE);
 	win32_end();
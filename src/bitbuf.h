@@ -17,13 +17,16 @@
 #ifndef INC_BITBUF_H
 #define INC_BITBUF_H
 
+#include <string.h>
+
 #include "intdefs.h"
 
 // NOTE: This code is not big-endian-safe, because the game itself is little-
 // endian. This could theoretically break tests in odd cross-compile scenarios,
-// but no tests currently look at actual bit values so it's fine for now.
+// since some tests now round-trip actual bit values, but we don't care.
 
-// handle one machine word at a time (SIMD is probably not worth it... yet?)
+// handle one machine word at a time, apart from big bitbuf_appendbuf() calls,
+// where it turns out SIMD actually is worth it (see further down)
 typedef usize bitbuf_cell;
 static const int bitbuf_cell_bits = sizeof(bitbuf_cell) * 8;
 static const int bitbuf_align = _Alignof(bitbuf_cell);
@@ -40,18 +43,28 @@ struct bitbuf {
 	const char *debugname;
 };
 
-// detail: need a cell internally, but API users shouldn't rely on 64-bit size
+// detail: need a cell internally, but API users shouldn't rely on 64-bit size.
+// x must not have any bits set above nbits, or they'll end up in the buffer!
 static inline void _bitbuf_append(struct bitbuf *bb, bitbuf_cell x, int nbits) {
 	int idx = bb->curbit / bitbuf_cell_bits;
 	int shift = bb->curbit % bitbuf_cell_bits;
 	// OR into the existing cell (lower bits were already set!)
 	bb->cells[idx] |= x << shift;
 	// assign the next cell (that also clears the upper bits for the next OR)
-	// if nbits fits in the first cell, this zeros the next cell, which is fine
-	bb->cells[idx + 1] = x >> (bitbuf_cell_bits - shift);
+	// if nbits fits in the first cell, this zeros the next cell, which is fine.
+	// double shift because shifting by bitbuf_cell_bits is UB (and x86 masks
+	// the count, meaning a shift of 0 would leave all of x in the next cell)
+	bb->cells[idx + 1] = x >> (bitbuf_cell_bits - 1 - shift) >> 1;
 	bb->curbit += nbits;
 }
 
+// detail: zero everything above curbit in the current cell, restoring the
+// invariant that _bitbuf_append() relies on after writing whole bytes directly
+static inline void _bitbuf_cleartail(struct bitbuf *bb) {
+	bb->cells[bb->curbit / bitbuf_cell_bits] &=
+			~((bitbuf_cell)-1 << bb->curbit % bitbuf_cell_bits);
+}
+
 /* Appends a value to the bit buffer, with a specfied length in bits. */
 static inline void bitbuf_appendbits(struct bitbuf *bb, uint x, int nbits) {
 	_bitbuf_append(bb, x, nbits);
@@ -62,31 +75,237 @@ static inline void bitbuf_appendbyte(struct bitbuf *bb, uchar x) {
 	_bitbuf_append(bb, x, 8);
 }
 
-/* Appends a sequence of bytes to the bit buffer, with length given in bytes. */
-static inline void bitbuf_appendbuf(struct bitbuf *bb, const char *buf,
+// detail: the plain word-at-a-time bitbuf_appendbuf() implementation, which is
+// used directly for smaller buffers and for the leftovers after any SIMD
+static inline void _bitbuf_appendbuf_scalar(struct bitbuf *bb, const char *buf,
 		uint len) {
 	// NOTE! This function takes advantage of the fact that nothing unaligned
 	// is page aligned, so accessing slightly outside the bounds of buf can't
 	// segfault. This is absolutely definitely technically UB, but it's unit
 	// tested and apparently works in practice. If something weird happens
 	// further down the line, sorry!
+	if (!len) return; // *aligned might be on the next page, so don't touch it!
 	usize unalign = (usize)buf & (bitbuf_align - 1);
 	if (unalign) {
+		uint headlen = bitbuf_align - unalign;
+		if (headlen > len) headlen = len;
 		// round down the pointer
 		bitbuf_cell *p = (bitbuf_cell *)((usize)buf - unalign);
 		// shift the stored value (if it were big endian, the shift would have
-		// to be the other way, or something)
-		_bitbuf_append(bb, *p >> (unalign << 3), (bitbuf_align - unalign) << 3);
-		buf += (int)sizeof(bitbuf_cell) - unalign;
-		len -= unalign;
+		// to be the other way, or something), then mask off anything past len
+		bitbuf_cell x = *p >> (unalign << 3) &
+				(bitbuf_cell)-1 >> (bitbuf_cell_bits - (headlen << 3));
+		_bitbuf_append(bb, x, headlen << 3);
+		buf += headlen;
+		len -= headlen;
 	}
 	bitbuf_cell *aligned = (bitbuf_cell *)buf;
 	for (; len >= (int)sizeof(bitbuf_cell); len -= (int)sizeof(bitbuf_cell),
 			++aligned) {
 		_bitbuf_append(bb, *aligned, bitbuf_cell_bits);
 	}
-	// unaligned end bytes
-	_bitbuf_append(bb, *aligned, len << 3);
+	// unaligned end bytes, again masking off anything past len
+	if (len) {
+		_bitbuf_append(bb, *aligned & ~((bitbuf_cell)-1 << (len << 3)),
+				len << 3);
+	}
+}
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+		(defined(__i386__) || defined(__x86_64__))
+#define _BITBUF_SIMD
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+// detail: 0 for no SIMD, 1 for SSE2, 2 for AVX2
+static inline int _bitbuf_detectsimd() {
+	uint a, b, c, d;
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(d & bit_SSE2)) return 0;
+	// AVX also requires the OS to save the upper halves of the YMM registers
+	if ((c & (bit_OSXSAVE | bit_AVX)) != (bit_OSXSAVE | bit_AVX)) return 1;
+	uint xcr0;
+	__asm__ ("xgetbv" : "=a" (xcr0) : "c" (0) : "edx");
+	if ((xcr0 & 6) != 6) return 1;
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d) || !(b & bit_AVX2)) return 1;
+	return 2;
+}
+
+// detail: the SIMD functions take dst pointing at the byte containing the
+// current bit and shift (1-7) being the number of valid bits in that byte. They
+// do whole blocks of 64-bit lanes, funnel-shifting the top bits of each lane
+// into the next, and return the number of bytes done. The leftover carry bits
+// are written to the byte after the last block, with garbage above them.
+
+__attribute__((target("sse2")))
+static inline uint _bitbuf_shiftcopy_sse2(uchar *dst, const uchar *src,
+		uint len, int shift) {
+	__m128i lcnt = _mm_cvtsi32_si128(shift);
+	__m128i rcnt = _mm_cvtsi32_si128(64 - shift);
+	__m128i carry = _mm_cvtsi32_si128(*dst & ((1 << shift) - 1));
+	uint done = 0;
+	for (; len - done >= 16; done += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + done));
+		__m128i lo = _mm_sll_epi64(v, lcnt), hi = _mm_srl_epi64(v, rcnt);
+		// lane 0 gets the previous block's carry; lane 1 gets lane 0's bits
+		lo = _mm_or_si128(lo, _mm_or_si128(_mm_slli_si128(hi, 8), carry));
+		_mm_storeu_si128((__m128i *)(dst + done), lo);
+		carry = _mm_srli_si128(hi, 8);
+	}
+	dst[done] = _mm_cvtsi128_si32(carry);
+	return done;
+}
+
+__attribute__((target("avx2")))
+static inline uint _bitbuf_shiftcopy_avx2(uchar *dst, const uchar *src,
+		uint len, int shift) {
+	__m128i lcnt = _mm_cvtsi32_si128(shift);
+	__m128i rcnt = _mm_cvtsi32_si128(64 - shift);
+	__m256i carry = _mm256_setr_epi32(*dst & ((1 << shift) - 1),
+			0, 0, 0, 0, 0, 0, 0);
+	uint done = 0;
+	for (; len - done >= 32; done += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + done));
+		__m256i lo = _mm256_sll_epi64(v, lcnt), hi = _mm256_srl_epi64(v, rcnt);
+		// rotate lanes up by one so each lane gets the carry from the lane
+		// below, and then lane 0 takes the carry from the previous block
+		__m256i rot = _mm256_permute4x64_epi64(hi, _MM_SHUFFLE(2, 1, 0, 3));
+		lo = _mm256_or_si256(lo, _mm256_blend_epi32(rot, carry, 0x03));
+		_mm256_storeu_si256((__m256i *)(dst + done), lo);
+		carry = rot; // top lane's carry is now in lane 0
+	}
+	dst[done] = _mm_cvtsi128_si32(_mm256_castsi256_si128(carry));
+	return done;
+}
+
+#endif
+
+// detail: big buffer path. simd is 0, 1 or 2 as per _bitbuf_detectsimd()
+static inline void _bitbuf_appendbuf_simd(struct bitbuf *bb, const char *buf,
+		uint len, int simd) {
+	uchar *dst = (uchar *)bb->buf + (bb->curbit >> 3);
+	int shift = bb->curbit & 7;
+	uint done;
+	if (!shift) {
+		// destination is byte aligned: no need to shift anything at all!
+		memcpy(dst, buf, len);
+		done = len;
+	}
+#ifdef _BITBUF_SIMD
+	else if (simd == 2) {
+		done = _bitbuf_shiftcopy_avx2(dst, (const uchar *)buf, len, shift);
+	}
+	else if (simd == 1) {
+		done = _bitbuf_shiftcopy_sse2(dst, (const uchar *)buf, len, shift);
+	}
+#endif
+	else {
+		_bitbuf_appendbuf_scalar(bb, buf, len);
+		return;
+	}
+	bb->curbit += done << 3;
+	_bitbuf_cleartail(bb);
+	_bitbuf_appendbuf_scalar(bb, buf + done, len - done);
+}
+
+/* Appends a sequence of bytes to the bit buffer, with length given in bytes. */
+static inline void bitbuf_appendbuf(struct bitbuf *bb, const char *buf,
+		uint len) {
+	// below this, SIMD setup and the leftovers eat up most of the gain
+	if (len < 64) { _bitbuf_appendbuf_scalar(bb, buf, len); return; }
+#ifdef _BITBUF_SIMD
+	static int simd = -1; // (one copy per translation unit, but who cares)
+	if (simd < 0) simd = _bitbuf_detectsimd();
+#else
+	enum { simd = 0 };
+#endif
+	_bitbuf_appendbuf_simd(bb, buf, len, simd);
+}
+
+// The engine's compact encodings. These are written branch-free where possible,
+// by building the whole encoded value up front and doing one _bitbuf_append(),
+// since the branchy versions in tier1 tend to mispredict on real-world data.
+
+// ranges and resolutions of encoded coordinates and normals, as per the engine
+#define BITBUF_COORD_INTBITS 14
+#define BITBUF_COORD_FRACBITS 5
+#define BITBUF_COORD_DENOM (1 << BITBUF_COORD_FRACBITS)
+#define BITBUF_NORMAL_FRACBITS 11
+#define BITBUF_NORMAL_DENOM ((1 << BITBUF_NORMAL_FRACBITS) - 1)
+
+/*
+ * Appends an unsigned value in the engine's UBitVar encoding: a 2-bit selector
+ * followed by the value in 4, 8, 12 or 32 bits, whichever is smallest.
+ */
+static inline void bitbuf_appendubitvar(struct bitbuf *bb, uint x) {
+	// n = -3 to 0 for 4 to 16 bits, via comparisons that become setcc/sbb
+	int n = -(x < 0x10u) - (x < 0x100u) - (x < 0x1000u);
+	// write the selector and up to the low 16 bits of x in one go, masking off
+	// anything above those before shifting them up for the selector
+	bitbuf_cell lo = (x & 0xFFFF) << 2 | (n + 3);
+	_bitbuf_append(bb, lo & (bitbuf_cell)-1 >> (bitbuf_cell_bits - 18 - 4 * n),
+			18 + 4 * n);
+	if (x >= 0x1000u) _bitbuf_append(bb, x >> 16, 16);
+}
+
+/*
+ * Appends an unsigned value in the protobuf-style varint encoding, used for
+ * lengths and such in later network protocols: 7 bits per byte, low bits first,
+ * with the top bit of each byte set if there are more to come.
+ */
+static inline void bitbuf_appendvarint32(struct bitbuf *bb, uint x) {
+	// number of bytes needed is 1 to 5. x | 1 avoids clz(0) being undefined
+	int nbytes = (32 - __builtin_clz(x | 1) + 6) / 7;
+	// spread the 7-bit groups out into bytes, then set the continuation bits
+	// for every byte but the last
+	bitbuf_cell lo = (x & 0x7F) | (x & 0x3F80) << 1 | (x & 0x1FC000) << 2 |
+			(x & 0xFE00000) << 3;
+	lo |= (uint)(0x80808080ull >> (40 - 8 * nbytes));
+	if (nbytes <= 4) {
+		_bitbuf_append(bb, (uint)lo, nbytes * 8);
+	}
+	else {
+		_bitbuf_append(bb, (uint)lo, 32);
+		_bitbuf_append(bb, x >> 28, 8);
+	}
+}
+
+/* Appends a signed value as a zigzag-encoded varint (see above). */
+static inline void bitbuf_appendsvarint32(struct bitbuf *bb, int x) {
+	bitbuf_appendvarint32(bb, (uint)x << 1 ^ (uint)(x >> 31));
+}
+
+/*
+ * Appends a world coordinate in the engine's BitCoord encoding: flags for
+ * whether there are integer and fractional parts, a sign bit if either is
+ * present, then the 14-bit integer part (minus 1) and/or the 5-bit fraction.
+ */
+static inline void bitbuf_appendcoord(struct bitbuf *bb, float f) {
+	int scaled = (int)(f * BITBUF_COORD_DENOM);
+	uint absscaled = scaled < 0 ? -scaled : scaled;
+	uint intval = absscaled >> BITBUF_COORD_FRACBITS;
+	uint fracval = absscaled & BITBUF_COORD_DENOM - 1;
+	uint hasint = intval != 0, hasfrac = fracval != 0, any = hasint | hasfrac;
+	uint neg = (scaled < 0) & any;
+	// pack it all into one value, using the flags as masks to skip fields
+	uint x = hasint | hasfrac << 1 | neg << 2;
+	int nbits = 2 + any;
+	x |= ((intval - 1) & (1 << BITBUF_COORD_INTBITS) - 1 & -hasint) << nbits;
+	nbits += BITBUF_COORD_INTBITS & -hasint;
+	x |= fracval << nbits;
+	nbits += BITBUF_COORD_FRACBITS & -hasfrac;
+	_bitbuf_append(bb, x, nbits);
+}
+
+/*
+ * Appends a normal vector component in the range [-1, 1] in the engine's
+ * BitNormal encoding: a sign bit then an 11-bit fraction, saturating at ±1.
+ */
+static inline void bitbuf_appendnormal(struct bitbuf *bb, float f) {
+	int scaled = (int)(f * BITBUF_NORMAL_DENOM);
+	uint neg = scaled < 0, fracval = neg ? -scaled : scaled;
+	if (fracval > BITBUF_NORMAL_DENOM) fracval = BITBUF_NORMAL_DENOM;
+	_bitbuf_append(bb, neg | fracval << 1, 1 + BITBUF_NORMAL_FRACBITS);
 }
 
 /* 0-pad the bit buffer up to the next whole byte boundary. */
@@ -96,10 +315,181 @@ static inline void bitbuf_roundup(struct bitbuf *bb) {
 
 /* Clear the bit buffer to make it ready to append new data. */
 static inline void bitbuf_reset(struct bitbuf *bb) {
-	bb->buf[0] = 0; // we have to zero out the lowest cell since it gets ORed
+	bb->cells[0] = 0; // we have to zero out the lowest cell since it gets ORed
 	bb->curbit = 0;
 }
 
+/*
+ * A bit buffer for reading, ABI-compatible with bf_read defined in
+ * tier1/bitbuf.h (which has the same layout as bf_write). This means it can be
+ * pointed straight at a buffer handed to us by the engine.
+ *
+ * Reads never go past the last cell containing any part of the buffer. Reading
+ * past nbits sets overflow and returns zeros, rather than checking beforehand;
+ * callers are expected to check overflow once at the end of a batch of reads.
+ */
+struct bitbuf_reader {
+	union {
+		const char *buf; /* NOTE: the buffer SHOULD be aligned as bitbuf_cell! */
+		const bitbuf_cell *cells;
+	};
+	int sz, nbits;
+	uint curbit;
+	bool overflow, assert_on_overflow;
+	const char *debugname;
+};
+
+// detail: get nbits (1 to bitbuf_cell_bits) at an arbitrary bit position,
+// without advancing or touching the overflow flag. the cell indices are clamped
+// (hopefully with cmovs) so that we only ever touch cells containing at least
+// one byte of the buffer; as with bitbuf_appendbuf(), this means we might read
+// a few bytes beyond the end, but nothing unaligned is page-aligned, so fine.
+static inline bitbuf_cell _bitbuf_peek(const struct bitbuf_reader *bb,
+		uint pos, int nbits) {
+	uint last = (uint)(bb->sz - 1) / sizeof(bitbuf_cell);
+	uint idx = pos / bitbuf_cell_bits;
+	int shift = pos % bitbuf_cell_bits;
+	uint idx2 = idx + 1;
+	idx = idx < last ? idx : last;
+	idx2 = idx2 < last ? idx2 : last;
+	// double shift for the upper part: a single shift by bitbuf_cell_bits
+	// would be UB (and x86 would just mask it to 0, giving us garbage)
+	bitbuf_cell x = bb->cells[idx] >> shift |
+			bb->cells[idx2] << (bitbuf_cell_bits - 1 - shift) << 1;
+	return x & (bitbuf_cell)-1 >> (bitbuf_cell_bits - nbits);
+}
+
+// detail: as above, but advance, and zero the result if we've gone too far
+static inline bitbuf_cell _bitbuf_read(struct bitbuf_reader *bb, int nbits) {
+	bitbuf_cell x = _bitbuf_peek(bb, bb->curbit, nbits);
+	bb->curbit += nbits;
+	bb->overflow |= bb->curbit > (uint)bb->nbits;
+	return x & -(bitbuf_cell)!bb->overflow;
+}
+
+/* Reads a value of a specified length in bits (1 to 32) from the bit buffer. */
+static inline uint bitbuf_readbits(struct bitbuf_reader *bb, int nbits) {
+	return _bitbuf_read(bb, nbits);
+}
+
+/* Reads a byte from the bit buffer. */
+static inline uchar bitbuf_readbyte(struct bitbuf_reader *bb) {
+	return _bitbuf_read(bb, 8);
+}
+
+/* Advances the read position of the bit buffer by a specified number of bits. */
+static inline void bitbuf_skipbits(struct bitbuf_reader *bb, uint nbits) {
+	bb->curbit += nbits;
+	bb->overflow |= bb->curbit > (uint)bb->nbits;
+}
+
+/*
+ * Reads a sequence of bytes from the bit buffer into buf, with length given in
+ * bytes. If there aren't enough bits left, sets overflow and zeros buf.
+ */
+static inline void bitbuf_readbuf(struct bitbuf_reader *bb, char *buf,
+		uint len) {
+	// one check up front, then the loops below can't run off the end
+	if (bb->curbit + (len << 3) > (uint)bb->nbits) {
+		bb->curbit = bb->nbits + 1;
+		bb->overflow = true;
+		memset(buf, 0, len);
+		return;
+	}
+	if (!(bb->curbit & 7)) {
+		// byte aligned: no shifting required at all
+		memcpy(buf, bb->buf + (bb->curbit >> 3), len);
+		bb->curbit += len << 3;
+		return;
+	}
+	for (; len >= sizeof(bitbuf_cell); len -= sizeof(bitbuf_cell),
+			buf += sizeof(bitbuf_cell)) {
+		bitbuf_cell x = _bitbuf_peek(bb, bb->curbit, bitbuf_cell_bits);
+		memcpy(buf, &x, sizeof(x)); // (turns into a plain store)
+		bb->curbit += bitbuf_cell_bits;
+	}
+	for (; len; --len, ++buf) {
+		*buf = _bitbuf_peek(bb, bb->curbit, 8);
+		bb->curbit += 8;
+	}
+}
+
+/* Reads an unsigned value in UBitVar encoding (see bitbuf_appendubitvar()). */
+static inline uint bitbuf_readubitvar(struct bitbuf_reader *bb) {
+	static const uchar nbits[4] = {4, 8, 12, 32};
+	uint sel = _bitbuf_read(bb, 2);
+	return _bitbuf_read(bb, nbits[sel]);
+}
+
+/* Reads a varint (see bitbuf_appendvarint32()). Stops after 5 bytes at most. */
+static inline uint bitbuf_readvarint32(struct bitbuf_reader *bb) {
+	uint x = _bitbuf_peek(bb, bb->curbit, 32);
+	// the first byte without a continuation bit is the last one
+	uint ends = ~x & 0x80808080u;
+	int nbytes = ends ? __builtin_ctz(ends) / 8 + 1 : 5;
+	uint ret = (x & 0x7F) | (x >> 1 & 0x3F80) | (x >> 2 & 0x1FC000) |
+			(x >> 3 & 0xFE00000);
+	ret &= (uint)-1 >> (32 - 7 * (nbytes < 4 ? nbytes : 4));
+	bitbuf_skipbits(bb, (nbytes < 4 ? nbytes : 4) * 8);
+	if (nbytes == 5) ret |= (uint)_bitbuf_read(bb, 8) << 28;
+	return ret & -(uint)!bb->overflow;
+}
+
+/* Reads a zigzag-encoded signed varint (see bitbuf_appendsvarint32()). */
+static inline int bitbuf_readsvarint32(struct bitbuf_reader *bb) {
+	uint x = bitbuf_readvarint32(bb);
+	return (int)(x >> 1 ^ -(x & 1));
+}
+
+/* Reads a world coordinate in BitCoord encoding (see bitbuf_appendcoord()). */
+static inline float bitbuf_readcoord(struct bitbuf_reader *bb) {
+	uint flags = _bitbuf_read(bb, 2);
+	if (!flags) return 0;
+	uint neg = _bitbuf_read(bb, 1), intval = 0, fracval = 0;
+	if (flags & 1) intval = _bitbuf_read(bb, BITBUF_COORD_INTBITS) + 1;
+	if (flags & 2) fracval = _bitbuf_read(bb, BITBUF_COORD_FRACBITS);
+	float ret = intval + fracval * (1.0f / BITBUF_COORD_DENOM);
+	return neg ? -ret : ret;
+}
+
+/* Reads a normal component in BitNormal encoding (see bitbuf_appendnormal()). */
+static inline float bitbuf_readnormal(struct bitbuf_reader *bb) {
+	uint x = _bitbuf_read(bb, 1 + BITBUF_NORMAL_FRACBITS);
+	float ret = (x >> 1) * (1.0f / BITBUF_NORMAL_DENOM);
+	return x & 1 ? -ret : ret;
+}
+
+/*
+ * Copies nbits from the current position of src to the end of dst, advancing
+ * src. Neither position has to be byte-aligned. If src doesn't have enough bits
+ * left, sets its overflow flag and copies nothing.
+ */
+static inline void bitbuf_copybits(struct bitbuf *dst,
+		struct bitbuf_reader *src, uint nbits) {
+	if (src->curbit + nbits > (uint)src->nbits) {
+		src->curbit = src->nbits + 1;
+		src->overflow = true;
+		return;
+	}
+	uint pos = src->curbit;
+	if (!(pos & 7)) {
+		// source is byte aligned, so this is really just an appendbuf, which
+		// can shift things into place using SIMD
+		uint len = nbits >> 3;
+		bitbuf_appendbuf(dst, src->buf + (pos >> 3), len);
+		pos += len << 3;
+		nbits &= 7;
+	}
+	// otherwise, funnel shift a whole cell at a time out of src and into dst
+	for (; nbits >= bitbuf_cell_bits; nbits -= bitbuf_cell_bits,
+			pos += bitbuf_cell_bits) {
+		_bitbuf_append(dst, _bitbuf_peek(src, pos, bitbuf_cell_bits),
+				bitbuf_cell_bits);
+	}
+	if (nbits) _bitbuf_append(dst, _bitbuf_peek(src, pos, nbits), nbits);
+	src->curbit = pos + nbits;
+}
+
 #endif
 
 // vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,545 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../intdefs.h"
+#include "../langext.h"
+#include "../os.h"
+
+#ifdef _WIN32
+#define fS "S"
+#else
+#define fS "s"
+#endif
+
+static cold noreturn die(int status, const char *s) {
+	fprintf(stderr, "mkrecords: fatal: %s\n", s);
+	exit(status);
+}
+
+static const os_char *srcname;
+static cold noreturn dieparse(int line, const char *s) {
+	fprintf(stderr, "mkrecords: %" fS ":%d: %s\n", srcname, line, s);
+	exit(2);
+}
+
+enum {
+	T_BOOL, T_U32, T_U64, T_S32, T_S64, T_F32, T_F64, T_STR, T_BIN,
+	T_BINFIX // bin<N>, with the size in fixlen
+};
+
+static const char *const typenames[] = {
+	"bool", "u32", "u64", "s32", "s64", "f32", "f64", "str", "bin"
+};
+
+// C types for encoder parameters and decoded struct members
+static const char *const ctypes[] = {
+	"_Bool", "unsigned int", "unsigned long long", "int", "long long", "float",
+	"double"
+};
+
+// biggest encoded size of each fixed-size type, for the _MAXSZ constants
+static const uchar maxsizes[] = {1, 5, 9, 5, 9, 5, 9};
+
+#define MAXRECS 127
+#define MAXFIELDS 32 // bits in demorec.has
+static struct rec {
+	const char *name;
+	int id, line, firstfield, nfields;
+} recs[MAXRECS];
+static int nrecs = 0;
+
+static struct field {
+	const char *name;
+	int id, type, fixlen;
+} fields[MAXRECS * MAXFIELDS];
+static int nfields = 0;
+
+static bool isident(const char *s) {
+	if (!(*s >= 'A' && *s <= 'Z' || *s >= 'a' && *s <= 'z' || *s == '_')) {
+		return false;
+	}
+	for (++s; *s; ++s) {
+		if (!(*s >= 'A' && *s <= 'Z' || *s >= 'a' && *s <= 'z' ||
+				*s >= '0' && *s <= '9' || *s == '_')) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// parses a decimal number in [min, max], or returns -1
+static int parsenum(const char *s, int min, int max) {
+	int ret = 0;
+	if (!*s) return -1;
+	for (; *s; ++s) {
+		if (*s < '0' || *s > '9') return -1;
+		ret = ret * 10 + *s - '0';
+		if (ret > max) return -1;
+	}
+	return ret < min ? -1 : ret;
+}
+
+static void parsetype(struct field *f, const char *s, int line) {
+	for (int i = 0; i < countof(typenames); ++i) {
+		if (!strcmp(s, typenames[i])) { f->type = i; return; }
+	}
+	if (!strncmp(s, "bin", 3)) {
+		f->fixlen = parsenum(s + 3, 1, 65535);
+		if_cold (f->fixlen == -1) dieparse(line, "invalid fixed binary size");
+		f->type = T_BINFIX;
+		return;
+	}
+	dieparse(line, "unknown field type");
+}
+
+static void handlerecord(char **toks, int ntoks, int line) {
+	if_cold (ntoks != 2) dieparse(line, "expected a record name and ID");
+	if_cold (nrecs == MAXRECS) dieparse(line, "too many records");
+	if_cold (!isident(toks[0])) dieparse(line, "invalid record name");
+	int id = parsenum(toks[1], 1, 127);
+	if_cold (id == -1) dieparse(line, "record ID must be in [1, 127]");
+	for (int i = 0; i < nrecs; ++i) {
+		if_cold (!strcmp(recs[i].name, toks[0])) {
+			dieparse(line, "duplicate record name");
+		}
+		if_cold (recs[i].id == id) dieparse(line, "duplicate record ID");
+	}
+	recs[nrecs++] = (struct rec){toks[0], id, line, nfields, 0};
+}
+
+static void handlefield(char **toks, int ntoks, int line) {
+	if_cold (!nrecs) dieparse(line, "field doesn't belong to any record");
+	if_cold (ntoks != 3) dieparse(line, "expected a field name, ID and type");
+	struct rec *r = recs + nrecs - 1;
+	if_cold (r->nfields == MAXFIELDS) {
+		dieparse(line, "too many fields in one record");
+	}
+	if_cold (!isident(toks[0])) dieparse(line, "invalid field name");
+	int id = parsenum(toks[1], 1, 127);
+	if_cold (id == -1) dieparse(line, "field ID must be in [1, 127]");
+	for (int i = r->firstfield; i < nfields; ++i) {
+		if_cold (!strcmp(fields[i].name, toks[0])) {
+			dieparse(line, "duplicate field name");
+		}
+		if_cold (fields[i].id == id) dieparse(line, "duplicate field ID");
+	}
+	struct field *f = fields + nfields++;
+	*f = (struct field){toks[0], id, 0, 0};
+	parsetype(f, toks[2], line);
+	++r->nfields;
+}
+
+static void parse(char *s, int len) {
+	if_cold (len && s[len - 1] != '\n') {
+		dieparse(0, "invalid text file (missing EOL)");
+	}
+	for (int line = 1; len; ++line) {
+		char *eol = memchr(s, '\n', len);
+		*eol = '\0';
+		len -= eol + 1 - s;
+		char *com = strchr(s, '#');
+		if (com) *com = '\0';
+		int indent = 0;
+		while (*s == '\t') { ++s; ++indent; }
+		if_cold (*s == ' ') dieparse(line, "unexpected space at start of line");
+		char *toks[4];
+		int ntoks = 0;
+		for (;;) {
+			while (*s == ' ' || *s == '\t') *s++ = '\0';
+			if (!*s) break;
+			if_cold (ntoks == countof(toks)) dieparse(line, "too many words");
+			toks[ntoks++] = s;
+			while (*s && *s != ' ' && *s != '\t') ++s;
+		}
+		if (ntoks) {
+			if_cold (indent > 1) dieparse(line, "excessive indentation");
+			if (indent) handlefield(toks, ntoks, line);
+			else handlerecord(toks, ntoks, line);
+		}
+		s = eol + 1;
+	}
+}
+
+static cold noreturn diewrite() { die(100, "couldn't write to file"); }
+#define _(x) if_cold (fprintf(out, "%s\n", x) < 0) diewrite();
+#define F(f, ...) if_cold (fprintf(out, f "\n", __VA_ARGS__) < 0) diewrite();
+#define H() \
+_( "/* This file is autogenerated by src/build/mkrecords.c. DO NOT EDIT! */") \
+_( "")
+
+static inline bool isvarsize(int type) {
+	return type == T_STR || type == T_BIN;
+}
+
+// writes the parameter list shared by a record's size and put functions
+static void params(FILE *out, const struct rec *r, bool first) {
+	for (int i = r->firstfield; i < r->firstfield + r->nfields; ++i) {
+		const struct field *f = fields + i;
+		const char *sep = first ? "" : ", ";
+		first = false;
+		switch (f->type) {
+			case T_STR:
+				if_cold (fprintf(out, "%sconst char *%s, unsigned int %s_len",
+						sep, f->name, f->name) < 0) {
+					diewrite();
+				}
+				break;
+			case T_BIN:
+				if_cold (fprintf(out, "%sconst unsigned char *%s, "
+						"unsigned int %s_len", sep, f->name, f->name) < 0) {
+					diewrite();
+				}
+				break;
+			case T_BINFIX:
+				if_cold (fprintf(out, "%sconst unsigned char *%s", sep,
+						f->name) < 0) {
+					diewrite();
+				}
+				break;
+			default:
+				if_cold (fprintf(out, "%s%s %s", sep, ctypes[f->type],
+						f->name) < 0) {
+					diewrite();
+				}
+		}
+	}
+	if (first && fputs("void", out) < 0) diewrite();
+}
+
+static inline int binhdrsize(int len) { return len <= 255 ? 2 : 3; }
+
+static void encoder(FILE *out, const struct rec *r) {
+	int end = r->firstfield + r->nfields;
+	// array header, record ID, map header, then a 1-byte key for each field
+	int fixed = 2 + (r->nfields <= 15 ? 1 : 3) + r->nfields, max = fixed;
+	bool bounded = true;
+	for (int i = r->firstfield; i < end; ++i) {
+		const struct field *f = fields + i;
+		if (f->type == T_BINFIX) {
+			fixed += binhdrsize(f->fixlen) + f->fixlen;
+			max += binhdrsize(f->fixlen) + f->fixlen;
+		}
+		else if (f->type == T_BOOL || f->type == T_F32) {
+			fixed += maxsizes[f->type];
+			max += maxsizes[f->type];
+		}
+		else if (isvarsize(f->type)) {
+			bounded = false;
+		}
+		else {
+			max += maxsizes[f->type];
+		}
+	}
+F( "/* %s, from line %d of %" fS " */", r->name, r->line, srcname)
+F( "enum { DEMOREC_%s = %d };", r->name, r->id)
+	if (bounded) {
+F( "enum { DEMOREC_%s_MAXSZ = %d };", r->name, max)
+	}
+	if_cold (fprintf(out, "static inline unsigned int demorec_size_%s(",
+			r->name) < 0) {
+		diewrite();
+	}
+	params(out, r, true);
+_( ") {")
+	if_cold (fprintf(out, "\treturn %d", fixed) < 0) diewrite();
+	for (int i = r->firstfield; i < end; ++i) {
+		const struct field *f = fields + i;
+		const char *expr;
+		switch (f->type) {
+			case T_U32: case T_U64: expr = "msg_sizeu(%s)"; break;
+			case T_S32: case T_S64: expr = "msg_sizes(%s)"; break;
+			case T_F64: expr = "msg_sized(%s)"; break;
+			case T_STR: expr = "msg_sizestr(%s_len)"; break;
+			case T_BIN: expr = "msg_sizebin(%s_len)"; break;
+			default: continue;
+		}
+		if_cold (fputs(" + ", out) < 0) diewrite();
+		if_cold (fprintf(out, expr, f->name) < 0) diewrite();
+	}
+_( ";")
+_( "}")
+	if_cold (fprintf(out, "static inline unsigned int demorec_put_%s("
+			"unsigned char *out", r->name) < 0) {
+		diewrite();
+	}
+	params(out, r, false);
+_( ") {")
+_( "	unsigned char *p = out;")
+F( "	msg_putasz4(p++, 2); msg_puti7(p++, DEMOREC_%s);", r->name)
+	if (r->nfields <= 15) {
+F( "	msg_putmsz4(p++, %d);", r->nfields)
+	}
+	else {
+F( "	p += msg_putmsz16(p, %d);", r->nfields)
+	}
+	for (int i = r->firstfield; i < end; ++i) {
+		const struct field *f = fields + i;
+		const char *n = f->name;
+F( "	msg_puti7(p++, %d); // %s", f->id, n)
+		switch (f->type) {
+			case T_BOOL: F( "	msg_putbool(p++, %s);", n) break;
+			case T_U32: F( "	p += msg_putu32(p, %s);", n) break;
+			case T_U64: F( "	p += msg_putu(p, %s);", n) break;
+			case T_S32: F( "	p += msg_puts32(p, %s);", n) break;
+			case T_S64: F( "	p += msg_puts(p, %s);", n) break;
+			case T_F32: F( "	msg_putf(p, %s); p += 5;", n) break;
+			case T_F64: F( "	p += msg_putd(p, %s);", n) break;
+			case T_STR:
+F( "	p += msg_putssz(p, %s_len);", n)
+F( "	memcpy(p, %s, %s_len); p += %s_len;", n, n, n)
+				break;
+			case T_BIN:
+F( "	p += msg_putbsz(p, %s_len);", n)
+F( "	memcpy(p, %s, %s_len); p += %s_len;", n, n, n)
+				break;
+			case T_BINFIX:
+				if (f->fixlen <= 255) {
+F( "	msg_putbsz8(p, %d); p += 2;", f->fixlen)
+				}
+				else {
+F( "	p += msg_putbsz16(p, %d);", f->fixlen)
+				}
+F( "	memcpy(p, %s, %d); p += %d;", n, f->fixlen, f->fixlen)
+		}
+	}
+_( "	return p - out;")
+_( "}")
+_( "")
+}
+
+static void decstruct(FILE *out, const struct rec *r) {
+F( "struct demorec_%s {", r->name)
+	for (int i = r->firstfield; i < r->firstfield + r->nfields; ++i) {
+		const struct field *f = fields + i;
+		switch (f->type) {
+			case T_STR:
+F( "	const char *%s; unsigned int %s_len; /* not null-terminated! */",
+f->name, f->name)
+				break;
+			case T_BIN:
+F( "	const unsigned char *%s; unsigned int %s_len;", f->name, f->name)
+				break;
+			case T_BINFIX:
+F( "	const unsigned char *%s; /* %d bytes */", f->name, f->fixlen)
+				break;
+			default:
+F( "	%s %s;", ctypes[f->type], f->name)
+		}
+	}
+	if (!r->nfields) _( "	char _dummy; /* avoid an empty struct */")
+_( "};")
+	for (int i = 0; i < r->nfields; ++i) {
+F( "#define DEMOREC_%s_%s (1u << %d) /* bit in demorec.has */", r->name,
+fields[r->firstfield + i].name, i)
+	}
+_( "")
+}
+
+// the condition under which a decoded value is NOT valid for a field
+static const char *const badconds[] = {
+	"v.type != MSGDEC_BOOL",
+	"v.type != MSGDEC_UINT || v.u > 4294967295u",
+	"v.type != MSGDEC_UINT",
+	"v.type == MSGDEC_UINT ? v.u > 2147483647 : "
+			"v.type != MSGDEC_SINT || v.s < -2147483647 - 1",
+	"v.type == MSGDEC_UINT ? v.u > 9223372036854775807u : "
+			"v.type != MSGDEC_SINT",
+	"v.type != MSGDEC_FLOAT",
+	"v.type != MSGDEC_FLOAT && v.type != MSGDEC_DOUBLE",
+	"v.type != MSGDEC_STR",
+	"v.type != MSGDEC_BIN"
+};
+
+static void decoder(FILE *out, const struct rec *r) {
+F( "static inline int demorec_get_%s(const unsigned char **p,", r->name)
+_( "		const unsigned char *end, struct demorec *r) {")
+_( "	struct msgdec_val v;")
+_( "	int ret = msgdec_get(p, end, &v);")
+_( "	if (ret != MSGDEC_OK) return ret;")
+_( "	if (v.type != MSGDEC_MAP) return MSGDEC_BAD;")
+_( "	for (unsigned int i = 0, n = v.n; i < n; ++i) {")
+_( "		if ((ret = msgdec_get(p, end, &v)) != MSGDEC_OK) return ret;")
+_( "		if (v.type != MSGDEC_UINT) return MSGDEC_BAD;")
+_( "		switch (v.u) {")
+	for (int i = 0; i < r->nfields; ++i) {
+		const struct field *f = fields + r->firstfield + i;
+		const char *n = f->name;
+F( "			case %d:", f->id)
+_( "				if ((ret = msgdec_get(p, end, &v)) != MSGDEC_OK) return ret;")
+		if (f->type == T_BINFIX) {
+F( "				if (v.type != MSGDEC_BIN || v.len != %d) return MSGDEC_BAD;",
+f->fixlen)
+		}
+		else {
+F( "				if (%s) {", badconds[f->type])
+_( "					return MSGDEC_BAD;")
+_( "				}")
+		}
+		switch (f->type) {
+			case T_BOOL: F( "				r->%s.%s = v.b;", r->name, n) break;
+			case T_U32: case T_U64:
+F( "				r->%s.%s = v.u;", r->name, n)
+				break;
+			case T_S32: case T_S64:
+F( "				r->%s.%s = v.s;", r->name, n) // same bits either way
+				break;
+			case T_F32: F( "				r->%s.%s = v.f;", r->name, n) break;
+			case T_F64:
+F( "				r->%s.%s = v.type == MSGDEC_FLOAT ? v.f : v.d;", r->name, n)
+				break;
+			case T_STR:
+F( "				r->%s.%s = (const char *)v.data;", r->name, n)
+F( "				r->%s.%s_len = v.len;", r->name, n)
+				break;
+			case T_BIN:
+F( "				r->%s.%s = v.data; r->%s.%s_len = v.len;", r->name, n, r->name,
+n)
+				break;
+			case T_BINFIX:
+F( "				r->%s.%s = v.data;", r->name, n)
+		}
+F( "				r->has |= DEMOREC_%s_%s;", r->name, n)
+_( "				break;")
+	}
+_( "			default: // from some newer version; don't care")
+_( "				if ((ret = msgdec_skip(p, end)) != MSGDEC_OK) return ret;")
+_( "		}")
+_( "	}")
+_( "	return MSGDEC_OK;")
+_( "}")
+_( "")
+}
+
+static void decoders(FILE *out) {
+_( "/*")
+_( " * Decoders for the records in demorecords.txt, for the offline tools.")
+_( " * chunklets/msgdec.h must be included before this header.")
+_( " */")
+_( "")
+_( "#include \"demorecords.gen.h\"")
+_( "")
+	for (int i = 0; i < nrecs; ++i) decstruct(out, recs + i);
+_( "/* A decoded record, as returned by demorec_get(). */")
+_( "struct demorec {")
+_( "	int id; /* DEMOREC_*, or 0 if the value wasn't a known record */")
+_( "	unsigned int has; /* DEMOREC_<record>_<field> bits, for fields seen */")
+_( "	union {")
+	for (int i = 0; i < nrecs; ++i) {
+F( "		struct demorec_%s %s;", recs[i].name, recs[i].name)
+	}
+	if (!nrecs) _( "		char _dummy;")
+_( "	};")
+_( "};")
+_( "")
+	for (int i = 0; i < nrecs; ++i) decoder(out, recs + i);
+_( "/*")
+_( " * Decodes one top-level msgpack value from *p, ending at end. If it's")
+_( " * one of the records in demorecords.txt, fills in r, or otherwise just")
+_( " * sets r->id to 0 so that the caller can deal with it. Returns the same")
+_( " * as msgdec_get(), and likewise only advances *p on success.")
+_( " */")
+_( "static inline int demorec_get(const unsigned char **p,")
+_( "		const unsigned char *end, struct demorec *r) {")
+_( "	const unsigned char *q = *p;")
+_( "	r->id = 0; r->has = 0;")
+_( "	// records always start with a fixarray of 2 and a positive fixint")
+_( "	if (end - q >= 2 && q[0] == 0x92 && q[1] < 0x80) {")
+_( "		q += 2;")
+_( "		int ret;")
+_( "		switch (q[-1]) {")
+	for (int i = 0; i < nrecs; ++i) {
+F( "			case DEMOREC_%s:", recs[i].name)
+F( "				ret = demorec_get_%s(&q, end, r);", recs[i].name)
+_( "				break;")
+	}
+_( "			default: goto skip;")
+_( "		}")
+_( "		if (ret == MSGDEC_OK) { r->id = (*p)[1]; *p = q; }")
+_( "		return ret;")
+_( "	}")
+_( "skip:")
+_( "	return msgdec_skip(p, end);")
+_( "}")
+_( "")
+_( "/* Returns the name of the given record type, or null if it's unknown. */")
+_( "static inline const char *demorec_name(int id) {")
+_( "	switch (id) {")
+	for (int i = 0; i < nrecs; ++i) {
+F( "		case %d: return \"%s\";", recs[i].id, recs[i].name)
+	}
+_( "	}")
+_( "	return 0;")
+_( "}")
+_( "")
+_( "/* Returns the name of a field in a record, or null if it's unknown. */")
+_( "static inline const char *demorec_fieldname(int id, int field) {")
+_( "	switch (id) {")
+	for (int i = 0; i < nrecs; ++i) {
+		const struct rec *r = recs + i;
+F( "		case %d: switch (field) {", r->id)
+		for (int j = r->firstfield; j < r->firstfield + r->nfields; ++j) {
+F( "			case %d: return \"%s\";", fields[j].id, fields[j].name)
+		}
+_( "		} break;")
+	}
+_( "	}")
+_( "	return 0;")
+_( "}")
+}
+
+int OS_MAIN(int argc, os_char *argv[]) {
+	if_cold (argc != 2) die(1, "wrong number of arguments");
+	srcname = argv[1];
+	int f = os_open_read(argv[1]);
+	if_cold (f == -1) die(100, "couldn't open file");
+	vlong len = os_fsize(f);
+	if_cold (len > 1u << 20) die(2, "input file is far too large");
+	char *s = malloc(len + 1);
+	if_cold (!s) die(100, "couldn't allocate memory");
+	if_cold (os_read(f, s, len) != len) die(100, "couldn't read file");
+	os_close(f);
+	s[len] = '\0';
+	parse(s, len);
+
+	FILE *out = fopen(".build/include/demorecords.gen.h", "wb");
+	if_cold (!out) die(100, "couldn't open demorecords.gen.h");
+	H();
+_( "/*")
+_( " * Encoders for the records in demorecords.txt. chunklets/msg.h and")
+_( " * string.h must be included before this header.")
+_( " *")
+_( " * demorec_size_X() gives the exact size of a record, and demorec_put_X()")
+_( " * writes it, returning the number of bytes written. If none of a record's")
+_( " * fields are variable-length, DEMOREC_X_MAXSZ is also defined as a size")
+_( " * that's always big enough.")
+_( " */")
+_( "")
+	for (int i = 0; i < nrecs; ++i) encoder(out, recs + i);
+	if_cold (fclose(out) == EOF) diewrite();
+
+	out = fopen(".build/include/demorecordsdec.gen.h", "wb");
+	if_cold (!out) die(100, "couldn't open demorecordsdec.gen.h");
+	H();
+	decoders(out);
+	if_cold (fclose(out) == EOF) diewrite();
+	return 0;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -21,6 +21,8 @@ keywords and APIs which have syntactically different equivalents for C++.
 
 #include <stdatomic.h>
 
+#include "fastspin.h"
+
 _Static_assert(sizeof(int) == sizeof(_Atomic int),
 	"This library assumes that ints in memory can be treated as atomic");
 _Static_assert(_Alignof(int) == _Alignof(_Atomic int),
@@ -45,22 +47,44 @@ void _mm_pause(); // don't pull in emmintrin.h for this
 #endif
 #endif
 
+// Timed waits need a monotonic clock to work out how much of the timeout is
+// left after a spurious (or lost-race) wakeup. Milliseconds are good enough.
+#ifdef _WIN32
+unsigned long long __stdcall GetTickCount64(void);
+static inline unsigned long long now_ms(void) { return GetTickCount64(); }
+#else
+#include <time.h>
+static inline unsigned long long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+#endif
+
 #if defined(__linux__)
 
 #include <linux/futex.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 
-// some arches only have a _time64 variant. doesn't actually matter what
-// timespec ABI is used here, as we don't use/expose that functionality
+// some arches only have a _time64 variant. timeouts are always relative and
+// short, so rather than caring what libc thinks a timespec is, just spell out
+// whichever layout the syscall we ended up with expects
 #if !defined(SYS_futex) && defined( SYS_futex_time64)
 #define SYS_futex SYS_futex_time64
+struct futex_ts { long long s, ns; };
+#else
+struct futex_ts { long s, ns; };
 #endif
 
 // glibc and musl have never managed and/or bothered to provide a futex wrapper
 static inline void futex_wait(int *p, int val) {
 	syscall(SYS_futex, p, FUTEX_WAIT, val, (void *)0, (void *)0, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	struct futex_ts ts = {ms / 1000, ms % 1000 * 1000000};
+	syscall(SYS_futex, p, FUTEX_WAIT, val, &ts, (void *)0, 0);
+}
 static inline void futex_wakeall(int *p) {
 	syscall(SYS_futex, p, FUTEX_WAKE, (1u << 31) - 1, (void *)0, (void *)0, 0);
 }
@@ -76,6 +100,10 @@ static inline void futex_wake1(int *p) {
 static inline void futex_wait(int *p, int val) {
 	futex(p, FUTEX_WAIT, val, (void *)0, (void *)0, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
+	futex(p, FUTEX_WAIT, val, &ts, (void *)0, 0);
+}
 static inline void futex_wakeall(int *p) {
 	futex(p, FUTEX_WAKE, (1u << 31) - 1, (void *)0, (void *)0, 0);
 }
@@ -95,6 +123,10 @@ static inline void futex_wake1(int *p) {
 static inline void futex_wait(int *p, int val) {
 	syscall(SYS_futex, p, FUTEX_WAIT, val, (void *)0, (void *)0, 0, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
+	syscall(SYS_futex, p, FUTEX_WAIT, val, &ts, (void *)0, 0, 0);
+}
 static inline void futex_wakeall(int *p) {
 	syscall(SYS_futex, p, FUTEX_WAKE, (1u << 31) - 1, (void *)0, (void *)0, 0, 0);
 }
@@ -110,6 +142,11 @@ static inline void futex_wake1(int *p) {
 static inline void futex_wait(int *p, int val) {
 	_umtx_op(p, UMTX_OP_WAIT_UINT, val, 0, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	// the size of the timeout struct goes in uaddr, for whatever reason
+	struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
+	_umtx_op(p, UMTX_OP_WAIT_UINT, val, (void *)sizeof(ts), &ts);
+}
 static inline void futex_wakeall(int *p) {
 	_umtx_op(p, UMTX_OP_WAKE, p, (1u << 31) - 1, 0, 0);
 }
@@ -125,6 +162,10 @@ static inline void futex_wake1(int *p) {
 static inline void futex_wait(int *p, int val) {
 	umtx_sleep(p, val, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	// microseconds, where 0 means forever. long waits just get cut short
+	umtx_sleep(p, val, ms > 1000000 ? 1000000000 : ms ? ms * 1000 : 1);
+}
 static inline void futex_wakeall(int *p) {
 	umtx_wakeup(p, 0);
 }
@@ -148,6 +189,11 @@ extern int __ulock_wake(unsigned int op, void *addr, unsigned long long val);
 static inline void futex_wait(int *p, int val) {
 	__ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, p, val, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	// same deal as DragonFly: microseconds, 0 is forever, so clamp
+	__ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, p, val,
+			ms > 1000000 ? 1000000000 : ms ? ms * 1000 : 1);
+}
 static inline void futex_wakeall(int *p) {
 	__ulock_wake(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO | ULF_WAKE_ALL, uaddr, 0);
 }
@@ -171,6 +217,10 @@ long __stdcall RtlWakeAddressSingle(void *p);
 static inline void futex_wait(int *p, int val) {
 	RtlWaitOnAddress(p, &val, 4, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	long long t = (long long)ms * -10000; // negative = relative, 100ns units
+	RtlWaitOnAddress(p, &val, 4, &t);
+}
 static inline void futex_wakeall(int *p) {
 	RtlWakeAddressAll(p);
 }
@@ -187,6 +237,10 @@ static inline void futex_wake1(int *p) {
 static inline void futex_wait(int *p, int val) {
 	futex(p, FUTEX_WAIT, val, 0, 0, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
+	futex(p, FUTEX_WAIT, val, &ts, 0, 0);
+}
 static inline void futex_wakeall(int *p) {
 	futex(p, FUTEX_WAKE, 0, 0, 0, 0);
 }
@@ -210,6 +264,149 @@ performance. Need either CPU spinlock hints or futexes, ideally both.
 #define RELAX do; while (0) // avoid having to #ifdef RELAX everywhere now
 #endif
 
+#define FOREVER -1ull // deadline for the non-timed calls
+
+// Per-call bookkeeping for FASTSPIN_STATS. Without that, all of this compiles
+// away to nothing. start is set the first time a caller has to wait at all.
+struct waitstats { unsigned int spins, sleeps; unsigned long long start; };
+
+#ifdef FASTSPIN_STATS
+
+#include <stdint.h>
+
+#ifdef _WIN32
+int __stdcall QueryPerformanceCounter(long long *count);
+int __stdcall QueryPerformanceFrequency(long long *freq);
+static unsigned long long now_us(void) {
+	static long long freq = 0;
+	long long t;
+	if (!freq) QueryPerformanceFrequency(&freq); // can't fail on XP or later
+	QueryPerformanceCounter(&t);
+	return t / freq * 1000000 + t % freq * 1000000 / freq;
+}
+#else
+static unsigned long long now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+#endif
+
+_Static_assert(!(FASTSPIN_STATS_SLOTS & (FASTSPIN_STATS_SLOTS - 1)),
+		"FASTSPIN_STATS_SLOTS must be a power of two");
+
+// Fixed-size open-addressed table keyed on lock address. Counters are updated
+// with relaxed atomics since they only have to add up eventually. Anything
+// that doesn't fit in the table gets lumped into the overflow entry.
+static struct statslot {
+	const volatile int *_Atomic lock;
+	const char *_Atomic label;
+	_Atomic unsigned long long acquires, contended, spins, sleeps;
+	_Atomic unsigned long long waits[FASTSPIN_STATS_BUCKETS];
+} stats[FASTSPIN_STATS_SLOTS], overflow;
+
+static struct statslot *findslot(const volatile int *p) {
+	// locks are often cache-line aligned, so mix the upper bits back down
+	unsigned int h = (unsigned int)((uintptr_t)p / sizeof(int)) * 0x9E3779B9u;
+	h ^= h >> 16;
+	for (int n = 0; n < FASTSPIN_STATS_SLOTS; ++n) {
+		struct statslot *slot = stats + (h + n) % FASTSPIN_STATS_SLOTS;
+		const volatile int *k = atomic_load_explicit(&slot->lock,
+				memory_order_relaxed);
+		if (k == p) return slot;
+		if (!k && atomic_compare_exchange_strong_explicit(&slot->lock, &k, p,
+				memory_order_relaxed, memory_order_relaxed) || k == p) {
+			return slot;
+		}
+	}
+	return &overflow;
+}
+
+static inline void stats_spin(struct waitstats *w) {
+	if (!w->start) w->start = now_us();
+	++w->spins;
+}
+
+static inline void stats_sleep(struct waitstats *w) {
+	if (!w->start) w->start = now_us();
+	++w->sleeps;
+}
+
+static void stats_acquired(const volatile void *p,
+		const struct waitstats *w) {
+	struct statslot *slot = findslot(p);
+	atomic_fetch_add_explicit(&slot->acquires, 1, memory_order_relaxed);
+	if (!w->start) return;
+	atomic_fetch_add_explicit(&slot->contended, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&slot->spins, w->spins, memory_order_relaxed);
+	atomic_fetch_add_explicit(&slot->sleeps, w->sleeps, memory_order_relaxed);
+	unsigned long long us = now_us() - w->start;
+	int b = 0;
+	while (us > 1 && b < FASTSPIN_STATS_BUCKETS - 1) { us >>= 1; ++b; }
+	atomic_fetch_add_explicit(&slot->waits[b], 1, memory_order_relaxed);
+}
+
+static void getslot(struct fastspin_stats *out, struct statslot *slot) {
+	out->lock = atomic_load_explicit(&slot->lock, memory_order_relaxed);
+	out->label = atomic_load_explicit(&slot->label, memory_order_relaxed);
+	out->acquires = atomic_load_explicit(&slot->acquires, memory_order_relaxed);
+	out->contended = atomic_load_explicit(&slot->contended,
+			memory_order_relaxed);
+	out->spins = atomic_load_explicit(&slot->spins, memory_order_relaxed);
+	out->sleeps = atomic_load_explicit(&slot->sleeps, memory_order_relaxed);
+	for (int i = 0; i < FASTSPIN_STATS_BUCKETS; ++i) {
+		out->waits[i] = atomic_load_explicit(&slot->waits[i],
+				memory_order_relaxed);
+	}
+}
+
+int fastspin_stats_get(struct fastspin_stats *out, int max) {
+	int n = 0;
+	for (int i = 0; i < FASTSPIN_STATS_SLOTS && n < max; ++i) {
+		if (atomic_load_explicit(&stats[i].acquires, memory_order_relaxed)) {
+			getslot(out + n++, stats + i);
+		}
+	}
+	if (n < max && atomic_load_explicit(&overflow.acquires,
+			memory_order_relaxed)) {
+		getslot(out + n++, &overflow);
+	}
+	return n;
+}
+
+void fastspin_stats_label(const volatile int *p, const char *label) {
+	atomic_store_explicit(&findslot(p)->label, label, memory_order_relaxed);
+}
+
+static void resetslot(struct statslot *slot) {
+	atomic_store_explicit(&slot->acquires, 0, memory_order_relaxed);
+	atomic_store_explicit(&slot->contended, 0, memory_order_relaxed);
+	atomic_store_explicit(&slot->spins, 0, memory_order_relaxed);
+	atomic_store_explicit(&slot->sleeps, 0, memory_order_relaxed);
+	for (int i = 0; i < FASTSPIN_STATS_BUCKETS; ++i) {
+		atomic_store_explicit(&slot->waits[i], 0, memory_order_relaxed);
+	}
+}
+
+void fastspin_stats_reset(void) {
+	// keep the table entries and labels, just zero all the numbers
+	for (int i = 0; i < FASTSPIN_STATS_SLOTS; ++i) resetslot(stats + i);
+	resetslot(&overflow);
+}
+
+#else
+
+static inline void stats_spin(struct waitstats *w) {}
+static inline void stats_sleep(struct waitstats *w) {}
+static inline void stats_acquired(const volatile void *p,
+		const struct waitstats *w) {}
+
+int fastspin_stats_get(struct fastspin_stats *out, int max) { return -1; }
+void fastspin_stats_label(const volatile int *p, const char *label) {}
+void fastspin_stats_reset(void) {}
+
+#endif
+
 void fastspin_raise(volatile int *p_, int val) {
 	_Atomic int *p = (_Atomic int *)p_;
 #ifdef NO_FUTEX
@@ -223,65 +420,148 @@ void fastspin_raise(volatile int *p_, int val) {
 #endif
 }
 
-int fastspin_wait(volatile int *p_) {
-	_Atomic int *p = (_Atomic int *)p_;
-	int x = atomic_load_explicit(p, memory_order_acquire);
+// how long until deadline, or 0 if it's passed. *p is rechecked by callers
+// whenever this is nonzero, so the exact point in time doesn't matter much
+static inline unsigned int remaining(unsigned long long deadline) {
+	unsigned long long now = now_ms();
+	return now < deadline ? deadline - now : 0;
+}
+
+// Sleeps on *p as long as it's still val, for the futex implementation, or just
+// spins once otherwise. Returns false if the deadline has passed. Callers have
+// to recheck *p either way, since there can always be spurious wakeups.
+static inline _Bool sleepon(_Atomic int *p, int val,
+		unsigned long long deadline, struct waitstats *w) {
+	if (deadline == FOREVER) {
 #ifdef NO_FUTEX
-	if (x) return x;
-	// only need acquire ordering once, then can avoid cache coherence overhead.
-	do {
-		x = atomic_load_explicit(p, memory_order_relaxed);
+		stats_spin(w);
 		RELAX();
-	} while (x);
 #else
+		stats_sleep(w);
+		futex_wait((int *)p, val);
+#endif
+		return 1;
+	}
+	unsigned int ms = remaining(deadline);
+	if (!ms) return 0;
+#ifdef NO_FUTEX
+	stats_spin(w);
+	RELAX();
+#else
+	stats_sleep(w);
+	futex_waitfor((int *)p, val, ms);
+#endif
+	return 1;
+}
+
+static inline void wakeall(_Atomic int *p) {
+#ifndef NO_FUTEX
+	futex_wakeall((int *)p);
+#endif
+}
+
+static int dowait(_Atomic int *p, unsigned long long deadline) {
+	struct waitstats w = {0}; // (only locks and semaphores get counted)
+	int x = atomic_load_explicit(p, memory_order_acquire);
 	if (x > 0) return x;
-	if (!x) {
-		for (int c = 1000; c; --c) {
-			x = atomic_load_explicit(p, memory_order_relaxed);
-			RELAX();
-			if (x > 0) return x;
+#ifdef NO_FUTEX
+	// spin on relaxed loads to avoid cache coherence overhead, then acquire
+	// just once at the end
+	for (unsigned int c = 0;; ++c) {
+		x = atomic_load_explicit(p, memory_order_relaxed);
+		if (x > 0) break;
+		// don't bother looking at the clock every single time round
+		if (!(c & 1023) && deadline != FOREVER && !remaining(deadline)) {
+			return 0;
 		}
-		// cmpxchg a negative (invalid) value. this will fail in two cases:
-		// 1. someone else already cmpxchg'd: the futex_wait() will work fine
-		// 2. raise() was already called: the futex_wait() will return instantly
-		atomic_compare_exchange_strong_explicit(p, &(int){0}, -1,
-				memory_order_acq_rel, memory_order_relaxed);
-		futex_wait((int *)p, -1);
+		RELAX();
 	}
-	return atomic_load_explicit(p, memory_order_relaxed);
+	atomic_thread_fence(memory_order_acquire);
+	return x;
+#else
+	for (int c = 1000; c; --c) {
+		x = atomic_load_explicit(p, memory_order_relaxed);
+		RELAX();
+		if (x > 0) goto r;
+	}
+	// cmpxchg a negative (invalid) value. this will fail in two cases:
+	// 1. someone else already cmpxchg'd: the futex_wait() will work fine
+	// 2. raise() was already called: the futex_wait() will return instantly
+	atomic_compare_exchange_strong_explicit(p, &(int){0}, -1,
+			memory_order_acq_rel, memory_order_relaxed);
+	// loop in case of signals and such waking us up early
+	while ((x = atomic_load_explicit(p, memory_order_relaxed)) <= 0) {
+		if (!sleepon(p, -1, deadline, &w)) return 0;
+	}
+r:	atomic_thread_fence(memory_order_acquire);
+	return x;
 #endif
 }
 
-void fastspin_lock(volatile int *p_) {
-	_Atomic int *p = (_Atomic int *)p_;
-	int x;
-	for (;;) {
+int fastspin_wait(volatile int *p) {
+	return dowait((_Atomic int *)p, FOREVER);
+}
+
+int fastspin_wait_timeout(volatile int *p, unsigned int ms) {
+	return dowait((_Atomic int *)p, now_ms() + ms);
+}
+
+_Bool fastspin_trylock(volatile int *p) {
+	if (atomic_compare_exchange_strong_explicit((_Atomic int *)p, &(int){0},
+			1, memory_order_acquire, memory_order_relaxed)) {
+		stats_acquired(p, &(struct waitstats){0});
+		return 1;
+	}
+	return 0;
+}
+
+static _Bool dolock(_Atomic int *p, unsigned long long deadline) {
+	struct waitstats w = {0};
+	int x = 0;
+	if (atomic_compare_exchange_weak_explicit(p, &x, 1,
+			memory_order_acquire, memory_order_relaxed)) {
+		goto r;
+	}
 #ifdef NO_FUTEX
-		if (!atomic_exchange_explicit(p, 1, memory_order_acquire)) return;
+	for (unsigned int c = 0;;) {
+		if (!atomic_exchange_explicit(p, 1, memory_order_acquire)) goto r;
 		do {
+			if (!(++c & 1023) && deadline != FOREVER && !remaining(deadline)) {
+				return 0;
+			}
 			x = atomic_load_explicit(p, memory_order_relaxed);
+			stats_spin(&w);
 			RELAX();
 		} while (x);
+	}
 #else
-top:	x = 0;
-		if (atomic_compare_exchange_weak_explicit(p, &x, 1,
+	// the lock is 1 if held, or -1 if held with (possibly) someone sleeping on
+	// it, in which case unlock() has to issue a wake
+	for (int c = 1000; c; --c) {
+		x = atomic_load_explicit(p, memory_order_relaxed);
+		stats_spin(&w);
+		RELAX();
+		if (!x && atomic_compare_exchange_weak_explicit(p, &x, 1,
 				memory_order_acquire, memory_order_relaxed)) {
-			return;
-		}
-		if (x) {
-			for (int c = 1000; c; --c) {
-				x = atomic_load_explicit(p, memory_order_relaxed);
-				RELAX();
-				// note: top sets x to 0 unnecessarily but clang actually does
-				// that regardless(!), probably to break loop-carried dependency
-				if (!x) goto top;
-			}
-			atomic_compare_exchange_strong_explicit(p, &(int){0}, -1,
-					memory_order_acq_rel, memory_order_relaxed);
-			futex_wait((int *)p, -1); // (then spin once more to avoid spuria)
+			goto r;
 		}
-#endif
 	}
+	// once we've gone to sleep, we don't know if anyone else has too, so we
+	// have to take the lock as -1 rather than 1 to make sure nobody's stranded
+	while (atomic_exchange_explicit(p, -1, memory_order_acquire)) {
+		if (!sleepon(p, -1, deadline, &w)) return 0;
+	}
+#endif
+r:	stats_acquired(p, &w);
+	return 1;
+}
+
+void fastspin_lock(volatile int *p) {
+	dolock((_Atomic int *)p, FOREVER);
+}
+
+_Bool fastspin_lock_timeout(volatile int *p, unsigned int ms) {
+	return dolock((_Atomic int *)p, now_ms() + ms);
 }
 
 void fastspin_unlock(volatile int *p_) {
@@ -295,4 +575,179 @@ void fastspin_unlock(volatile int *p_) {
 #endif
 }
 
+// Reader-writer locks and semaphores share a flag in the sign bit meaning that
+// someone might be asleep on the value. Whoever changes the value in a way that
+// could let sleepers continue clears the flag and wakes everyone up; anyone who
+// still can't continue just sets it again and goes back to sleep.
+#define SLEEPERS (int)(1u << 31)
+
+// Reader-writer lock bits. WRWANT stops new readers from piling in while a
+// writer is waiting for the existing ones to finish, so that a steady stream of
+// readers can't lock a writer out forever.
+#define WRITER (1 << 30)
+#define WRWANT (1 << 29)
+#define READERS (WRWANT - 1)
+
+// Spins for a bit waiting for (*p & mask) to be 0. Returns the last value seen.
+static inline int spinwhile(_Atomic int *p, int mask, struct waitstats *w) {
+	int x;
+	for (int c = 1000; c; --c) {
+		x = atomic_load_explicit(p, memory_order_relaxed);
+		if (!(x & mask)) break;
+		stats_spin(w);
+		RELAX();
+	}
+	return x;
+}
+
+// Sets the sleeper flag if it isn't already set, and then sleeps if *p hasn't
+// changed in the meantime. Returns false if the deadline has passed.
+static inline _Bool sleepflagged(_Atomic int *p, int x,
+		unsigned long long deadline, struct waitstats *w) {
+	if (x & SLEEPERS || atomic_compare_exchange_weak_explicit(p, &x,
+			x | SLEEPERS, memory_order_relaxed, memory_order_relaxed)) {
+		return sleepon(p, x | SLEEPERS, deadline, w);
+	}
+	return 1;
+}
+
+_Bool fastspin_tryrdlock(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = atomic_load_explicit(p, memory_order_relaxed);
+	while (!(x & (WRITER | WRWANT))) {
+		if (atomic_compare_exchange_weak_explicit(p, &x, x + 1,
+				memory_order_acquire, memory_order_relaxed)) {
+			stats_acquired(p, &(struct waitstats){0});
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void fastspin_rdlock(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	struct waitstats w = {0};
+	for (;;) {
+		int x = spinwhile(p, WRITER | WRWANT, &w);
+		if (!(x & (WRITER | WRWANT))) {
+			if (atomic_compare_exchange_weak_explicit(p, &x, x + 1,
+					memory_order_acquire, memory_order_relaxed)) {
+				stats_acquired(p, &w);
+				return;
+			}
+			continue;
+		}
+		sleepflagged(p, x, FOREVER, &w);
+	}
+}
+
+void fastspin_rdunlock(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = atomic_fetch_sub_explicit(p, 1, memory_order_release);
+	// only the last reader out can let anyone else in (i.e. a writer)
+	if ((x & (READERS | SLEEPERS)) == (1 | SLEEPERS)) {
+		atomic_fetch_and_explicit(p, ~SLEEPERS, memory_order_relaxed);
+		wakeall(p);
+	}
+}
+
+_Bool fastspin_trywrlock(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = atomic_load_explicit(p, memory_order_relaxed);
+	while (!(x & (WRITER | READERS))) {
+		if (atomic_compare_exchange_weak_explicit(p, &x, x | WRITER,
+				memory_order_acquire, memory_order_relaxed)) {
+			stats_acquired(p, &(struct waitstats){0});
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void fastspin_wrlock(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	struct waitstats w = {0};
+	for (;;) {
+		int x = spinwhile(p, WRITER | READERS, &w);
+		if (!(x & (WRITER | READERS))) {
+			// we can take the lock! clear WRWANT as we're that writer now. if
+			// any other writers were waiting, they'll set it again on wakeup
+			if (atomic_compare_exchange_weak_explicit(p, &x,
+					(x & ~WRWANT) | WRITER, memory_order_acquire,
+					memory_order_relaxed)) {
+				stats_acquired(p, &w);
+				return;
+			}
+			continue;
+		}
+		if (!(x & WRWANT)) {
+			// hold off any more readers, then re-evaluate
+			atomic_fetch_or_explicit(p, WRWANT, memory_order_relaxed);
+			continue;
+		}
+		sleepflagged(p, x, FOREVER, &w);
+	}
+}
+
+void fastspin_wrunlock(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	// leave WRWANT in place if it's there, so the writer we're about to wake
+	// gets a chance to go before any more readers
+	int x = atomic_fetch_and_explicit(p, ~(WRITER | SLEEPERS),
+			memory_order_release);
+	if (x & SLEEPERS) wakeall(p);
+}
+
+void fastspin_sem_post(volatile int *p_, int n) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = atomic_fetch_add_explicit(p, n, memory_order_release);
+	if (x & SLEEPERS) {
+		atomic_fetch_and_explicit(p, ~SLEEPERS, memory_order_relaxed);
+		wakeall(p);
+	}
+}
+
+_Bool fastspin_sem_trywait(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = atomic_load_explicit(p, memory_order_relaxed);
+	while (x & ~SLEEPERS) {
+		if (atomic_compare_exchange_weak_explicit(p, &x, x - 1,
+				memory_order_acquire, memory_order_relaxed)) {
+			stats_acquired(p, &(struct waitstats){0});
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static _Bool semwait(_Atomic int *p, unsigned long long deadline) {
+	struct waitstats w = {0};
+	for (;;) {
+		int x;
+		for (int c = 1000; c; --c) {
+			x = atomic_load_explicit(p, memory_order_relaxed);
+			if (x & ~SLEEPERS) break;
+			stats_spin(&w);
+			RELAX();
+		}
+		if (x & ~SLEEPERS) {
+			if (atomic_compare_exchange_weak_explicit(p, &x, x - 1,
+					memory_order_acquire, memory_order_relaxed)) {
+				stats_acquired(p, &w);
+				return 1;
+			}
+			continue;
+		}
+		if (!sleepflagged(p, x, deadline, &w)) return 0;
+	}
+}
+
+void fastspin_sem_wait(volatile int *p) {
+	semwait((_Atomic int *)p, FOREVER);
+}
+
+_Bool fastspin_sem_wait_timeout(volatile int *p, unsigned int ms) {
+	return semwait((_Atomic int *)p, now_ms() + ms);
+}
+
 // vi: sw=4 ts=4 noet tw=80 cc=80
@@ -18,7 +18,10 @@
 #define INC_CHUNKLETS_FASTSPIN_H
 
 #ifdef __cplusplus
+#define _fastspin_Bool bool
 extern "C" {
+#else
+#define _fastspin_Bool _Bool
 #endif
 
 /*
@@ -35,18 +38,141 @@ void fastspin_raise(volatile int *p, int val);
  */
 int fastspin_wait(volatile int *p);
 
+/*
+ * Like fastspin_wait(), but gives up after roughly ms milliseconds, in which
+ * case it returns 0. An event being raised after the timeout is not an error;
+ * a later wait call will pick it up.
+ */
+int fastspin_wait_timeout(volatile int *p, unsigned int ms);
+
 /*
  * Takes a mutual exclusion, i.e. a lock. *p must be initialised to 0 before
  * anything starts using it as a lock.
  */
 void fastspin_lock(volatile int *p);
 
+/*
+ * Takes a lock only if nobody else has it, without waiting at all. Returns true
+ * if the lock was taken, in which case it must later be released as usual.
+ */
+_fastspin_Bool fastspin_trylock(volatile int *p);
+
+/*
+ * Like fastspin_lock(), but gives up after roughly ms milliseconds. Returns
+ * true if the lock was taken, or false if the timeout elapsed first.
+ */
+_fastspin_Bool fastspin_lock_timeout(volatile int *p, unsigned int ms);
+
 /*
  * Releases a lock such that other threads may claim it. Immediately as a lock
  * is released, its value will be 0, as though it had just been initialised.
  */
 void fastspin_unlock(volatile int *p);
 
+/*
+ * Takes a shared (read) lock. Any number of readers can hold the lock at once,
+ * but not while a writer holds it. *p must be initialised to 0 before anything
+ * starts using it as a lock. Read locks are not recursive: once a writer starts
+ * waiting, new readers have to wait too, even if they already hold the lock.
+ */
+void fastspin_rdlock(volatile int *p);
+
+/*
+ * Takes a read lock only if it's available right now. Returns true if the lock
+ * was taken.
+ */
+_fastspin_Bool fastspin_tryrdlock(volatile int *p);
+
+/* Releases a read lock taken by fastspin_rdlock() or fastspin_tryrdlock(). */
+void fastspin_rdunlock(volatile int *p);
+
+/*
+ * Takes an exclusive (write) lock, waiting for any readers to finish. Waiting
+ * writers take priority over newly arriving readers, so they don't get starved.
+ */
+void fastspin_wrlock(volatile int *p);
+
+/*
+ * Takes a write lock only if nobody else holds the lock in any way. Returns
+ * true if the lock was taken.
+ */
+_fastspin_Bool fastspin_trywrlock(volatile int *p);
+
+/*
+ * Releases a write lock. If nothing else was waiting for the lock, its value
+ * will then be 0, as though it had just been initialised.
+ */
+void fastspin_wrunlock(volatile int *p);
+
+/*
+ * Adds n (which must be positive) to a counting semaphore, waking up anything
+ * waiting on it. *p must be initialised to the starting count, which can be 0,
+ * and the count must never go above 2^31 - 1.
+ */
+void fastspin_sem_post(volatile int *p, int n);
+
+/* Waits for a semaphore's count to be nonzero, and then decrements it. */
+void fastspin_sem_wait(volatile int *p);
+
+/*
+ * Decrements a semaphore's count if it's nonzero right now. Returns true if it
+ * did so.
+ */
+_fastspin_Bool fastspin_sem_trywait(volatile int *p);
+
+/*
+ * Like fastspin_sem_wait(), but gives up after roughly ms milliseconds. Returns
+ * true if the count was decremented, or false if the timeout elapsed first.
+ */
+_fastspin_Bool fastspin_sem_wait_timeout(volatile int *p, unsigned int ms);
+
+/*
+ * Contention statistics. These are only recorded if fastspin.c is built with
+ * FASTSPIN_STATS defined, which adds some overhead to every lock operation and
+ * a fair bit more to contended ones. Locks and semaphores are tracked by
+ * address in a fixed-size table whose size can be set by defining
+ * FASTSPIN_STATS_SLOTS (default 64, must be a power of two); anything beyond
+ * that is lumped together in an entry with a null lock pointer. Events are not
+ * tracked.
+ */
+
+#define FASTSPIN_STATS_BUCKETS 16
+#ifndef FASTSPIN_STATS_SLOTS
+#define FASTSPIN_STATS_SLOTS 64
+#endif
+
+struct fastspin_stats {
+	const volatile int *lock; /* the lock this entry is for, or null */
+	const char *label; /* passed to fastspin_stats_label(), or null */
+	unsigned long long acquires; /* total number of times the lock was taken */
+	unsigned long long contended; /* ... of which had to wait at all */
+	unsigned long long spins; /* total CPU spin-wait iterations */
+	unsigned long long sleeps; /* total times a waiter went to sleep */
+	/*
+	 * Histogram of how long contended acquisitions waited. Bucket 0 counts
+	 * waits under 2 microseconds; bucket n counts waits of 2^n to 2^(n+1) - 1
+	 * microseconds; the last bucket also counts anything longer.
+	 */
+	unsigned long long waits[FASTSPIN_STATS_BUCKETS];
+};
+
+/*
+ * Copies statistics for up to max locks into out, skipping any that have not
+ * been taken since the last reset. Returns the number of entries filled in, or
+ * -1 if the library was not built with FASTSPIN_STATS.
+ */
+int fastspin_stats_get(struct fastspin_stats *out, int max);
+
+/*
+ * Gives a lock a name to be reported by fastspin_stats_get(). label must stay
+ * valid for as long as stats might be queried. Does nothing if the library was
+ * not built with FASTSPIN_STATS.
+ */
+void fastspin_stats_label(const volatile int *p, const char *label);
+
+/* Zeroes all statistics, but keeps track of labels. */
+void fastspin_stats_reset(void);
+
 #ifdef __cplusplus
 }
 
@@ -59,6 +185,7 @@ struct fastspin_lock_guard {
 };
 
 #endif
+#undef _fastspin_Bool
 
 #endif
 
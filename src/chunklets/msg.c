@@ -71,31 +71,40 @@ static inline unsigned long long swap64(unsigned long long x) {
 #endif
 #endif
 
-static inline void doput16(unsigned char *out, unsigned char tag,
-		unsigned short val) {
-	out[0] = tag;
+// plain big-endian writes, used on their own for packed arrays (see below)
+static inline void be16(unsigned char *out, unsigned short val) {
 #ifdef USE_BSWAP_NONSENSE
 	// Use swap32() here because x86 and ARM don't have instructions for 16-bit
 	// swaps, and Clang doesn't realise it could just use the 32-bit one anyway.
-	*(unsigned short *)(out + 1) = swap32(val) >> 16;
+	*(unsigned short *)out = swap32(val) >> 16;
 #else
-	out[1] = val >> 8; out[2] = val;
+	out[0] = val >> 8; out[1] = val;
 #endif
 }
 
-static inline void doput32(unsigned char *out, unsigned char tag,
-		unsigned int val) {
-	out[0] = tag;
+static inline void be32(unsigned char *out, unsigned int val) {
 #ifdef USE_BSWAP_NONSENSE
-	*(unsigned int *)(out + 1) = swap32(val);
+	*(unsigned int *)out = swap32(val);
 #else
-	out[1] = val >> 24; out[2] = val >> 16; out[3] = val >> 8; out[4] = val;
+	out[0] = val >> 24; out[1] = val >> 16; out[2] = val >> 8; out[3] = val;
 #endif
 }
 
-static inline void doput64(unsigned char *out, unsigned char tag,
+static inline void doput16(unsigned char *out, unsigned char tag,
+		unsigned short val) {
+	out[0] = tag;
+	be16(out + 1, val);
+}
+
+static inline void doput32(unsigned char *out, unsigned char tag,
 		unsigned int val) {
 	out[0] = tag;
+	be32(out + 1, val);
+}
+
+static inline void doput64(unsigned char *out, unsigned char tag,
+		unsigned long long val) {
+	out[0] = tag;
 #ifdef USE_BSWAP_NONSENSE
 	// Clang is smart enough to make this into two bswaps and a word swap in
 	// 32-bit builds. MSVC seems to be fine too when using the above intrinsics.
@@ -173,13 +182,13 @@ int msg_rputs32(unsigned char *end, int val) {
 }
 
 int msg_putu32(unsigned char *out, unsigned int val) {
-	if (val <= 65536) return msg_putu16(out, val);
+	if (val <= 65535) return msg_putu16(out, val);
 	doput32(out, 0xCE, val);
 	return 5;
 }
 
 int msg_rputu32(unsigned char *end, unsigned int val) {
-	if (val <= 65536) return msg_rputu16(end, val);
+	if (val <= 65535) return msg_rputu16(end, val);
 	doput32(end - 5, 0xCE, val);
 	return 5;
 }
@@ -224,13 +233,13 @@ int msg_putd(unsigned char *out, double val) {
 	// XXX: is this really the most efficient way to check this?
 	float f = val;
 	if ((double)f == val) { msg_putf(out, f); return 5; }
-	doput64(out, 0xCA, doublebits(val)); return 9;
+	doput64(out, 0xCB, doublebits(val)); return 9;
 }
 
 int msg_rputd(unsigned char *end, double val) {
 	float f = val;
 	if ((double)f == val) { msg_rputf(end, f); return 5; }
-	doput64(end - 9, 0xCA, doublebits(val)); return 9;
+	doput64(end - 9, 0xCB, doublebits(val)); return 9;
 }
 
 int msg_putssz8(unsigned char *out, int sz) {
@@ -338,4 +347,201 @@ int msg_rputmsz(unsigned char *end, unsigned int val) {
 	return 5;
 }
 
+// -- Bulk arrays --
+//
+// Every element of an array gets the same representation, wide enough for the
+// largest (or smallest) value, rather than each getting its own smallest one.
+// That way each loop below writes a fixed pattern with no branching, which the
+// compiler can unroll and vectorise, including the byte swapping. The msgpack
+// spec only says that the smallest encoding SHOULD be used, so the result is
+// still perfectly valid for any decoder, and the size difference only comes up
+// when values are spread across ranges.
+
+static inline int uwidth(unsigned int max) {
+	if (max <= 127) return 1;
+	if (max <= 255) return 2;
+	if (max <= 65535) return 3;
+	return 5;
+}
+
+static inline int swidth(int min, int max) {
+	if (min >= -32 && max <= 127) return 1;
+	if (min >= -128 && max <= 127) return 2;
+	if (min >= -32768 && max <= 32767) return 3;
+	return 5;
+}
+
+// A fixnum is just the value's low byte, whether positive or negative, so width
+// 1 is the same for both. The other widths differ only in tags.
+#define PUTUNIFORM(out, vals, n, w, tag8, tag16, tag32) do { \
+	switch (w) { \
+		case 1: \
+			for (unsigned int i = 0; i < n; ++i) out[i] = vals[i]; \
+			break; \
+		case 2: \
+			for (unsigned int i = 0; i < n; ++i) { \
+				out[i * 2] = tag8; out[i * 2 + 1] = vals[i]; \
+			} \
+			break; \
+		case 3: \
+			for (unsigned int i = 0; i < n; ++i) { \
+				doput16(out + i * 3, tag16, vals[i]); \
+			} \
+			break; \
+		default: \
+			for (unsigned int i = 0; i < n; ++i) { \
+				doput32(out + i * 5, tag32, vals[i]); \
+			} \
+	} \
+} while (0)
+
+static inline unsigned char maxu8(const unsigned char *vals, unsigned int n) {
+	unsigned char max = 0;
+	for (unsigned int i = 0; i < n; ++i) if (vals[i] > max) max = vals[i];
+	return max;
+}
+
+static inline unsigned short maxu16(const unsigned short *vals,
+		unsigned int n) {
+	unsigned short max = 0;
+	for (unsigned int i = 0; i < n; ++i) if (vals[i] > max) max = vals[i];
+	return max;
+}
+
+static inline unsigned int maxu32(const unsigned int *vals, unsigned int n) {
+	unsigned int max = 0;
+	for (unsigned int i = 0; i < n; ++i) if (vals[i] > max) max = vals[i];
+	return max;
+}
+
+static inline int widths32(const int *vals, unsigned int n) {
+	int min = 0, max = 0;
+	for (unsigned int i = 0; i < n; ++i) {
+		if (vals[i] < min) min = vals[i];
+		if (vals[i] > max) max = vals[i];
+	}
+	return swidth(min, max);
+}
+
+unsigned int msg_sizeau8(const unsigned char *vals, unsigned int n) {
+	return msg_sizeasz(n) + n * uwidth(maxu8(vals, n));
+}
+
+unsigned int msg_putau8(unsigned char *out, const unsigned char *vals,
+		unsigned int n) {
+	int hdr = msg_putasz(out, n), w = uwidth(maxu8(vals, n));
+	out += hdr;
+	PUTUNIFORM(out, vals, n, w, 0xCC, 0xCD, 0xCE);
+	return hdr + n * w;
+}
+
+unsigned int msg_sizeau16(const unsigned short *vals, unsigned int n) {
+	return msg_sizeasz(n) + n * uwidth(maxu16(vals, n));
+}
+
+unsigned int msg_putau16(unsigned char *out, const unsigned short *vals,
+		unsigned int n) {
+	int hdr = msg_putasz(out, n), w = uwidth(maxu16(vals, n));
+	out += hdr;
+	PUTUNIFORM(out, vals, n, w, 0xCC, 0xCD, 0xCE);
+	return hdr + n * w;
+}
+
+unsigned int msg_sizeau32(const unsigned int *vals, unsigned int n) {
+	return msg_sizeasz(n) + n * uwidth(maxu32(vals, n));
+}
+
+unsigned int msg_putau32(unsigned char *out, const unsigned int *vals,
+		unsigned int n) {
+	int hdr = msg_putasz(out, n), w = uwidth(maxu32(vals, n));
+	out += hdr;
+	PUTUNIFORM(out, vals, n, w, 0xCC, 0xCD, 0xCE);
+	return hdr + n * w;
+}
+
+unsigned int msg_sizeas32(const int *vals, unsigned int n) {
+	return msg_sizeasz(n) + n * widths32(vals, n);
+}
+
+unsigned int msg_putas32(unsigned char *out, const int *vals, unsigned int n) {
+	int hdr = msg_putasz(out, n), w = widths32(vals, n);
+	out += hdr;
+	PUTUNIFORM(out, vals, n, w, 0xD0, 0xD1, 0xD2);
+	return hdr + n * w;
+}
+
+unsigned int msg_putaf(unsigned char *out, const float *vals, unsigned int n) {
+	int hdr = msg_putasz(out, n);
+	out += hdr;
+	for (unsigned int i = 0; i < n; ++i) {
+		doput32(out + i * 5, 0xCA, floatbits(vals[i]));
+	}
+	return hdr + n * 5;
+}
+
+// Packed arrays drop the per-element tags entirely, which also leaves a plain
+// run of byte-swapped values; about the best case there is for vectorisation.
+
+static int putexthdr(unsigned char *out, signed char type, unsigned int len) {
+	switch (len) {
+		// fixext: 0xD4 is 1 byte, 0xD5 is 2 bytes, ... 0xD8 is 16 bytes
+		case 1: out[0] = 0xD4; break;
+		case 2: out[0] = 0xD5; break;
+		case 4: out[0] = 0xD6; break;
+		case 8: out[0] = 0xD7; break;
+		case 16: out[0] = 0xD8; break;
+		default:
+			if (len <= 255) {
+				out[0] = 0xC7; out[1] = len; out[2] = type;
+				return 3;
+			}
+			if (len <= 65535) {
+				doput16(out, 0xC8, len); out[3] = type;
+				return 4;
+			}
+			doput32(out, 0xC9, len); out[5] = type;
+			return 6;
+	}
+	out[1] = type;
+	return 2;
+}
+
+unsigned int msg_putpacku8(unsigned char *out, signed char type,
+		const unsigned char *vals, unsigned int n) {
+	int hdr = putexthdr(out, type, n);
+	out += hdr;
+	for (unsigned int i = 0; i < n; ++i) out[i] = vals[i];
+	return hdr + n;
+}
+
+unsigned int msg_putpacku16(unsigned char *out, signed char type,
+		const unsigned short *vals, unsigned int n) {
+	int hdr = putexthdr(out, type, n * 2);
+	out += hdr;
+	for (unsigned int i = 0; i < n; ++i) be16(out + i * 2, vals[i]);
+	return hdr + n * 2;
+}
+
+unsigned int msg_putpacku32(unsigned char *out, signed char type,
+		const unsigned int *vals, unsigned int n) {
+	int hdr = putexthdr(out, type, n * 4);
+	out += hdr;
+	for (unsigned int i = 0; i < n; ++i) be32(out + i * 4, vals[i]);
+	return hdr + n * 4;
+}
+
+unsigned int msg_putpacks32(unsigned char *out, signed char type,
+		const int *vals, unsigned int n) {
+	// two's complement, so the bits are the same
+	return msg_putpacku32(out, type, (const unsigned int *)vals, n);
+}
+
+unsigned int msg_putpackf(unsigned char *out, signed char type,
+		const float *vals, unsigned int n) {
+	int hdr = putexthdr(out, type, n * 4);
+	out += hdr;
+	for (unsigned int i = 0; i < n; ++i) be32(out + i * 4, floatbits(vals[i]));
+	return hdr + n * 4;
+}
+
 // vi: sw=4 ts=4 noet tw=80 cc=80
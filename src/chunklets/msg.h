@@ -174,10 +174,10 @@ int msg_puts16(unsigned char *out, short val);
  * It is recommended to use msg_rputs() for arbitrary signed values. That
  * function will produce the smallest possible encoding for any value.
  */
-int mmsg_rputs16(unsigned char *end, short val);
+int msg_rputs16(unsigned char *end, short val);
 
 /*
- * Writes the unsigned int `val` in the range [0, 65536] to the buffer `out`.
+ * Writes the unsigned int `val` in the range [0, 65535] to the buffer `out`.
  *
  * `out` must point to at least 3 bytes of space.
  *
@@ -189,7 +189,7 @@ int mmsg_rputs16(unsigned char *end, short val);
 int msg_putu16(unsigned char *out, unsigned short val);
 
 /*
- * Writes the signed int `val` in the range [0, 65536] immediately before the
+ * Writes the signed int `val` in the range [0, 65535] immediately before the
  * pointer `end`.
  *
  * `end` must point immediately beyond at least 3 bytes of space.
@@ -685,7 +685,7 @@ static inline void msg_rputmsz4(unsigned char *end, int sz) {
 }
 
 /*
- * Writes the map size `sz` in the range [0, 65536] to the buffer `out`.
+ * Writes the map size `sz` in the range [0, 65535] to the buffer `out`.
  *
  * `out` must point to at least 3 bytes of space.
  *
@@ -701,7 +701,7 @@ static inline void msg_rputmsz4(unsigned char *end, int sz) {
 int msg_putmsz16(unsigned char *out, int sz);
 
 /*
- * Writes the map size `sz` in the range [0, 65536] immediately before the
+ * Writes the map size `sz` in the range [0, 65535] immediately before the
  * pointer `end`. Values outside this range will produce an undefined encoding.
  *
  * `end` must point immediately beyond least 3 bytes of space.
@@ -731,7 +731,7 @@ int msg_rputmsz16(unsigned char *end, int sz);
 int msg_putmsz(unsigned char *out, unsigned int sz);
 
 /*
- * Writes the map size `sz` in the range [0, 4294967295] immediately before the 
+ * Writes the map size `sz` in the range [0, 4294967295] immediately before the
  * pointer `end`.
  *
  * `end` must point immediately beyond at least 5 bytes of space.
@@ -742,7 +742,179 @@ int msg_putmsz(unsigned char *out, unsigned int sz);
  * N other pairs of messages, each containing a key followed by a value, making
  * up the contents of the map.
  */
-int msg_putmszr(unsigned char *end, unsigned int sz);
+int msg_rputmsz(unsigned char *end, unsigned int sz);
+
+/*
+ * The functions below return the exact number of bytes that the corresponding
+ * put/rput functions above will write for a given value, so that the size of a
+ * whole message can be worked out up front and the message then written in one
+ * go, without either guessing a worst-case buffer size or checking for space
+ * after every value. They're cheap enough that the compiler will usually fold
+ * them into constants wherever the values are known.
+ *
+ * Each one also applies to the fixed-width variants with the same prefix, e.g.
+ * msg_sizeu() gives the size written by msg_putu8() through to msg_putu().
+ */
+
+/* Returns the encoded size of signed int `val`, one of {1, 2, 3, 5, 9}. */
+static inline int msg_sizes(long long val) {
+	if (val >= -32 && val <= 127) return 1;
+	if (val >= -128 && val <= 127) return 2;
+	if (val >= -32768 && val <= 32767) return 3;
+	if (val >= -2147483647 - 1 && val <= 2147483647) return 5;
+	return 9;
+}
+
+/* Returns the encoded size of unsigned int `val`, one of {1, 2, 3, 5, 9}. */
+static inline int msg_sizeu(unsigned long long val) {
+	if (val <= 127) return 1;
+	if (val <= 255) return 2;
+	if (val <= 65535) return 3;
+	if (val <= 4294967295) return 5;
+	return 9;
+}
+
+/*
+ * Returns the encoded size of the double `val` as written by msg_putd(), one of
+ * {5, 9}. Floats written with msg_putf() are always 5 bytes.
+ */
+static inline int msg_sized(double val) {
+	return (double)(float)val == val ? 5 : 9;
+}
+
+/* Returns the encoded size of the string size `sz`, one of {1, 2, 3, 5}. */
+static inline int msg_sizessz(unsigned int sz) {
+	if (sz <= 31) return 1;
+	if (sz <= 255) return 2;
+	if (sz <= 65535) return 3;
+	return 5;
+}
+
+/* Returns the encoded size of the binary blob size `sz`, one of {2, 3, 5}. */
+static inline int msg_sizebsz(unsigned int sz) {
+	if (sz <= 255) return 2;
+	if (sz <= 65535) return 3;
+	return 5;
+}
+
+/* Returns the encoded size of the array size `sz`, one of {1, 3, 5}. */
+static inline int msg_sizeasz(unsigned int sz) {
+	if (sz <= 15) return 1;
+	if (sz <= 65535) return 3;
+	return 5;
+}
+
+/* Returns the encoded size of the map size `sz`, one of {1, 3, 5}. */
+static inline int msg_sizemsz(unsigned int sz) {
+	return msg_sizeasz(sz); // same thresholds, different tags
+}
+
+/*
+ * Returns the total size of a string of `len` bytes, i.e. its encoded size
+ * followed by the string data itself.
+ */
+static inline unsigned int msg_sizestr(unsigned int len) {
+	return msg_sizessz(len) + len;
+}
+
+/*
+ * Returns the total size of a binary blob of `len` bytes, i.e. its encoded size
+ * followed by the data itself.
+ */
+static inline unsigned int msg_sizebin(unsigned int len) {
+	return msg_sizebsz(len) + len;
+}
+
+/*
+ * Returns the total size of an extension value of `len` bytes, as written by
+ * the msg_putpack*() functions below, i.e. its header followed by the data.
+ */
+static inline unsigned int msg_sizeext(unsigned int len) {
+	switch (len) { case 1: case 2: case 4: case 8: case 16: return 2 + len; }
+	if (len <= 255) return 3 + len;
+	if (len <= 65535) return 4 + len;
+	return 6 + len;
+}
+
+/*
+ * The functions below write a whole array of values at once, which is much
+ * faster than one at a time, and also gives more compact output in most cases.
+ *
+ * The msg_puta*() functions write a regular msgpack array, including its size,
+ * which any decoder can handle. Every element is written the same way, using
+ * the smallest representation that fits all of them, so for instance an array
+ * of ints which are all in [-32, 127] takes one byte per element, but a single
+ * large value makes every element take 5 bytes. This is slightly larger than
+ * the usual smallest-possible encoding when values vary wildly, but makes the
+ * encoding loops simple enough for the compiler to vectorise.
+ *
+ * The msg_putpack*() functions instead write an extension value with the given
+ * application-defined `type`, containing the values back to back as fixed-size
+ * big-endian integers or IEEE 754 floats, with no per-element overhead. This is
+ * the most compact and fastest option for numbers that genuinely need their
+ * full width, like positions and angles, but the reader has to know what the
+ * type means in order to unpack it. The data takes up n times the element size,
+ * which must not exceed 4294967295 bytes.
+ *
+ * `out` must point to at least as much space as given by the corresponding
+ * msg_sizea*() function, or msg_sizeext() for packed arrays. The number of
+ * bytes written is returned.
+ */
+
+/* Returns the number of bytes that msg_putau8() will write. */
+unsigned int msg_sizeau8(const unsigned char *vals, unsigned int n);
+
+/* Writes the `n` unsigned bytes in `vals` to `out` as a msgpack array. */
+unsigned int msg_putau8(unsigned char *out, const unsigned char *vals,
+		unsigned int n);
+
+/* Returns the number of bytes that msg_putau16() will write. */
+unsigned int msg_sizeau16(const unsigned short *vals, unsigned int n);
+
+/* Writes the `n` unsigned shorts in `vals` to `out` as a msgpack array. */
+unsigned int msg_putau16(unsigned char *out, const unsigned short *vals,
+		unsigned int n);
+
+/* Returns the number of bytes that msg_putau32() will write. */
+unsigned int msg_sizeau32(const unsigned int *vals, unsigned int n);
+
+/* Writes the `n` unsigned ints in `vals` to `out` as a msgpack array. */
+unsigned int msg_putau32(unsigned char *out, const unsigned int *vals,
+		unsigned int n);
+
+/* Returns the number of bytes that msg_putas32() will write. */
+unsigned int msg_sizeas32(const int *vals, unsigned int n);
+
+/* Writes the `n` signed ints in `vals` to `out` as a msgpack array. */
+unsigned int msg_putas32(unsigned char *out, const int *vals, unsigned int n);
+
+/* Returns the number of bytes that msg_putaf() will write for `n` floats. */
+static inline unsigned int msg_sizeaf(unsigned int n) {
+	return msg_sizeasz(n) + n * 5;
+}
+
+/* Writes the `n` single-precision floats in `vals` to `out` as an array. */
+unsigned int msg_putaf(unsigned char *out, const float *vals, unsigned int n);
+
+/* Writes the `n` unsigned bytes in `vals` to `out` as a packed array. */
+unsigned int msg_putpacku8(unsigned char *out, signed char type,
+		const unsigned char *vals, unsigned int n);
+
+/* Writes the `n` unsigned shorts in `vals` to `out` as a packed array. */
+unsigned int msg_putpacku16(unsigned char *out, signed char type,
+		const unsigned short *vals, unsigned int n);
+
+/* Writes the `n` unsigned ints in `vals` to `out` as a packed array. */
+unsigned int msg_putpacku32(unsigned char *out, signed char type,
+		const unsigned int *vals, unsigned int n);
+
+/* Writes the `n` signed ints in `vals` to `out` as a packed array. */
+unsigned int msg_putpacks32(unsigned char *out, signed char type,
+		const int *vals, unsigned int n);
+
+/* Writes the `n` floats in `vals` to `out` as a packed array. */
+unsigned int msg_putpackf(unsigned char *out, signed char type,
+		const float *vals, unsigned int n);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,33 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include "msgbuild.h"
+
+_Bool msgbuild_grow(struct msgbuild *b, unsigned int n) {
+	if (n > 0xFFFFFFFFu - b->len) return 0;
+	unsigned int want = b->len + n, cap = b->cap ? b->cap : 256;
+	// double up to avoid reallocating for every message, unless doing so would
+	// wrap around, in which case just go for the exact size
+	while (cap < want) cap = cap > 0x7FFFFFFFu ? want : cap * 2;
+	if (cap == b->cap) return 1;
+	unsigned char *buf = (unsigned char *)b->alloc(b->ctx, b->buf, b->cap, cap);
+	if (!buf) return 0;
+	b->buf = buf; b->cap = cap;
+	return 1;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,102 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef INC_CHUNKLETS_MSGBUILD_H
+#define INC_CHUNKLETS_MSGBUILD_H
+
+#ifdef __cplusplus
+#define _msgbuild_Bool bool
+extern "C" {
+#else
+#define _msgbuild_Bool _Bool
+#endif
+
+/*
+ * A growable arena that messages get built up in back to back, to go with the
+ * size functions in msg.h. The idea is to work out the exact size of a message
+ * first, get that much space with msgbuild_alloc(), and then fill it in with
+ * the regular put functions, without any further bounds checking. Once the
+ * messages have been dealt with, msgbuild_reset() makes the space available
+ * again without giving it back, so once the arena has grown to fit a typical
+ * workload, building messages never needs to allocate.
+ *
+ * This library doesn't use libc, so memory comes from a caller-supplied
+ * function. `alloc` is called with the old buffer (null the first time), its
+ * size and the wanted new size, and must return a buffer of the new size with
+ * the old contents copied over (much like realloc()), or null on failure, in
+ * which case the old buffer must be left alone. A new size of 0 means the old
+ * buffer is to be freed, and the return value is ignored.
+ *
+ * Zero-initialise and set `alloc` (and `ctx` if needed), or use
+ * msgbuild_init(), before use.
+ */
+struct msgbuild {
+	unsigned char *buf;
+	unsigned int len, cap; /* bytes used so far, and bytes available */
+	void *(*alloc)(void *ctx, void *old, unsigned int oldsz,
+			unsigned int newsz);
+	void *ctx; /* passed to alloc, for the caller's own use */
+};
+
+/* Initialises `b` to start off empty, getting its memory from `alloc`. */
+static inline void msgbuild_init(struct msgbuild *b,
+		void *(*alloc)(void *, void *, unsigned int, unsigned int), void *ctx) {
+	b->buf = 0; b->len = 0; b->cap = 0; b->alloc = alloc; b->ctx = ctx;
+}
+
+/*
+ * Grows the arena `b` to fit at least `n` more bytes. Returns false if the
+ * allocator fails or the size would exceed 4 GiB, leaving the arena untouched.
+ * This generally doesn't need to be called directly, but can be used to set an
+ * initial size up front.
+ */
+_msgbuild_Bool msgbuild_grow(struct msgbuild *b, unsigned int n);
+
+/*
+ * Appends `n` bytes to the arena `b` and returns a pointer to them, so that a
+ * message of exactly that size can be written there. Returns null if the arena
+ * needs to grow and can't, in which case nothing is appended.
+ *
+ * The pointer is only valid until the next call to msgbuild_alloc(), since the
+ * arena may move when it grows. Use offsets from `buf` to keep track of
+ * anything earlier on.
+ */
+static inline unsigned char *msgbuild_alloc(struct msgbuild *b,
+		unsigned int n) {
+	if (b->cap - b->len < n && !msgbuild_grow(b, n)) return 0;
+	unsigned char *ret = b->buf + b->len;
+	b->len += n;
+	return ret;
+}
+
+/* Empties the arena `b`, keeping its memory around to be reused. */
+static inline void msgbuild_reset(struct msgbuild *b) { b->len = 0; }
+
+/* Frees the memory belonging to `b`, leaving it empty and ready for reuse. */
+static inline void msgbuild_free(struct msgbuild *b) {
+	if (b->buf) b->alloc(b->ctx, b->buf, b->cap, 0);
+	b->buf = 0; b->len = 0; b->cap = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#undef _msgbuild_Bool
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,234 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef __cplusplus
+#error This file should not be compiled as C++. It relies on C-specific union \
+behaviour which is undefined in C++.
+#endif
+
+// _Static_assert needs MSVC >= 2019, and this check is irrelevant on Windows
+#ifndef _MSC_VER
+_Static_assert(
+	(unsigned char)-1 == 255 &&
+	sizeof(short) == 2 &&
+	sizeof(int) == 4 &&
+	sizeof(long long) == 8 &&
+	sizeof(float) == 4 &&
+	sizeof(double) == 8,
+	"this code is only designed for relatively sane environments, plus Windows"
+);
+#endif
+
+#include "msgdec.h"
+
+// Unlike the encoder, there's no byte-swapping trickery here. Every compiler we
+// care about turns these loops into a load and a bswap, and reads are much less
+// of a hot spot than writes anyway, since SST itself never decodes anything.
+static inline unsigned long long getbe(const unsigned char *p, int n) {
+	unsigned long long x = 0;
+	for (int i = 0; i < n; ++i) x = x << 8 | p[i];
+	return x;
+}
+
+// Size of the header of a value starting with `tag`: the tag itself plus any
+// length/type bytes that follow, or the whole value for scalars. This is what
+// has to be contiguous before a value can be decoded.
+static int hdrsize(unsigned char tag) {
+	if (tag < 0xC0 || tag >= 0xE0) return 1; // fixint/fixmap/fixarray/fixstr
+	switch (tag) {
+		case 0xC4: case 0xCC: case 0xD0: case 0xD9: return 2;
+		case 0xC5: case 0xCD: case 0xD1: case 0xDA: case 0xDC: case 0xDE:
+			return 3;
+		case 0xC6: case 0xCA: case 0xCE: case 0xD2: case 0xDB: case 0xDD:
+		case 0xDF:
+			return 5;
+		case 0xCB: case 0xCF: case 0xD3: return 9;
+		case 0xC7: return 3; // ext8: length, type
+		case 0xC8: return 4; // ext16
+		case 0xC9: return 6; // ext32
+		case 0xD4: case 0xD5: case 0xD6: case 0xD7: case 0xD8:
+			return 2; // fixext: type
+	}
+	return 1; // nil, bools, and the invalid 0xC1
+}
+
+// Decodes the header at p, which must have hdrsize() bytes available. For
+// STR/BIN/EXT, sets v->len but not the data slice.
+static int decodehdr(const unsigned char *p, struct msgdec_val *v) {
+	unsigned char tag = *p;
+	v->more = 0;
+	if (tag < 0x80) { v->type = MSGDEC_UINT; v->u = tag; return MSGDEC_OK; }
+	if (tag >= 0xE0) {
+		v->type = MSGDEC_SINT; v->s = (signed char)tag;
+		return MSGDEC_OK;
+	}
+	if (tag < 0x90) {
+		v->type = MSGDEC_MAP; v->n = tag & 15;
+		return MSGDEC_OK;
+	}
+	if (tag < 0xA0) {
+		v->type = MSGDEC_ARRAY; v->n = tag & 15;
+		return MSGDEC_OK;
+	}
+	if (tag < 0xC0) {
+		v->type = MSGDEC_STR; v->len = tag & 31;
+		return MSGDEC_OK;
+	}
+	++p;
+	switch (tag) {
+		case 0xC0: v->type = MSGDEC_NIL; return MSGDEC_OK;
+		case 0xC2: case 0xC3:
+			v->type = MSGDEC_BOOL; v->b = tag & 1;
+			return MSGDEC_OK;
+		case 0xC4: case 0xC5: case 0xC6:
+			v->type = MSGDEC_BIN; v->len = getbe(p, 1 << (tag - 0xC4));
+			return MSGDEC_OK;
+		case 0xC7: case 0xC8: case 0xC9: {
+			int lensz = 1 << (tag - 0xC7);
+			v->type = MSGDEC_EXT;
+			v->len = getbe(p, lensz);
+			v->ext = p[lensz];
+			return MSGDEC_OK;
+		}
+		case 0xCA: {
+			union { unsigned int i; float f; } u = {getbe(p, 4)};
+			v->type = MSGDEC_FLOAT; v->f = u.f;
+			return MSGDEC_OK;
+		}
+		case 0xCB: {
+			union { unsigned long long i; double d; } u = {getbe(p, 8)};
+			v->type = MSGDEC_DOUBLE; v->d = u.d;
+			return MSGDEC_OK;
+		}
+		case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+			v->type = MSGDEC_UINT; v->u = getbe(p, 1 << (tag - 0xCC));
+			return MSGDEC_OK;
+		case 0xD0: case 0xD1: case 0xD2: case 0xD3: {
+			int bits = 8 << (tag - 0xD0);
+			// sign-extend from the top bit of the value
+			long long x = (long long)(getbe(p, bits / 8) << (64 - bits)) >>
+					(64 - bits);
+			if (x >= 0) { v->type = MSGDEC_UINT; v->u = x; }
+			else { v->type = MSGDEC_SINT; v->s = x; }
+			return MSGDEC_OK;
+		}
+		case 0xD4: case 0xD5: case 0xD6: case 0xD7: case 0xD8:
+			v->type = MSGDEC_EXT; v->len = 1 << (tag - 0xD4); v->ext = *p;
+			return MSGDEC_OK;
+		case 0xD9: case 0xDA: case 0xDB:
+			v->type = MSGDEC_STR; v->len = getbe(p, 1 << (tag - 0xD9));
+			return MSGDEC_OK;
+		case 0xDC: case 0xDD:
+			v->type = MSGDEC_ARRAY; v->n = getbe(p, 2 << (tag - 0xDC));
+			return MSGDEC_OK;
+		case 0xDE: case 0xDF:
+			v->type = MSGDEC_MAP; v->n = getbe(p, 2 << (tag - 0xDE));
+			return MSGDEC_OK;
+	}
+	return MSGDEC_BAD; // 0xC1 is never used
+}
+
+static inline _Bool hasdata(int type) {
+	return type == MSGDEC_STR || type == MSGDEC_BIN || type == MSGDEC_EXT;
+}
+
+int msgdec_get(const unsigned char **p, const unsigned char *end,
+		struct msgdec_val *v) {
+	const unsigned char *q = *p;
+	if (q == end) return MSGDEC_SHORT;
+	int sz = hdrsize(*q);
+	if (end - q < sz) return MSGDEC_SHORT;
+	int ret = decodehdr(q, v);
+	if (ret != MSGDEC_OK) return ret;
+	q += sz;
+	if (hasdata(v->type)) {
+		if ((unsigned long long)(end - q) < v->len) return MSGDEC_SHORT;
+		v->data = q;
+		v->datalen = v->len;
+		q += v->len;
+	}
+	*p = q;
+	return MSGDEC_OK;
+}
+
+int msgdec_skip(const unsigned char **p, const unsigned char *end) {
+	const unsigned char *q = *p;
+	// count of values still to skip; maps can have up to 2^33 of them
+	unsigned long long n = 1;
+	do {
+		struct msgdec_val v;
+		int ret = msgdec_get(&q, end, &v);
+		if (ret != MSGDEC_OK) return ret;
+		if (v.type == MSGDEC_ARRAY) n += v.n;
+		else if (v.type == MSGDEC_MAP) n += 2ull * v.n;
+	} while (--n);
+	*p = q;
+	return MSGDEC_OK;
+}
+
+// keeps track of where we are in the structure, for msgdec_stream_atboundary()
+static void account(struct msgdec_stream *s, const struct msgdec_val *v) {
+	if (!s->pending) s->pending = 1;
+	--s->pending;
+	if (v->type == MSGDEC_ARRAY) s->pending += v->n;
+	else if (v->type == MSGDEC_MAP) s->pending += 2ull * v->n;
+}
+
+int msgdec_stream_next(struct msgdec_stream *s, struct msgdec_val *v) {
+	if (s->remain) {
+		if (s->p == s->end) return MSGDEC_SHORT;
+		unsigned int n = s->remain;
+		if ((unsigned long long)(s->end - s->p) < n) n = s->end - s->p;
+		v->type = MSGDEC_CONT;
+		v->data = s->p;
+		v->datalen = n;
+		v->more = s->remain -= n;
+		s->p += n;
+		return MSGDEC_OK;
+	}
+	if (s->p == s->end) return MSGDEC_SHORT;
+	int ret;
+	if (s->hdrlen) {
+		// finish off the header carried over from the previous buffer
+		int sz = hdrsize(s->hdr[0]);
+		while (s->hdrlen < sz && s->p != s->end) s->hdr[s->hdrlen++] = *s->p++;
+		if (s->hdrlen < sz) return MSGDEC_SHORT;
+		ret = decodehdr(s->hdr, v);
+		s->hdrlen = 0;
+	}
+	else {
+		int sz = hdrsize(*s->p);
+		if (s->end - s->p < sz) {
+			while (s->p != s->end) s->hdr[s->hdrlen++] = *s->p++;
+			return MSGDEC_SHORT;
+		}
+		ret = decodehdr(s->p, v);
+		s->p += sz;
+	}
+	if (ret != MSGDEC_OK) return ret;
+	account(s, v);
+	if (hasdata(v->type)) {
+		unsigned int n = v->len;
+		if ((unsigned long long)(s->end - s->p) < n) n = s->end - s->p;
+		v->data = s->p;
+		v->datalen = n;
+		v->more = s->remain = v->len - n;
+		s->p += n;
+	}
+	return MSGDEC_OK;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
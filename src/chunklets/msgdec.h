@@ -0,0 +1,161 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef INC_CHUNKLETS_MSGDEC_H
+#define INC_CHUNKLETS_MSGDEC_H
+
+#ifdef __cplusplus
+#define _msgdec_Bool bool
+extern "C" {
+#else
+#define _msgdec_Bool _Bool
+#endif
+
+/*
+ * The kinds of value that can be decoded. Note that all non-negative integers
+ * come out as MSGDEC_UINT and all negative ones as MSGDEC_SINT, regardless of
+ * which representation was used to encode them.
+ */
+enum msgdec_type {
+	MSGDEC_NIL,
+	MSGDEC_BOOL,
+	MSGDEC_UINT,
+	MSGDEC_SINT,
+	MSGDEC_FLOAT,
+	MSGDEC_DOUBLE,
+	MSGDEC_STR,
+	MSGDEC_BIN,
+	MSGDEC_EXT,
+	MSGDEC_ARRAY, /* followed by `n` more values */
+	MSGDEC_MAP, /* followed by `n` pairs of values, i.e. 2n values */
+	/* streaming only: more data belonging to the preceding STR/BIN/EXT */
+	MSGDEC_CONT
+};
+
+/* Return values of the decoding functions. */
+enum msgdec_status {
+	MSGDEC_BAD = -1, /* malformed input; nothing more can be read */
+	MSGDEC_SHORT, /* input ended partway through a value (or needs feeding) */
+	MSGDEC_OK /* a value was read */
+};
+
+/*
+ * A single decoded value. Arrays and maps only give their sizes; their
+ * contents are then read as individual values in turn.
+ */
+struct msgdec_val {
+	int type; /* enum msgdec_type */
+	signed char ext; /* the extension type, for MSGDEC_EXT */
+	union {
+		_msgdec_Bool b;
+		unsigned long long u;
+		long long s;
+		float f;
+		double d;
+		unsigned int n; /* element/pair count for MSGDEC_ARRAY/MSGDEC_MAP */
+		unsigned int len; /* total length of a STR/BIN/EXT */
+	};
+	/*
+	 * For STR/BIN/EXT/CONT: a slice of the data, pointing into the input
+	 * buffer. Strings are not null-terminated.
+	 */
+	const unsigned char *data;
+	unsigned int datalen;
+	/* streaming only: bytes of data still to follow as MSGDEC_CONT values */
+	unsigned int more;
+};
+
+/*
+ * Decodes a single value from the buffer at `*p`, ending at `end`. On success,
+ * advances `*p` past the value and returns MSGDEC_OK. STR/BIN/EXT data must be
+ * entirely within the buffer and is returned as a single slice (datalen == len,
+ * more == 0).
+ *
+ * Returns MSGDEC_SHORT if the buffer ends before the value does, or MSGDEC_BAD
+ * if the value is malformed. In either case `*p` is left where it was.
+ */
+int msgdec_get(const unsigned char **p, const unsigned char *end,
+		struct msgdec_val *v);
+
+/*
+ * Skips over a whole value from the buffer at `*p`, ending at `end`, including
+ * the entire contents of an array or map. Returns the same as msgdec_get(); on
+ * failure, `*p` is left where it was.
+ *
+ * This doesn't recurse, so arbitrarily deep nesting is not a problem.
+ */
+int msgdec_skip(const unsigned char **p, const unsigned char *end);
+
+/*
+ * State for decoding a stream of values split across any number of separate
+ * buffers, as with SST's custom demo data which gets chopped up into user
+ * message-sized chunks. Nothing gets copied except for value headers (at most
+ * 9 bytes) which happen to straddle two buffers. STR/BIN/EXT data split
+ * across buffers comes out as a first slice followed by MSGDEC_CONT slices.
+ *
+ * Zero-initialise or use msgdec_stream_init() before use.
+ */
+struct msgdec_stream {
+	const unsigned char *p, *end; /* current buffer */
+	/* values remaining in the current top-level value (0 at a boundary) */
+	unsigned long long pending;
+	unsigned int remain; /* STR/BIN/EXT bytes still to hand out */
+	unsigned char hdrlen; /* bytes of a split value header held in hdr */
+	unsigned char hdr[9];
+};
+
+/* (Re)initialises the stream state `s`, discarding any partial input. */
+static inline void msgdec_stream_init(struct msgdec_stream *s) {
+	s->p = 0; s->end = 0; s->pending = 0; s->remain = 0; s->hdrlen = 0;
+}
+
+/*
+ * Hands the next `len` bytes of input to the stream `s`. This should only be
+ * done once msgdec_stream_next() has returned MSGDEC_SHORT, meaning that the
+ * previous buffer has been used up.
+ *
+ * The buffer must remain valid until the next call to msgdec_stream_next()
+ * returns MSGDEC_SHORT, as slices returned up until then may point into it.
+ */
+static inline void msgdec_stream_feed(struct msgdec_stream *s,
+		const unsigned char *buf, unsigned int len) {
+	s->p = buf; s->end = buf + len;
+}
+
+/*
+ * Decodes the next value from the stream `s`. Returns MSGDEC_OK on success,
+ * MSGDEC_SHORT if more input needs to be fed in first, or MSGDEC_BAD if the
+ * input is malformed, after which the stream must be reinitialised.
+ */
+int msgdec_stream_next(struct msgdec_stream *s, struct msgdec_val *v);
+
+/*
+ * Returns true if the stream `s` is between two top-level values, i.e. if
+ * everything read so far has made up complete values.
+ */
+static inline _msgdec_Bool msgdec_stream_atboundary(
+		const struct msgdec_stream *s) {
+	return !s->pending && !s->remain && !s->hdrlen;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#undef _msgdec_Bool
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
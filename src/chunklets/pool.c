@@ -0,0 +1,403 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef __cplusplus
+#error This file should not be compiled as C++. It relies on C-specific \
+keywords and APIs which have syntactically different equivalents for C++.
+#endif
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "cacheline.h"
+#include "fastspin.h"
+#include "pool.h"
+
+#ifdef _WIN32
+// Windows.h is huge and we only need a handful of things from it. These are
+// written to be compatible with its declarations anyway, in case something
+// else includes it too (the tests do, for instance).
+typedef unsigned long (__stdcall *threadfn)(void *);
+void *__stdcall CreateThread(struct _SECURITY_ATTRIBUTES *attrs, size_t stacksz,
+		threadfn fn, void *arg, unsigned long flags, unsigned long *id);
+unsigned long __stdcall WaitForSingleObject(void *h, unsigned long ms);
+int __stdcall CloseHandle(void *h);
+unsigned long __stdcall GetActiveProcessorCount(unsigned short group);
+#define ALL_PROCESSOR_GROUPS 0xffff
+#define INFINITE 0xFFFFFFFF
+typedef void *thread;
+#else
+typedef pthread_t thread;
+#endif
+
+typedef void (*taskfn)(void *ctx);
+struct task { taskfn fn; void *ctx; };
+
+// A thief can read a slot just as the owner reuses it, so both halves of a task
+// are atomic. A torn read can only happen if the slot got reused, in which case
+// the thief's CAS on top fails and the result gets thrown away anyway.
+struct slot { _Atomic(taskfn) fn; void *_Atomic ctx; };
+
+struct ring {
+	size_t mask; // size - 1, where size is a power of 2
+	// Thieves might still be reading from an old ring after it's been replaced
+	// by a bigger one, so old rings are kept around until the pool is freed.
+	struct ring *prev;
+	struct slot slots[];
+};
+
+// Chase-Lev deque, in the C11 formulation from Lê et al., "Correct and
+// Efficient Work-Stealing for Weak Memory Models" (2013). The owner pushes and
+// takes at the bottom, so it works on whatever it most recently split off while
+// that's still warm in cache; thieves take from the top, where the oldest and
+// usually biggest tasks are. Only the owner ever writes bottom, whereas top is
+// fought over by thieves, so the two are kept on separate lines.
+struct deque {
+	_Alignas(CACHELINE_FALSESHARE_SIZE) _Atomic size_t top;
+	_Alignas(CACHELINE_FALSESHARE_SIZE) _Atomic size_t bottom;
+	struct ring *_Atomic ring;
+	struct pool *pool;
+	int self;
+	thread thr;
+};
+
+struct pool {
+	// read-mostly stuff
+	_Alignas(CACHELINE_FALSESHARE_SIZE) int nthreads;
+	_Atomic _Bool quit;
+	void *mem; // what was actually allocated, since we align by hand
+	// written by every task completion
+	_Alignas(CACHELINE_FALSESHARE_SIZE) _Atomic int pending;
+	volatile int done; // raised when pending drops to 0
+	// idle workers sleep on the wake semaphore. nsleeping is how many of them
+	// there are, less any that have already had a wakeup posted for them
+	_Alignas(CACHELINE_FALSESHARE_SIZE) _Atomic int nsleeping;
+	volatile int wake;
+	// tasks submitted from outside the pool go here, since the deques can only
+	// be pushed to by their owners. head and tail are only atomic so that
+	// workers can peek without taking the lock
+	_Alignas(CACHELINE_FALSESHARE_SIZE) volatile int inlock;
+	_Atomic size_t inhead, intail;
+	size_t incap; // 0 or a power of 2
+	struct task *inbox;
+	struct deque deques[];
+};
+
+// the deque of the current thread, if it's a worker
+static _Thread_local struct deque *curdeque = 0;
+
+#define LOAD(x, o) atomic_load_explicit(&(x), memory_order_##o)
+#define STORE(x, v, o) atomic_store_explicit(&(x), (v), memory_order_##o)
+
+static struct ring *newring(size_t size, struct ring *prev) {
+	struct ring *r = malloc(offsetof(struct ring, slots) +
+			size * sizeof(struct slot));
+	if (!r) return 0;
+	r->mask = size - 1;
+	r->prev = prev;
+	return r;
+}
+
+static _Bool push(struct deque *q, taskfn fn, void *ctx) {
+	size_t b = LOAD(q->bottom, relaxed), t = LOAD(q->top, acquire);
+	struct ring *r = LOAD(q->ring, relaxed);
+	if (b - t > r->mask) {
+		struct ring *bigger = newring((r->mask + 1) * 2, r);
+		if (!bigger) return 0;
+		for (size_t i = t; i != b; ++i) {
+			struct slot *from = r->slots + (i & r->mask);
+			struct slot *to = bigger->slots + (i & bigger->mask);
+			STORE(to->fn, LOAD(from->fn, relaxed), relaxed);
+			STORE(to->ctx, LOAD(from->ctx, relaxed), relaxed);
+		}
+		STORE(q->ring, bigger, release);
+		r = bigger;
+	}
+	struct slot *s = r->slots + (b & r->mask);
+	STORE(s->fn, fn, relaxed);
+	STORE(s->ctx, ctx, relaxed);
+	atomic_thread_fence(memory_order_release);
+	STORE(q->bottom, b + 1, relaxed);
+	return 1;
+}
+
+static _Bool take(struct deque *q, struct task *out) {
+	size_t b = LOAD(q->bottom, relaxed) - 1;
+	struct ring *r = LOAD(q->ring, relaxed);
+	STORE(q->bottom, b, relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	size_t t = LOAD(q->top, relaxed);
+	if ((ptrdiff_t)(b - t) < 0) { // was already empty
+		STORE(q->bottom, b + 1, relaxed);
+		return 0;
+	}
+	struct slot *s = r->slots + (b & r->mask);
+	out->fn = LOAD(s->fn, relaxed);
+	out->ctx = LOAD(s->ctx, relaxed);
+	if (b != t) return 1;
+	// this is the last task, so thieves might be going for it too
+	_Bool won = atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+			memory_order_seq_cst, memory_order_relaxed);
+	STORE(q->bottom, b + 1, relaxed);
+	return won;
+}
+
+// returns 1 on success, 0 if there's nothing to steal, or -1 if someone else
+// got in first, in which case there might still be more to steal
+static int steal(struct deque *q, struct task *out) {
+	size_t t = LOAD(q->top, acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	size_t b = LOAD(q->bottom, acquire);
+	if ((ptrdiff_t)(b - t) <= 0) return 0;
+	struct ring *r = LOAD(q->ring, acquire);
+	struct slot *s = r->slots + (t & r->mask);
+	out->fn = LOAD(s->fn, relaxed);
+	out->ctx = LOAD(s->ctx, relaxed);
+	if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+			memory_order_seq_cst, memory_order_relaxed)) {
+		return -1;
+	}
+	return 1;
+}
+
+static _Bool inbox_push(struct pool *p, taskfn fn, void *ctx) {
+	fastspin_lock(&p->inlock);
+	size_t head = LOAD(p->inhead, relaxed), tail = LOAD(p->intail, relaxed);
+	if (tail - head == p->incap) {
+		size_t cap = p->incap ? p->incap * 2 : 64;
+		struct task *tasks = malloc(cap * sizeof(*tasks));
+		if (!tasks) { fastspin_unlock(&p->inlock); return 0; }
+		for (size_t i = head; i != tail; ++i) {
+			tasks[i & cap - 1] = p->inbox[i & p->incap - 1];
+		}
+		free(p->inbox);
+		p->inbox = tasks;
+		p->incap = cap;
+	}
+	p->inbox[tail & p->incap - 1] = (struct task){fn, ctx};
+	STORE(p->intail, tail + 1, relaxed);
+	fastspin_unlock(&p->inlock);
+	return 1;
+}
+
+static _Bool inbox_pop(struct pool *p, struct task *out) {
+	if (LOAD(p->intail, relaxed) == LOAD(p->inhead, relaxed)) return 0;
+	fastspin_lock(&p->inlock);
+	size_t head = LOAD(p->inhead, relaxed);
+	_Bool ret = LOAD(p->intail, relaxed) != head;
+	if (ret) {
+		*out = p->inbox[head & p->incap - 1];
+		STORE(p->inhead, head + 1, relaxed);
+	}
+	fastspin_unlock(&p->inlock);
+	return ret;
+}
+
+static _Bool findwork(struct pool *p, struct deque *self, unsigned int *seed,
+		struct task *out) {
+	if (take(self, out) || inbox_pop(p, out)) return 1;
+	// start stealing from different places so everyone doesn't pile onto the
+	// same victim at once
+	*seed = *seed * 1103515245 + 12345;
+	int n = p->nthreads, start = (*seed >> 16) % n;
+	_Bool lost;
+	do {
+		lost = 0;
+		for (int i = 0; i < n; ++i) {
+			struct deque *q = p->deques + (start + i) % n;
+			if (q == self) continue;
+			int ret = steal(q, out);
+			if (ret > 0) return 1;
+			if (ret < 0) lost = 1;
+		}
+	} while (lost);
+	return 0;
+}
+
+static _Bool haswork(struct pool *p) {
+	if (LOAD(p->intail, relaxed) != LOAD(p->inhead, relaxed)) return 1;
+	for (int i = 0; i < p->nthreads; ++i) {
+		struct deque *q = p->deques + i;
+		if ((ptrdiff_t)(LOAD(q->bottom, relaxed) - LOAD(q->top, relaxed)) > 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Submitters and sleepers each do a store (to a deque or nsleeping), a fence,
+// then a load of the other thing. That way at least one of them is bound to see
+// the other, so a task can't be left sitting around while everyone sleeps.
+static void wakeone(struct pool *p) {
+	atomic_thread_fence(memory_order_seq_cst);
+	int n = LOAD(p->nsleeping, relaxed);
+	while (n > 0) {
+		if (atomic_compare_exchange_weak_explicit(&p->nsleeping, &n, n - 1,
+				memory_order_relaxed, memory_order_relaxed)) {
+			fastspin_sem_post(&p->wake, 1);
+			return;
+		}
+	}
+}
+
+static void taskdone(struct pool *p) {
+	if (atomic_fetch_sub_explicit(&p->pending, 1, memory_order_acq_rel) == 1) {
+		fastspin_raise(&p->done, 1);
+	}
+}
+
+static void work(struct deque *self) {
+	struct pool *p = self->pool;
+	curdeque = self;
+	unsigned int seed = self->self * 2654435761u + 1;
+	for (;;) {
+		struct task t;
+		// have a few goes before sleeping, since going to sleep and being woken
+		// up again costs a lot more than a few trips through everyone's deques
+		for (int tries = 0; tries < 16; ++tries) {
+			if (findwork(p, self, &seed, &t)) goto run;
+		}
+		atomic_fetch_add_explicit(&p->nsleeping, 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (LOAD(p->quit, acquire)) return;
+		if (haswork(p)) {
+			// never mind! take ourselves back off the count. if a submitter
+			// already did that for us, it's also posted a wakeup, which no one
+			// else needs, so soak it up to avoid a pointless spurious wakeup
+			int n = LOAD(p->nsleeping, relaxed);
+			while (n > 0 && !atomic_compare_exchange_weak_explicit(
+					&p->nsleeping, &n, n - 1, memory_order_relaxed,
+					memory_order_relaxed));
+			if (!n) fastspin_sem_wait(&p->wake);
+			continue;
+		}
+		fastspin_sem_wait(&p->wake);
+		if (LOAD(p->quit, acquire)) return;
+		continue;
+run:	t.fn(t.ctx);
+		taskdone(p);
+	}
+}
+
+#ifdef _WIN32
+static unsigned long __stdcall threadmain(void *q) {
+#else
+static void *threadmain(void *q) {
+#endif
+	work(q);
+	return 0;
+}
+
+static int ncpus(void) {
+#ifdef _WIN32
+	int n = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+#else
+	int n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return n > 0 ? n : 1;
+}
+
+static void freeall(struct pool *p) {
+	for (int i = 0; i < p->nthreads; ++i) {
+		for (struct ring *r = p->deques[i].ring, *prev; r; r = prev) {
+			prev = r->prev;
+			free(r);
+		}
+	}
+	free(p->inbox);
+	free(p->mem);
+}
+
+static void joinall(struct pool *p, int n) {
+	for (int i = 0; i < n; ++i) {
+#ifdef _WIN32
+		WaitForSingleObject(p->deques[i].thr, INFINITE);
+		CloseHandle(p->deques[i].thr);
+#else
+		pthread_join(p->deques[i].thr, 0);
+#endif
+	}
+}
+
+struct pool *pool_start(int nthreads) {
+	if (!nthreads) nthreads = ncpus();
+	// no aligned_alloc() in UCRT, so over-allocate and align by hand
+	enum { ALIGN = _Alignof(struct pool) };
+	void *mem = calloc(1, sizeof(struct pool) +
+			nthreads * sizeof(struct deque) + ALIGN - 1);
+	if (!mem) return 0;
+	struct pool *p = (struct pool *)((uintptr_t)mem + ALIGN - 1 &
+			~(uintptr_t)(ALIGN - 1));
+	p->mem = mem;
+	p->nthreads = nthreads;
+	// the caller holds a reference until pool_finish(), so that pending can't
+	// hit 0 early if the workers manage to keep up with the submissions
+	p->pending = 1;
+	for (int i = 0; i < nthreads; ++i) {
+		p->deques[i].pool = p;
+		p->deques[i].self = i;
+		if (!(p->deques[i].ring = newring(64, 0))) goto e;
+	}
+	int i = 0;
+	for (; i < nthreads; ++i) {
+#ifdef _WIN32
+		p->deques[i].thr = CreateThread(0, 0, &threadmain, p->deques + i, 0, 0);
+		if (!p->deques[i].thr) goto e2;
+#else
+		if (pthread_create(&p->deques[i].thr, 0, &threadmain, p->deques + i)) {
+			goto e2;
+		}
+#endif
+	}
+	return p;
+e2:	// tell any threads we did manage to start to stop, before freeing stuff
+	STORE(p->quit, 1, release);
+	fastspin_sem_post(&p->wake, i);
+	joinall(p, i);
+e:	freeall(p);
+	return 0;
+}
+
+int pool_nthreads(const struct pool *p) { return p->nthreads; }
+
+void pool_submit(struct pool *p, void (*fn)(void *ctx), void *ctx) {
+	atomic_fetch_add_explicit(&p->pending, 1, memory_order_relaxed);
+	struct deque *q = curdeque;
+	if (!(q && q->pool == p ? push(q, fn, ctx) : inbox_push(p, fn, ctx))) {
+		// out of memory: not much else we can do but run it right here
+		fn(ctx);
+		taskdone(p);
+		return;
+	}
+	wakeone(p);
+}
+
+void pool_finish(struct pool *p) {
+	taskdone(p); // drop the caller's reference
+	fastspin_wait(&p->done);
+	STORE(p->quit, 1, release);
+	fastspin_sem_post(&p->wake, p->nthreads);
+	joinall(p, p->nthreads);
+	freeall(p);
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,63 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef INC_CHUNKLETS_POOL_H
+#define INC_CHUNKLETS_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A small work-stealing thread pool. Each worker has its own deque of tasks: it
+ * pushes and pops tasks at one end, and when it runs dry it steals from the
+ * other end of someone else's. Tasks can submit more tasks, which is how big
+ * jobs get split up. Workers with nothing to do go to sleep until more work
+ * turns up, so an idle pool costs nothing.
+ */
+struct pool;
+
+/*
+ * Starts a pool with the given number of worker threads, or one per CPU if
+ * nthreads is 0. Returns null if something goes wrong.
+ */
+struct pool *pool_start(int nthreads);
+
+/* Returns the number of worker threads in the pool. */
+int pool_nthreads(const struct pool *p);
+
+/*
+ * Queues up fn to be called with ctx on some worker thread. Can be called from
+ * any thread, including from inside another task. Tasks submitted from inside
+ * a task go on that worker's own deque, so that related work tends to stay on
+ * the same CPU unless someone else is idle.
+ */
+void pool_submit(struct pool *p, void (*fn)(void *ctx), void *ctx);
+
+/*
+ * Waits for all tasks to finish, including any tasks they submitted, and then
+ * stops the worker threads and frees the pool. Only one thread should call
+ * this, and it must not be a worker thread.
+ */
+void pool_finish(struct pool *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
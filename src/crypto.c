@@ -27,4 +27,19 @@ int crypto_aead_unlock_djb(u8 *plain_text, const u8  mac[16], const u8 key[32],
 	return mismatch;
 }
 
+int crypto_aead_check_djb(const u8 mac[16], const u8 key[32],
+                          const u8 nonce[8], const u8 *ad, size_t ad_size,
+                          const u8 *cipher_text, size_t text_size)
+{
+	// same as crypto_aead_read(), minus the decryption
+	u8 auth_key[32];
+	u8 real_mac[16];
+	crypto_chacha20_djb(auth_key, 0, 32, key, nonce, 0);
+	lock_auth(real_mac, auth_key, ad, ad_size, cipher_text, text_size);
+	int mismatch = crypto_verify16(mac, real_mac);
+	WIPE_BUFFER(auth_key);
+	WIPE_BUFFER(real_mac);
+	return mismatch;
+}
+
 // vi: sw=4 ts=4 noet tw=80 cc=80
@@ -19,6 +19,12 @@ int crypto_aead_unlock_djb(uint8_t       *plain_text,
                            const uint8_t  nonce[8],
                            const uint8_t *ad,          size_t ad_size,
                            const uint8_t *cipher_text, size_t text_size);
+// checks the mac only, without decrypting, for offline verification
+int crypto_aead_check_djb(const uint8_t  mac  [16],
+                          const uint8_t  key  [32],
+                          const uint8_t  nonce[8],
+                          const uint8_t *ad,          size_t ad_size,
+                          const uint8_t *cipher_text, size_t text_size);
 
 #endif
 
@@ -0,0 +1,415 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include "democache.h"
+#include "demodefs.h"
+#include "intdefs.h"
+#include "langext.h"
+#include "os.h"
+
+#define VERSION 1
+
+#ifdef _WIN32
+#define fS "S"
+#else
+#define fS "s"
+#endif
+
+struct filehdr {
+	char magic[8]; // "SSTDMCH"
+	uint version, n, strsz;
+	// these catch a cache being shared between different platforms/builds
+	ushort entsz, charsz;
+};
+
+static const char magic[8] = "SSTDMCH";
+
+// a demo file found in the directory listing
+struct file {
+	os_char *name;
+	int namelen, runlen;
+	uint num;
+	uvlong size;
+	vlong mtime;
+};
+
+static void parsename(struct file *f) {
+	int baselen = f->namelen - 4; // (.dem)
+	f->runlen = baselen;
+	f->num = 1;
+	// autorecord names the second and later demos foo_2.dem, foo_3.dem, etc.
+	int i = baselen;
+	uint num = 0;
+	while (i > 0 && f->name[i - 1] >= '0' && f->name[i - 1] <= '9') --i;
+	if (i == baselen || i < 2 || f->name[i - 1] != '_') return;
+	if (baselen - i > 9) return; // too long to be a demo number
+	for (int j = i; j < baselen; ++j) num = num * 10 + f->name[j] - '0';
+	f->runlen = i - 1;
+	f->num = num;
+}
+
+static int cmpspan(const os_char *a, int alen, const os_char *b, int blen) {
+	int n = alen < blen ? alen : blen;
+	for (int i = 0; i < n; ++i) if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+	return alen - blen;
+}
+
+// sorts by run name, then demo number, then by whole name, just in case
+static int cmpfile(const struct file *a, const struct file *b) {
+	int r = cmpspan(a->name, a->runlen, b->name, b->runlen);
+	if (r) return r;
+	if (a->num != b->num) return a->num < b->num ? -1 : 1;
+	return cmpspan(a->name, a->namelen, b->name, b->namelen);
+}
+
+static int qcmpfile(const void *a, const void *b) { return cmpfile(a, b); }
+
+static bool isdemo(const os_char *name, int len) {
+	return len > 4 && name[len - 4] == '.' && name[len - 3] == 'd' &&
+			name[len - 2] == 'e' && name[len - 1] == 'm';
+}
+
+struct listing {
+	struct file *files;
+	int n, cap;
+};
+
+static void freelisting(struct listing *l) {
+	for (int i = 0; i < l->n; ++i) free(l->files[i].name);
+	free(l->files);
+}
+
+static bool addfile(struct listing *l, const os_char *name, int namelen,
+		uvlong size, vlong mtime) {
+	if (l->n == l->cap) {
+		int cap = l->cap ? l->cap * 2 : 256;
+		struct file *files = realloc(l->files, cap * sizeof(*files));
+		if_cold (!files) return false;
+		l->files = files; l->cap = cap;
+	}
+	os_char *copy = malloc((namelen + 1) * sizeof(os_char));
+	if_cold (!copy) return false;
+	os_spancopy(copy, name, namelen + 1);
+	struct file *f = l->files + l->n++;
+	*f = (struct file){copy, namelen, 0, 0, size, mtime};
+	parsename(f);
+	return true;
+}
+
+// joins dir and name into buf, which is PATH_MAX long; false if that's too short
+static bool joinpath(os_char *buf, const os_char *dir, const os_char *name,
+		int namelen) {
+	int dirlen = os_strlen(dir);
+	if_cold (dirlen + 1 + namelen + 1 > PATH_MAX) return false;
+	os_spancopy(buf, dir, dirlen);
+	buf[dirlen] = OS_LIT('/');
+	os_spancopy(buf + dirlen + 1, name, namelen + 1);
+	return true;
+}
+
+static bool list(struct listing *l, const os_char *dir) {
+	os_char path[PATH_MAX];
+#ifdef _WIN32
+	if_cold (!joinpath(path, dir, L"*.dem", 5)) return false;
+	WIN32_FIND_DATAW fd;
+	HANDLE h = FindFirstFileW(path, &fd);
+	if (h == INVALID_HANDLE_VALUE) {
+		// an empty directory is fine, anything else isn't
+		return GetLastError() == ERROR_FILE_NOT_FOUND;
+	}
+	bool ok = true;
+	do {
+		int len = os_strlen(fd.cFileName);
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+		// *.dem also matches .demo etc., thanks to 8.3 names
+		if (!isdemo(fd.cFileName, len)) continue;
+		uvlong size = (uvlong)fd.nFileSizeHigh << 32 | fd.nFileSizeLow;
+		vlong mtime = (vlong)fd.ftLastWriteTime.dwHighDateTime << 32 |
+				fd.ftLastWriteTime.dwLowDateTime;
+		if_cold (!addfile(l, fd.cFileName, len, size, mtime)) {
+			ok = false;
+			break;
+		}
+	} while (FindNextFileW(h, &fd));
+	FindClose(h);
+	return ok;
+#else
+	DIR *d = opendir(dir);
+	if_cold (!d) return false;
+	bool ok = true;
+	for (struct dirent *ent; ent = readdir(d);) {
+		int len = strlen(ent->d_name);
+		if (!isdemo(ent->d_name, len)) continue;
+		// unlike on Windows, we have to stat each file for its size and time,
+		// but at least this is just the inode and not the file's contents
+		struct os_stat s;
+		if (!joinpath(path, dir, ent->d_name, len)) continue;
+		if (os_stat(path, &s) == -1 || !S_ISREG(s.st_mode)) continue;
+		// nanoseconds, so that rewriting a file within a second gets noticed
+		vlong mtime = (vlong)s.st_mtim.tv_sec * 1000000000 + s.st_mtim.tv_nsec;
+		if_cold (!addfile(l, ent->d_name, len, s.st_size, mtime)) {
+			ok = false;
+			break;
+		}
+	}
+	closedir(d);
+	return ok;
+#endif
+}
+
+// appends n bytes to the string table, aligned to align. returns the offset
+static bool addstr(struct democache *c, uint *cap, const void *s, uint n,
+		uint align, uint *off) {
+	uint start = (c->strsz + align - 1) & ~(align - 1);
+	if (start + n > *cap) {
+		uint newcap = *cap ? *cap * 2 : 65536;
+		while (newcap < start + n) newcap *= 2;
+		char *strs = realloc(c->strs, newcap);
+		if_cold (!strs) return false;
+		c->strs = strs; *cap = newcap;
+	}
+	memset(c->strs + c->strsz, 0, start - c->strsz);
+	memcpy(c->strs + start, s, n);
+	c->strsz = start + n;
+	*off = start;
+	return true;
+}
+
+static void readhdr(const os_char *dir, const struct file *f,
+		struct democache_ent *e, struct demo_hdr *h) {
+	os_char path[PATH_MAX];
+	e->demover = 0;
+	if (!joinpath(path, dir, f->name, f->namelen)) return;
+	int fd = os_open_read(path);
+	if (fd == -1) return;
+	int n = os_read(fd, h, sizeof(*h));
+	os_close(fd);
+	if (n != sizeof(*h) || memcmp(h->sig, "HL2DEMO", 8)) return;
+	e->demover = h->demover;
+	e->netver = h->netver;
+	e->nticks = h->nticks;
+	e->nframes = h->nframes;
+	e->realtime = h->realtime;
+}
+
+// maps the existing cache file, if there's a usable one
+static const struct filehdr *mapcache(const os_char *path, usize *sz) {
+	int fd = os_open_read(path);
+	if (fd == -1) return 0;
+	vlong len = os_fsize(fd);
+	const struct filehdr *h = 0;
+	if (len >= ssizeof(*h)) h = os_mapfile(fd, len);
+	os_close(fd);
+	if (!h) return 0;
+	if (memcmp(h->magic, magic, sizeof(magic)) || h->version != VERSION ||
+			h->entsz != sizeof(struct democache_ent) ||
+			h->charsz != sizeof(os_char) || sizeof(*h) +
+			(uvlong)h->n * sizeof(struct democache_ent) + h->strsz != len) {
+		os_unmapfile(h, len);
+		return 0;
+	}
+	*sz = len;
+	return h;
+}
+
+static bool writecache(const struct democache *c, const os_char *path) {
+	int fd = os_open_writetrunc(path);
+	if_cold (fd == -1) return false;
+	struct filehdr h = {
+		.version = VERSION, .n = c->n, .strsz = c->strsz,
+		.entsz = sizeof(struct democache_ent), .charsz = sizeof(os_char)
+	};
+	memcpy(h.magic, magic, sizeof(magic));
+	struct { const void *p; usize n; } parts[] = {
+		{&h, sizeof(h)}, {c->ents, c->n * sizeof(*c->ents)}, {c->strs, c->strsz}
+	};
+	bool ok = true;
+	for (int i = 0; ok && i < countof(parts); ++i) {
+		for (const char *p = parts[i].p, *end = p + parts[i].n; p < end;) {
+			int n = os_write(fd, p, end - p > 1 << 30 ? 1 << 30 : end - p);
+			if_cold (n <= 0) { ok = false; break; }
+			p += n;
+		}
+	}
+	os_close(fd);
+	// a half-written cache will get rejected by the size check next time
+	return ok;
+}
+
+bool democache_load(struct democache *c, const os_char *dir) {
+	*c = (struct democache){0};
+	struct listing l = {0};
+	if_cold (!list(&l, dir)) { freelisting(&l); return false; }
+	qsort(l.files, l.n, sizeof(*l.files), &qcmpfile);
+	if (l.n) {
+		c->ents = malloc(l.n * sizeof(*c->ents));
+		if_cold (!c->ents) { freelisting(&l); return false; }
+	}
+	os_char cachepath[PATH_MAX];
+	static const os_char cachename[] = OS_LIT(DEMOCACHE_FILENAME);
+	bool havepath = joinpath(cachepath, dir, cachename, countof(cachename) - 1);
+	usize oldsz;
+	const struct filehdr *old = havepath ? mapcache(cachepath, &oldsz) : 0;
+	const struct democache_ent *oldents = old ?
+			(const struct democache_ent *)(old + 1) : 0;
+	const char *oldstrs = old ? (const char *)(oldents + old->n) : 0;
+	int nold = old ? old->n : 0, j = 0;
+	uint strcap = 0;
+	// both lists are in the same order, so just walk through them together
+	for (int i = 0; i < l.n; ++i) {
+		const struct file *f = l.files + i;
+		struct democache_ent *e = c->ents + i;
+		const struct democache_ent *o = 0;
+		for (; j < nold; ++j) {
+			const struct democache_ent *cand = oldents + j;
+			struct file of = {0};
+			if_cold ((uvlong)cand->nameoff + cand->namelen * sizeof(os_char) >
+					old->strsz || (uvlong)cand->mapoff + cand->maplen >
+					old->strsz || cand->runlen > cand->namelen) {
+				nold = j; // bogus; ignore the rest of the cache
+				break;
+			}
+			of.name = (os_char *)(oldstrs + cand->nameoff);
+			of.namelen = cand->namelen; of.runlen = cand->runlen;
+			of.num = cand->num;
+			int r = cmpfile(&of, f);
+			if (r > 0) break;
+			if (r == 0) {
+				if (cand->size == f->size && cand->mtime == f->mtime) o = cand;
+				++j;
+				break;
+			}
+		}
+		const char *map;
+		uint maplen;
+		struct demo_hdr h;
+		if (o) {
+			*e = *o;
+			map = oldstrs + o->mapoff;
+			maplen = o->maplen;
+		}
+		else {
+			*e = (struct democache_ent){.size = f->size, .mtime = f->mtime};
+			readhdr(dir, f, e, &h);
+			++c->nread;
+			if (e->demover) {
+				map = h.mapname;
+				maplen = strnlen(h.mapname, sizeof(h.mapname));
+			}
+			else {
+				map = ""; maplen = 0;
+			}
+		}
+		e->num = f->num;
+		e->namelen = f->namelen;
+		e->runlen = f->runlen;
+		e->maplen = maplen;
+		e->_pad = 0;
+		if_cold (!addstr(c, &strcap, f->name, f->namelen * sizeof(os_char),
+				_Alignof(os_char), &e->nameoff) ||
+				!addstr(c, &strcap, map, maplen, 1, &e->mapoff)) {
+			if (old) os_unmapfile(old, oldsz);
+			freelisting(&l);
+			democache_free(c);
+			return false;
+		}
+		c->n = i + 1;
+	}
+	// the old mapping has to go before rewriting the file, for Windows' sake
+	if (old) os_unmapfile(old, oldsz);
+	if (havepath && (c->nread || c->n != nold || !old)) {
+		c->stale = !writecache(c, cachepath);
+	}
+	freelisting(&l);
+	return true;
+}
+
+void democache_free(struct democache *c) {
+	free(c->ents);
+	free(c->strs);
+	c->ents = 0; c->strs = 0;
+	c->n = 0; c->strsz = 0;
+}
+
+bool democache_nextrun(const struct democache *c, int *i,
+		struct democache_run *r) {
+	if (*i >= c->n) return false;
+	const struct democache_ent *first = c->ents + *i;
+	const os_char *name = democache_name(c, first);
+	*r = (struct democache_run){.first = *i};
+	for (; *i < c->n; ++*i) {
+		const struct democache_ent *e = c->ents + *i;
+		if (e->runlen != first->runlen || cmpspan(democache_name(c, e),
+				e->runlen, name, first->runlen)) {
+			break;
+		}
+		++r->n;
+		r->nticks += e->nticks;
+		r->realtime += e->realtime;
+	}
+	return true;
+}
+
+void democache_fmttime(char buf[static 24], double secs) {
+	uint cs = secs * 100 + 0.5;
+	uint s = cs / 100, m = s / 60, h = m / 60;
+	if (h) {
+		snprintf(buf, 24, "%u:%02u:%02u.%02u", h, m % 60, s % 60, cs % 100);
+	}
+	else {
+		snprintf(buf, 24, "%u:%02u.%02u", m, s % 60, cs % 100);
+	}
+}
+
+void democache_fmtrun(char *buf, int sz, const struct democache *c,
+		const struct democache_run *r) {
+	const struct democache_ent *first = c->ents + r->first;
+	const struct democache_ent *last = first + r->n - 1;
+	char tbuf[24];
+	democache_fmttime(tbuf, r->realtime);
+	snprintf(buf, sz, "%.*" fS ": %d demo%s, %lld ticks, %s (%.*s -> %.*s)",
+			first->runlen, democache_name(c, first), r->n,
+			r->n == 1 ? "" : "s", r->nticks, tbuf,
+			first->maplen, democache_map(c, first),
+			last->maplen, democache_map(c, last));
+}
+
+void democache_fmttotal(char *buf, int sz, const struct democache *c) {
+	struct democache_run r;
+	vlong totalticks = 0;
+	double totaltime = 0;
+	int nruns = 0;
+	for (int i = 0; democache_nextrun(c, &i, &r); ++nruns) {
+		totalticks += r.nticks;
+		totaltime += r.realtime;
+	}
+	char tbuf[24];
+	democache_fmttime(tbuf, totaltime);
+	snprintf(buf, sz, "%d demos in %d runs, %lld ticks, %s total "
+			"(%d header%s read, %d cached)", c->n, nruns, totalticks, tbuf,
+			c->nread, c->nread == 1 ? "" : "s", c->n - c->nread);
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
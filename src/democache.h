@@ -0,0 +1,122 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef INC_DEMOCACHE_H
+#define INC_DEMOCACHE_H
+
+#include "intdefs.h"
+#include "os.h"
+
+/*
+ * A cache of demo header info for a directory full of demos, so that listing
+ * thousands of autorecorded demos doesn't mean opening every single one of them
+ * each time. The cache is a file in the directory itself, which is
+ * memory-mapped and checked against the directory listing: entries are matched
+ * up by file name, size and modification time, and only new or changed demos
+ * have their headers read. The cache file is then rewritten if anything
+ * changed.
+ *
+ * Entries are sorted by run and then by demo number, where a run is a sequence
+ * of demos like foo.dem, foo_2.dem, foo_3.dem and so on, as autorecord makes.
+ *
+ * Used both by the plugin and by host-side tools.
+ */
+
+#define DEMOCACHE_FILENAME "sst-democache.bin"
+
+struct democache_ent {
+	uvlong size;
+	vlong mtime; // in whatever units the OS uses
+	int demover; // 0 if the file didn't have a valid header
+	int netver;
+	int nticks, nframes;
+	float realtime;
+	uint nameoff, mapoff; // offsets into the string table
+	uint num; // demo number within the run, from the file name (1 if none)
+	ushort namelen; // in os_chars
+	ushort runlen; // length of the run's name, within the file name
+	ushort maplen; // in bytes
+	ushort _pad;
+};
+
+struct democache {
+	struct democache_ent *ents;
+	int n;
+	char *strs;
+	uint strsz;
+	int nread; // number of headers that actually had to be read from disk
+	bool stale; // couldn't write the cache file (if not, it's still usable)
+};
+
+/* Returns the file name of an entry. Note: this is not null-terminated! */
+static inline const os_char *democache_name(const struct democache *c,
+		const struct democache_ent *e) {
+	return (const os_char *)(c->strs + e->nameoff);
+}
+
+/* Returns the map name of an entry. Note: this is not null-terminated! */
+static inline const char *democache_map(const struct democache *c,
+		const struct democache_ent *e) {
+	return c->strs + e->mapoff;
+}
+
+/*
+ * Lists the demos in dir, reading from and updating its cache file as needed.
+ * Returns false if the directory can't be read or memory runs out; otherwise
+ * fills in c, which must later be freed with democache_free().
+ */
+bool democache_load(struct democache *c, const os_char *dir);
+
+/* Frees the memory allocated by democache_load(). */
+void democache_free(struct democache *c);
+
+/* Totals for one run of demos, as returned by democache_nextrun(). */
+struct democache_run {
+	int first, n; // index of the first entry, and number of entries
+	vlong nticks;
+	double realtime;
+};
+
+/*
+ * Gets the totals for the run starting at entry *i and advances *i past it.
+ * Returns false once there are no more entries.
+ */
+bool democache_nextrun(const struct democache *c, int *i,
+		struct democache_run *r);
+
+/*
+ * Formats a length of time in seconds as [h:]mm:ss.cc, which fits in the 24
+ * bytes of buf.
+ */
+void democache_fmttime(char buf[static 24], double secs);
+
+/*
+ * Formats a one-line summary of a run (its name, demo count, ticks, time and
+ * first and last maps) into buf, with no trailing newline, truncating if it
+ * doesn't fit in sz bytes.
+ */
+void democache_fmtrun(char *buf, int sz, const struct democache *c,
+		const struct democache_run *r);
+
+/*
+ * Formats a one-line summary of the whole cache (demo and run counts, total
+ * ticks and time, and how many headers were cached), as with fmtrun.
+ */
+void democache_fmttotal(char *buf, int sz, const struct democache *c);
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -14,16 +14,25 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdatomic.h>
 #include <string.h>
 
 #include "bitbuf.h"
+#include "chunklets/cacheline.h"
+#include "con_.h"
+#include "democustom.h"
+#include "demodefs.h"
 #include "demorec.h"
 #include "engineapi.h"
+#include "event.h"
 #include "feature.h"
 #include "gamedata.h"
+#include "hook.h"
 #include "intdefs.h"
 #include "langext.h"
+#include "lz.h"
 #include "mem.h"
+#include "sst.h"
 #include "vcall.h"
 #include "x86.h"
 #include "x86util.h"
@@ -33,21 +42,41 @@ REQUIRE(demorec)
 REQUIRE_GAMEDATA(vtidx_GetEngineBuildNumber)
 REQUIRE_GAMEDATA(vtidx_RecordPacket)
 
+DEF_FEAT_CVAR(sst_demo_compressdata,
+		"Compress SST's custom demo data (needs an up-to-date demo parser)", 0,
+		CON_HIDDEN)
+
 static int nbits_msgtype, nbits_datalen;
 
 // engine limit is 255, we use 2 bytes for header + round the bitstream to the
 // next whole byte, which gives 3 bytes overhead hence 252 here.
 #define CHUNKSZ 252
+// worst case size of one whole message including the message header, starting
+// at an arbitrary bit position: 6 + 8 + 12 bits of header, 2 bytes, padding
+#define MSGSZ (CHUNKSZ + 8)
+// up to this many messages get sent to the engine in one go, as one packet
+#define MAXMSGS 8
 
 static union {
-	char x[CHUNKSZ + /*7*/ 8]; // needs to be multiple of of 4!
+	// + 1 cell since bitbuf appends also write to the cell after the last bit
+	char x[MSGSZ * MAXMSGS + sizeof(bitbuf_cell)];
 	bitbuf_cell _align; // just in case...
 } bb_buf;
 static struct bitbuf bb = {
 	{bb_buf.x}, ssizeof(bb_buf), ssizeof(bb_buf) * 8, 0, false, false, "SST"
 };
 
-static const void *createhdr(struct bitbuf *msg, int len, bool last) {
+// records passed to democustom_queue() build up in here, to be split up and
+// sent off in as few messages as possible (meaning CHUNKSZ multiples is ideal)
+static char stage[CHUNKSZ * MAXMSGS];
+static int stagelen = 0;
+
+// compression dictionary is kept for the whole demo, and reset for the next one
+static struct lz_enc lzenc;
+static uchar lzout[LZ_BOUND(LZ_MAXBLOCK)];
+static bool lzreset = true;
+
+static void createhdr(struct bitbuf *msg, int len, int flags) {
 	// We pack custom data into user message packets of type "HudText," with a
 	// leading null byte which the engine treats as an empty string. On demo
 	// playback, the client does a text lookup which fails silently on invalid
@@ -57,33 +86,201 @@ static const void *createhdr(struct bitbuf *msg, int len, bool last) {
 	// do here way back when this was first being figured out!
 	bitbuf_appendbits(msg, 23, nbits_msgtype); // type: 23 is user message
 	bitbuf_appendbyte(msg, 2); // user message type: 2 is HudText
-	bitbuf_appendbits(msg, len * 8, nbits_datalen); // our data length in bits
+	// the length has to cover everything after itself, including the padding,
+	// so that the engine can find the start of the next message in the packet
+	uint datastart = msg->curbit + nbits_datalen + 16;
+	int datalen = 16 + (-datastart & 7) + len * 8;
+	bitbuf_appendbits(msg, datalen, nbits_datalen); // our data length in bits
 	bitbuf_appendbyte(msg, 0); // aforementionied null byte
-	bitbuf_appendbyte(msg, 0xAC + last); // arbitrary marker byte to aid parsing
+	// arbitrary marker byte to aid parsing, plus some flags (see demodefs.h)
+	bitbuf_appendbyte(msg, DEMO_SST_MARKER | flags);
 	// store the data itself byte-aligned so there's no need to bitshift the
 	// universe (which would be both slower and more annoying to do)
 	bitbuf_roundup(msg);
-	return msg->buf + (msg->nbits >> 3);
 }
 
 typedef void (*VCALLCONV WriteMessages_func)(void *this, struct bitbuf *msg);
 static WriteMessages_func WriteMessages = 0;
 
-void democustom_write(const void *buf, int len) {
-	for (; len > CHUNKSZ; len -= CHUNKSZ) {
-		createhdr(&bb, CHUNKSZ, false);
-		memcpy(bb.buf + (bb.nbits >> 3), buf, CHUNKSZ);
-		bb.nbits += CHUNKSZ << 3;
-		WriteMessages(demorecorder, &bb);
-		bitbuf_reset(&bb);
-	}
-	createhdr(&bb, len, true);
-	memcpy(bb.buf + (bb.nbits >> 3), buf, len);
-	bb.nbits += len << 3;
+// hands all the messages built up so far to the engine, as a single packet
+static void sendmsgs() {
+	if (!bb.curbit) return;
 	WriteMessages(demorecorder, &bb);
 	bitbuf_reset(&bb);
 }
 
+static void appendmsg(const char *buf, int len, int flags) {
+	if (bb.curbit > (MSGSZ * (MAXMSGS - 1)) * 8) sendmsgs();
+	createhdr(&bb, len, flags);
+	bitbuf_appendbuf(&bb, buf, len);
+}
+
+// splits up buf into the usual chunks, with the last one marked as such
+static void appendchunks(const char *buf, int len, int flags) {
+	for (; len > CHUNKSZ; len -= CHUNKSZ, buf += CHUNKSZ) {
+		appendmsg(buf, CHUNKSZ, flags);
+	}
+	appendmsg(buf, len, flags | DEMO_SSTF_LAST);
+}
+
+// writes out one or more whole blocks of data, compressed if requested
+static void appendblocks(const char *buf, int len) {
+	if (!con_getvari(sst_demo_compressdata)) {
+		appendchunks(buf, len, 0);
+		return;
+	}
+	do {
+		int flags = DEMO_SSTF_LZ;
+		if (lzreset) {
+			lz_enc_reset(&lzenc);
+			flags |= DEMO_SSTF_LZRESET;
+			lzreset = false;
+		}
+		int n = len < LZ_MAXBLOCK ? len : LZ_MAXBLOCK;
+		int clen = lz_compress(&lzenc, lzout, (const uchar *)buf, n);
+		appendchunks((const char *)lzout, clen, flags);
+		buf += n; len -= n;
+	} while (len);
+}
+
+static void flushstage() {
+	if (!stagelen) return;
+	appendblocks(stage, stagelen);
+	stagelen = 0;
+}
+
+void democustom_write(const void *buf, int len) {
+	// with no file to write to, the best we can do is hang onto it for later
+	if (!demorec_fileopen()) { democustom_queue(buf, len); return; }
+	flushstage(); // anything queued earlier has to come first!
+	appendblocks(buf, len);
+	sendmsgs();
+}
+
+void democustom_queue(const void *buf, int len) {
+	if (stagelen + len > ssizeof(stage)) {
+		// if no file is open, anything written now would just get lost. keep
+		// what's already staged for the next file, since that's likely to be
+		// more important (the new file's session key, say), and drop this
+		if (!demorec_fileopen()) return;
+		flushstage();
+		// bigger than the whole buffer? no point staging it, just write it
+		if (len > ssizeof(stage)) { appendblocks(buf, len); sendmsgs(); return; }
+		sendmsgs();
+	}
+	memcpy(stage + stagelen, buf, len);
+	stagelen += len;
+}
+
+static void drainring(bool keep);
+
+void democustom_flush() {
+	drainring(true);
+	if (!demorec_fileopen()) return; // keep it staged for the next file
+	flushstage();
+	sendmsgs();
+}
+
+// Records from democustom_post() go into this ring buffer, each prefixed with a
+// 2-byte length. The producer only ever writes head and the consumer only ever
+// writes tail. The producer also keeps a possibly-outdated copy of tail on its
+// own cache line, so that it only has to touch the consumer's line when it
+// looks like there's no room left. The consumer only checks head once per
+// drain, so it doesn't bother. Indices are free-running and get masked on
+// access, so head == tail means empty.
+#define RINGSZ 16384 // must be a power of 2!
+static struct {
+	_Alignas(CACHELINE_FALSESHARE_SIZE) _Atomic uint head;
+	uint tailcache; // producer's view of tail
+	_Alignas(CACHELINE_FALSESHARE_SIZE) _Atomic uint tail;
+	_Alignas(CACHELINE_FALSESHARE_SIZE) uchar data[RINGSZ];
+} ring;
+
+static inline void ringcopyin(uint off, const void *buf, uint len) {
+	off &= RINGSZ - 1;
+	uint part = RINGSZ - off;
+	if (len <= part) { memcpy(ring.data + off, buf, len); return; }
+	memcpy(ring.data + off, buf, part);
+	memcpy(ring.data, (const uchar *)buf + part, len - part);
+}
+
+static inline void ringcopyout(void *buf, uint off, uint len) {
+	off &= RINGSZ - 1;
+	uint part = RINGSZ - off;
+	if (len <= part) { memcpy(buf, ring.data + off, len); return; }
+	memcpy(buf, ring.data + off, part);
+	memcpy((uchar *)buf + part, ring.data, len - part);
+}
+
+bool democustom_post(const void *buf, int len) {
+	if_cold (len > DEMOCUSTOM_POST_MAX) return false;
+	uint head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+	uint need = len + 2;
+	if (head + need - ring.tailcache > RINGSZ) {
+		ring.tailcache = atomic_load_explicit(&ring.tail, memory_order_acquire);
+		if (head + need - ring.tailcache > RINGSZ) return false;
+	}
+	ringcopyin(head, &(ushort){len}, 2);
+	ringcopyin(head + 2, buf, len);
+	atomic_store_explicit(&ring.head, head + need, memory_order_release);
+	return true;
+}
+
+static void (*posthandler)(const void *buf, int len) = 0;
+
+void democustom_setposthandler(void (*handler)(const void *buf, int len)) {
+	posthandler = handler;
+}
+
+// moves everything from the ring into the stage (or discards it if keep is
+// false, e.g. when there's no demo to put it in)
+static void drainring(bool keep) {
+	uint tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+	uint head = atomic_load_explicit(&ring.head, memory_order_acquire);
+	if (head == tail) return;
+	if (keep) {
+		while (tail != head) {
+			ushort len;
+			char rec[DEMOCUSTOM_POST_MAX];
+			ringcopyout(&len, tail, 2);
+			ringcopyout(rec, tail + 2, len);
+			if (posthandler) posthandler(rec, len);
+			else democustom_queue(rec, len);
+			tail += len + 2;
+		}
+	}
+	atomic_store_explicit(&ring.tail, head, memory_order_release);
+}
+
+typedef void (*VCALLCONV RecordPacket_func)(struct CDemoRecorder *);
+static RecordPacket_func orig_RecordPacket;
+static void VCALLCONV hook_RecordPacket(struct CDemoRecorder *this) {
+	// put all our stuff for this frame in the demo ahead of the frame itself
+	democustom_flush();
+	orig_RecordPacket(this);
+}
+
+HANDLE_EVENT(Tick, bool simulating) {
+	// don't let the ring fill up if packets are few and far between, but also
+	// don't keep around stuff that was posted outside of a recording session
+	drainring(demorec_demonum() != -1);
+}
+
+HANDLE_EVENT(DemoFileClosing) {
+	// write out what's already staged, but leave the ring alone: whatever's
+	// still in there may well have been posted after the poster itself already
+	// moved on to the next file (ac.c drains the ring in its own handler, for
+	// instance, right before switching keys). so that goes in the next file
+	if (demorec_fileopen()) { flushstage(); sendmsgs(); }
+	lzreset = true; // next demo's parser will need to start from scratch
+}
+
+HANDLE_EVENT(DemoRecordStopped, int ndemos) {
+	// if recording stopped before a file was ever opened, whatever's left over
+	// belongs to nothing, so don't let it leak into the next recording session
+	stagelen = 0;
+}
+
 static bool find_WriteMessages() {
 	const uchar *insns = (uchar *)demorecorder->vtable[vtidx_RecordPacket];
 	// RecordPacket calls WriteMessages right away, so just look for a call
@@ -118,7 +315,16 @@ INIT {
 	//}
 
 	if (!find_WriteMessages()) return FEAT_INCOMPAT;
+	// NOTE: demorec already made the vtable writable for us
+	orig_RecordPacket = (RecordPacket_func)hook_vtable(demorecorder->vtable,
+			vtidx_RecordPacket, (void *)&hook_RecordPacket);
 	return FEAT_OK;
 }
 
+END {
+	if_hot (!sst_userunloaded) return;
+	unhook_vtable(demorecorder->vtable, vtidx_RecordPacket,
+			(void *)orig_RecordPacket);
+}
+
 // vi: sw=4 ts=4 noet tw=80 cc=80
@@ -17,12 +17,62 @@
 #ifndef INC_DEMOCUSTOM_H
 #define INC_DEMOCUSTOM_H
 
+#include "intdefs.h"
+
 /*
- * Writes a custom demo message, automatically splitting into multiple demo
- * packets if too long. Assumes a demo is currently being recorded.
+ * Writes a custom demo message, automatically splitting into multiple user
+ * messages if too long. All of these, as well as anything still waiting to be
+ * written from democustom_queue(), go to the demo immediately, as one packet.
+ * Assumes a demo is currently being recorded. If the engine doesn't have a file
+ * open right now, the message is queued for the next file instead.
  */
 void democustom_write(const void *buf, int len);
 
+/*
+ * Queues up a custom demo message to be written as part of the next demo packet
+ * written by the engine, or sooner if the queue gets full. Consecutive queued
+ * messages are packed together into as few user messages as possible, meaning
+ * that a parser will see them concatenated into one message. As such, the data
+ * needs to be self-delimiting (as with msgpack). Assumes a demo is currently
+ * being recorded. If the queue is full and the engine has no file open to
+ * write it to, the new message is dropped; whatever's already queued is kept
+ * for the next file, unless recording stops first.
+ */
+void democustom_queue(const void *buf, int len);
+
+/*
+ * Writes anything queued by democustom_queue() or posted by democustom_post()
+ * to the demo right away. This happens automatically and generally won't need
+ * to be called, except to make sure everything so far goes in the current file.
+ */
+void democustom_flush();
+
+/* The maximum length of a message passed to democustom_post(). */
+#define DEMOCUSTOM_POST_MAX 1024
+
+/*
+ * Posts a custom demo message from a background thread, without locking. The
+ * message gets picked up on the main thread on the next tick or demo packet and
+ * is then queued as per democustom_queue(), or discarded if no demo is being
+ * recorded by then. Messages still waiting when a file is closed go in the next
+ * file, unless the poster calls democustom_flush() from its own DemoFileClosing
+ * handler. This is meant for a single dedicated thread, such as an
+ * input hook; calling it from more than one thread at a time is NOT safe.
+ * Returns false if the message is too long or there's no room left for it, in
+ * which case it gets dropped.
+ */
+bool democustom_post(const void *buf, int len);
+
+/*
+ * Sets a function to be called on the main thread with each message posted via
+ * democustom_post(), in place of the message being queued as-is. The handler
+ * is then responsible for passing whatever it wants written on to
+ * democustom_queue(). This allows for processing that depends on main-thread
+ * state, such as sealing records with the current demo file's key. Passing
+ * null goes back to queueing messages directly.
+ */
+void democustom_setposthandler(void (*handler)(const void *buf, int len));
+
 #endif
 
 // vi: sw=4 ts=4 noet tw=80 cc=80
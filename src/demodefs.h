@@ -76,6 +76,19 @@ enum demo_cmd {
 #define DEMO_PLAYERNAMELEN 32
 #define DEMO_GUIDLEN 32
 
+/*
+ * SST's custom data goes in HudText user messages whose data starts with a null
+ * byte, followed by a marker byte, then padding up to the next byte boundary
+ * in the packet, then the data itself. Data is sent in blocks, which may span
+ * several consecutive messages. The marker byte is DEMO_SST_MARKER plus any of
+ * the flags below; DEMO_SST_MARKERMASK covers the bits that are always set.
+ */
+#define DEMO_SST_MARKER 0xAC
+#define DEMO_SST_MARKERMASK 0xEC
+#define DEMO_SSTF_LAST 0x01 // last message of a block
+#define DEMO_SSTF_LZ 0x02 // block is compressed (see lz.h)
+#define DEMO_SSTF_LZRESET 0x10 // first compressed block in the stream
+
 /* protocol versions (seem somewhat arbitrary but just copying Uncrafted) */
 // (note: these aren't version numbers, they're just our own identifiers)
 enum {
@@ -49,6 +49,7 @@ static int *demonum;
 static bool *recording;
 const char *demorec_basename;
 static bool wantstop = false;
+static bool fileopen = false;
 bool demorec_forceauto = false;
 
 #define SIGNONSTATE_NEW 3
@@ -57,6 +58,7 @@ bool demorec_forceauto = false;
 
 DEF_PREDICATE(DemoControlAllowed)
 DEF_EVENT(DemoRecordStarting)
+DEF_EVENT(DemoFileClosing)
 DEF_EVENT(DemoRecordStopped, int)
 
 struct CDemoRecorder;
@@ -67,9 +69,12 @@ static void VCALLCONV hook_SetSignonState(struct CDemoRecorder *this, int state)
 	// NEW fires once every map or save load, but only bumps number if demo file
 	// was left open (i.e. every transition). bump it unconditionally instead!
 	if (state == SIGNONSTATE_NEW) {
+		// the engine closes any file left open from the last map right here
+		if (fileopen) EMIT_DemoFileClosing();
 		int oldnum = *demonum;
 		orig_SetSignonState(this, state);
 		*demonum = oldnum + 1;
+		fileopen = false;
 		return;
 	}
 	// dumb hack: demo file gets opened on FULL. bumping the number on NEW would
@@ -78,6 +83,7 @@ static void VCALLCONV hook_SetSignonState(struct CDemoRecorder *this, int state)
 	// it back up to 1 right before the demo actually gets created
 	if (state == SIGNONSTATE_FULL && *demonum == 0) *demonum = 1;
 	orig_SetSignonState(this, state);
+	if (state == SIGNONSTATE_FULL && *recording) fileopen = true;
 }
 
 typedef void (*VCALLCONV StopRecording_func)(struct CDemoRecorder *);
@@ -85,7 +91,9 @@ static StopRecording_func orig_StopRecording;
 static void VCALLCONV hook_StopRecording(struct CDemoRecorder *this) {
 	bool wasrecording = *recording;
 	int lastnum = *demonum;
+	if (wasrecording) EMIT_DemoFileClosing();
 	orig_StopRecording(this);
+	fileopen = false;
 	// If the user didn't specifically request the stop, tell the engine to
 	// start recording again as soon as it can.
 	if (wasrecording && !wantstop && (demorec_forceauto ||
@@ -249,7 +257,9 @@ int demorec_stop() {
 	// note: our set-to-0-and-back hack actually has the nice side effect of
 	// making this correct when recording and stopping in the menu lol
 	int ret = *demonum;
+	if (*recording) EMIT_DemoFileClosing();
 	orig_StopRecording(demorecorder);
+	fileopen = false;
 	EMIT_DemoRecordStopped(ret);
 	return ret;
 }
@@ -258,6 +268,10 @@ int demorec_demonum() {
 	return *recording ? *demonum : -1;
 }
 
+bool demorec_fileopen() {
+	return fileopen;
+}
+
 INIT {
 	cmd_record = con_findcmd("record");
 	orig_record_cb = con_getcmdcb(cmd_record);
@@ -65,6 +65,14 @@ int demorec_stop();
  */
 int demorec_demonum();
 
+/*
+ * Returns whether the engine currently has a demo file open, meaning that data
+ * written to the demo right now will actually end up in a file. Recording can
+ * be in progress without a file being open, such as before a map has loaded or
+ * in between files in an automatically-recorded sequence.
+ */
+bool demorec_fileopen();
+
 /*
  * Used to determine whether to allow usage of the normal record and stop
  * commands. Code which takes over control of demo recording can use this to
@@ -80,6 +88,14 @@ DECL_PREDICATE(DemoControlAllowed, void)
  */
 DECL_EVENT(DemoRecordStarting, void)
 
+/*
+ * Emitted right before each individual demo file is closed, including each file
+ * in an automatically-recorded sequence, while it's still possible to write
+ * more data to it. This may also fire if recording was requested but no file
+ * has been created yet, so handlers shouldn't assume anything was recorded.
+ */
+DECL_EVENT(DemoFileClosing, void)
+
 /*
  * Emitted when the current demo or series of demos has finished recording.
  * Receives the number of recorded demo files (which could be 0) as an argument.
@@ -15,6 +15,7 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "hook.h"
@@ -28,13 +29,115 @@
 // Almost certainly breaks in some weird cases. Oh well! Most of the time,
 // vtable hooking is more reliable, this is only for, uh, emergencies.
 
-static _Alignas(4096) uchar trampolines[4096];
-static uchar *curtrampoline = trampolines;
+// Trampolines live in fixed-size slots on pages which are allocated as needed.
+// A slot holds a length byte (for quick unhooking), the instructions copied out
+// of the prologue (at most 4 bytes plus one 15-byte instruction), and a 5-byte
+// jump back into the original function. That all fits comfortably in 32 bytes.
+#define SLOTSZ 32
+#define PAGESZ 4096
+#define NSLOTS (PAGESZ / SLOTSZ)
+
+// Bookkeeping is kept off to the side rather than on the pages themselves, so
+// that pages only have to be writable while new trampolines are written to
+// them. Pages are always executable, since other trampolines on the same page
+// might be in use at any time, but they're made read-only again by the next
+// hook_inline_commit() call, so a whole batch of hooks only costs one
+// protection change each way.
+struct trampage {
+	uchar *base;
+	u32 used[NSLOTS / 32]; // bitmap of slots in use
+	bool writable;
+};
+static struct trampage *pages = 0;
+static int npages = 0, maxpages = 0;
+
+static inline bool reachable(const uchar *page, const uchar *p) {
+	// rel32 wraps around on 32-bit, so everything's in reach
+	if (sizeof(void *) == 4) return true;
+	// leave a bit of slack so that everything in the page is in reach too
+	ssize diff = (usize)page - (usize)p;
+	return diff > -0x7FFF0000 && diff < 0x7FFF0000;
+}
+
+static uchar *allocnear(const uchar *p) {
+	// as above, anywhere will do on 32-bit
+	if (sizeof(void *) == 4) {
+		return os_pagealloc(0, PAGESZ, PAGE_EXECUTE_READWRITE);
+	}
+	// otherwise, ask for spots further and further away on either side until
+	// the OS gives us something close enough
+	for (usize dist = 1 << 16; dist < 1u << 30; dist *= 2) {
+		for (int dir = -1; dir <= 1; dir += 2) {
+			usize hint = dir < 0 ? (usize)p - dist : (usize)p + dist;
+			uchar *ret = os_pagealloc((void *)(hint & ~(usize)0xFFFF), PAGESZ,
+					PAGE_EXECUTE_READWRITE);
+			if (ret && reachable(ret, p)) return ret;
+			if (ret) os_pagefree(ret, PAGESZ);
+		}
+	}
+	return 0;
+}
+
+static struct trampage *newpage(const uchar *near) {
+	if (npages == maxpages) {
+		int n = maxpages ? maxpages * 2 : 8;
+		struct trampage *new = realloc(pages, n * sizeof(*pages));
+		if_cold (!new) return 0;
+		pages = new;
+		maxpages = n;
+	}
+	uchar *base = allocnear(near);
+	if_cold (!base) return 0;
+	pages[npages] = (struct trampage){base, .writable = true};
+	return pages + npages++;
+}
+
+static uchar *alloctrampoline(const uchar *near) {
+	for (int i = 0; i < npages; ++i) {
+		struct trampage *pg = pages + i;
+		if (!reachable(pg->base, near)) continue;
+		for (int w = 0; w < countof(pg->used); ++w) {
+			if (pg->used[w] == (u32)-1) continue;
+			if (!pg->writable) {
+				if_cold (!os_mprot(pg->base, PAGESZ, PAGE_EXECUTE_READWRITE)) {
+					return 0;
+				}
+				pg->writable = true;
+			}
+			int bit = __builtin_ctz(~pg->used[w]);
+			pg->used[w] |= 1u << bit;
+			return pg->base + (w * 32 + bit) * SLOTSZ;
+		}
+	}
+	struct trampage *pg = newpage(near);
+	if_cold (!pg) return 0;
+	pg->used[0] = 1;
+	return pg->base;
+}
+
+static void freetrampoline(uchar *slot) {
+	uchar *base = (uchar *)((usize)slot & ~(usize)(PAGESZ - 1));
+	for (int i = 0; i < npages; ++i) {
+		if (pages[i].base == base) {
+			int idx = (slot - base) / SLOTSZ;
+			pages[i].used[idx / 32] &= ~(1u << idx % 32);
+			return;
+		}
+	}
+}
 
 bool hook_init() {
-	// PE doesn't support rwx sections, not sure about ELF. Meh, just set it
-	// here instead.
-	return os_mprot(trampolines, 4096, PAGE_EXECUTE_READWRITE);
+	if (npages) return true;
+	// grab a first page up front, so that we find out right away if this
+	// isn't going to work. the plugin is as good a place as any to be near
+	return !!newpage((uchar *)&hook_init);
+}
+
+void hook_fini() {
+	for (int i = 0; i < npages; ++i) os_pagefree(pages[i].base, PAGESZ);
+	free(pages);
+	pages = 0;
+	npages = maxpages = 0;
 }
 
 struct hook_inline_prep_ret hook_inline_prep(void *func, void **trampoline) {
@@ -60,11 +163,14 @@ struct hook_inline_prep_ret hook_inline_prep(void *func, void **trampoline) {
 		}
 		len += ilen;
 		if (len >= 5) {
-			// we should have statically made trampoline buffer size big enough
-			assume(curtrampoline - trampolines < sizeof(trampolines) - len - 6);
-			*curtrampoline = len; // stuff length in there for quick unhooking
-			uchar *newtrampoline = curtrampoline + 1;
-			curtrampoline += len + 6;
+			uchar *slot = alloctrampoline(p);
+			if_cold (!slot) {
+				return (struct hook_inline_prep_ret){
+					0, "couldn't allocate memory for trampoline"
+				};
+			}
+			*slot = len; // stuff length in there for quick unhooking
+			uchar *newtrampoline = slot + 1;
 			memcpy(newtrampoline, p, len);
 			newtrampoline[len] = X86_JMPIW;
 			u32 diff = p - (newtrampoline + 5); // goto the continuation
@@ -89,6 +195,15 @@ void hook_inline_commit(void *restrict prologue, void *restrict target) {
 	u32 diff = (uchar *)target - (p + 5); // goto the hook target
 	p[0] = X86_JMPIW;
 	memcpy(p + 1, &diff, 4);
+	// all the trampolines for this batch are written by now, so lock them back
+	// down. if that fails for whatever reason, they're still usable, just not
+	// as well protected, so there's no need to bother anyone about it
+	for (int i = 0; i < npages; ++i) {
+		if (pages[i].writable &&
+				os_mprot(pages[i].base, PAGESZ, PAGE_EXECUTE_READ)) {
+			pages[i].writable = false;
+		}
+	}
 }
 
 void unhook_inline(void *orig) {
@@ -97,6 +212,7 @@ void unhook_inline(void *orig) {
 	int off = mem_loads32(p + len + 1);
 	uchar *q = p + off + 5;
 	memcpy(q, p, 5); // XXX: not atomic atm! (does any of it even need to be?)
+	freetrampoline(p - 1);
 }
 
 // vi: sw=4 ts=4 noet tw=80 cc=80
@@ -24,6 +24,13 @@
 
 bool hook_init();
 
+/*
+ * Frees all the memory used for inline hook trampolines. Call this only once
+ * every inline hook has been removed again. If hooks are being left in place,
+ * as on game exit, don't call this; just let the memory go with the process.
+ */
+void hook_fini();
+
 /*
  * Replaces a vtable entry with a target function and returns the original
  * function.
@@ -103,6 +110,10 @@ bool hook_inline_mprot(void *func);
  * to in place of the original. It is very important that these functions are
  * ABI-compatible lest obvious bad things happen.
  *
+ * This also makes any trampolines written since the last commit read-only
+ * again, so it's best to prepare a related batch of hooks together and then
+ * commit them all at the end, as described above.
+ *
  * The resulting hook can be removed later by calling unhook_inline().
  */
 void hook_inline_commit(void *restrict prologue, void *restrict target);
@@ -147,7 +158,8 @@ static inline struct hook_inline_featsetup_ret {
 /*
  * Reverts a function to its original unhooked state. Takes the pointer to the
  * callable "original" function, i.e. the trampoline, NOT the initial function
- * pointer from before hooking.
+ * pointer from before hooking. The trampoline is freed for reuse afterwards, so
+ * it must not be called again.
  */
 void unhook_inline(void *orig);
 
@@ -0,0 +1,78 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "con_.h"
+#include "democache.h"
+#include "feature.h"
+#include "gameinfo.h"
+#include "intdefs.h"
+#include "langext.h"
+#include "os.h"
+
+FEATURE("demo listing")
+
+#ifdef _WIN32
+#define fS "S"
+#else
+#define fS "s"
+#endif
+
+DEF_FEAT_CCMD_HERE(sst_listdemos, "List demos in the game directory or a "
+		"subdirectory of it, grouped into runs", 0) {
+	if (cmd->argc > 2) {
+		con_warn("usage: sst_listdemos [subdirectory]\n");
+		return;
+	}
+	os_char dir[PATH_MAX];
+	int gdlen = os_strlen(gameinfo_gamedir);
+	os_spancopy(dir, gameinfo_gamedir, gdlen + 1);
+	if (cmd->argc == 2) {
+		const char *arg = cmd->argv[1];
+		int arglen = strlen(arg);
+		if (gdlen + 1 + arglen >= PATH_MAX) {
+			con_warn("sst_listdemos: path is too long\n");
+			return;
+		}
+		os_char *q = dir + gdlen;
+		*q++ = OS_LIT('/');
+		// ascii->wtf16, as in demorec
+		for (const char *p = arg; *p; ++p, ++q) *q = (uchar)*p;
+		*q = OS_LIT('\0');
+	}
+	struct democache c;
+	if (!democache_load(&c, dir)) {
+		con_warn("sst_listdemos: couldn't list demos in %" fS "\n", dir);
+		return;
+	}
+	struct democache_run r;
+	char line[1024];
+	for (int i = 0; democache_nextrun(&c, &i, &r);) {
+		democache_fmtrun(line, sizeof(line), &c, &r);
+		con_msg("%s\n", line);
+	}
+	democache_fmttotal(line, sizeof(line), &c);
+	con_msg("%s%s\n", line,
+			c.stale ? " - couldn't update the cache file" : "");
+	democache_free(&c);
+}
+
+INIT {
+	return FEAT_OK;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
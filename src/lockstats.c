@@ -0,0 +1,68 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// This file is only built when lockstats=1 in the build script, which also
+// defines FASTSPIN_STATS. It's meant for checking lock contention on real runs
+// without having to attach a profiler to the game.
+
+#include <string.h>
+
+#include "chunklets/fastspin.h"
+#include "con_.h"
+#include "intdefs.h"
+#include "langext.h"
+
+static struct fastspin_stats stats[FASTSPIN_STATS_SLOTS + 1];
+
+static void printstats(const struct fastspin_stats *s) {
+	if (s->label) con_msg("%s", s->label);
+	else if (s->lock) con_msg("%p", (void *)s->lock);
+	else con_msg("(others)");
+	con_msg(": %llu taken, %llu contended (%.2f%%), %llu spins, %llu sleeps\n",
+			s->acquires, s->contended, s->contended * 100.0 / s->acquires,
+			s->spins, s->sleeps);
+	if (!s->contended) return;
+	con_msg("  waits:");
+	for (int i = 0; i < countof(s->waits); ++i) {
+		if (!s->waits[i]) continue;
+		if (i == 0) con_msg(" <2us: %llu", s->waits[i]);
+		else if (i == countof(s->waits) - 1) {
+			con_msg(" %uus+: %llu", 1u << i, s->waits[i]);
+		}
+		else con_msg(" %u-%uus: %llu", 1u << i, (2u << i) - 1, s->waits[i]);
+	}
+	con_msg("\n");
+}
+
+DEF_CCMD_HERE(sst_lockstats, "Print lock contention statistics", 0) {
+	if (cmd->argc == 2 && !strcmp(cmd->argv[1], "reset")) {
+		fastspin_stats_reset();
+		return;
+	}
+	if (cmd->argc != 1) {
+		con_warn("usage: sst_lockstats [reset]\n");
+		return;
+	}
+	int n = fastspin_stats_get(stats, countof(stats));
+	if (n < 0) {
+		con_warn("sst_lockstats: not built with FASTSPIN_STATS\n");
+		return;
+	}
+	if (!n) con_msg("no locks have been taken since the last reset\n");
+	for (int i = 0; i < n; ++i) printstats(stats + i);
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
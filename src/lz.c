@@ -0,0 +1,158 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "intdefs.h"
+#include "langext.h"
+#include "lz.h"
+
+#define MINMATCH 4
+// the last few bytes of a block are always literals, which saves having to
+// bounds-check the 4-byte reads in the match finder
+#define LASTLITS 5
+#define NOPOS ((uint)-1)
+
+static inline uint load32(const uchar *p) {
+	uint x; memcpy(&x, p, 4); return x; // (turns into a plain load)
+}
+
+static inline uint hash(uint x) {
+	return x * 2654435761u >> (32 - LZ_HASHBITS);
+}
+
+void lz_enc_reset(struct lz_enc *e) {
+	e->histlen = 0;
+	for (int i = 0; i < countof(e->hashtab); ++i) e->hashtab[i] = NOPOS;
+}
+
+// writes the 255-continued excess of a length that didn't fit in a nibble
+static inline uchar *putlen(uchar *out, uint len) {
+	for (; len >= 255; len -= 255) *out++ = 255;
+	*out++ = len;
+	return out;
+}
+
+static uchar *putseq(uchar *out, const uchar *lits, uint nlits, uint off,
+		uint mlen) {
+	uchar *token = out++;
+	uint mcode = mlen - MINMATCH;
+	*token = (nlits < 15 ? nlits : 15) << 4 | (mcode < 15 ? mcode : 15);
+	if (nlits >= 15) out = putlen(out, nlits - 15);
+	memcpy(out, lits, nlits); out += nlits;
+	*out++ = off; *out++ = off >> 8;
+	if (mcode >= 15) out = putlen(out, mcode - 15);
+	return out;
+}
+
+int lz_compress(struct lz_enc *e, uchar *out, const uchar *in, int len) {
+	assume(len >= 0 && len <= LZ_MAXBLOCK);
+	// slide the window down if there's no room for another block; old hash
+	// table entries pointing before the window get thrown away
+	if (e->histlen > LZ_WINDOW) {
+		uint shift = e->histlen - LZ_WINDOW;
+		memmove(e->hist, e->hist + shift, LZ_WINDOW);
+		for (int i = 0; i < countof(e->hashtab); ++i) {
+			uint pos = e->hashtab[i];
+			e->hashtab[i] = pos != NOPOS && pos >= shift ? pos - shift : NOPOS;
+		}
+		e->histlen = LZ_WINDOW;
+	}
+	uchar *base = e->hist, *start = base + e->histlen;
+	memcpy(start, in, len);
+	e->histlen += len;
+	const uchar *ip = start, *anchor = start, *end = start + len;
+	uchar *op = out;
+	while (end - ip > LASTLITS + MINMATCH) {
+		uint x = load32(ip);
+		uint *slot = e->hashtab + hash(x);
+		uint ref = *slot;
+		*slot = ip - base;
+		if (ref == NOPOS || ip - base - ref > LZ_WINDOW ||
+				load32(base + ref) != x) {
+			++ip;
+			continue;
+		}
+		const uchar *mp = base + ref;
+		uint mlen = MINMATCH;
+		while (ip + mlen < end - LASTLITS && mp[mlen] == ip[mlen]) ++mlen;
+		op = putseq(op, anchor, ip - anchor, ip - mp, mlen);
+		ip += mlen;
+		anchor = ip;
+	}
+	// final literal run, with no match
+	uint nlits = end - anchor;
+	*op++ = (nlits < 15 ? nlits : 15) << 4;
+	if (nlits >= 15) op = putlen(op, nlits - 15);
+	memcpy(op, anchor, nlits); op += nlits;
+	return op - out;
+}
+
+void lz_dec_reset(struct lz_dec *d) {
+	d->histlen = 0;
+}
+
+// reads a 255-continued length excess, returning -1 if it runs past the end
+static inline int getlen(const uchar **pp, const uchar *end) {
+	int len = 0;
+	for (const uchar *p = *pp; p < end;) {
+		uchar b = *p++;
+		len += b;
+		if (b != 255) { *pp = p; return len; }
+		if_cold (len > LZ_MAXBLOCK) return -1;
+	}
+	return -1;
+}
+
+int lz_decompress(struct lz_dec *d, const uchar **out, const uchar *in,
+		int len) {
+	if (d->histlen > LZ_WINDOW) {
+		memmove(d->hist, d->hist + d->histlen - LZ_WINDOW, LZ_WINDOW);
+		d->histlen = LZ_WINDOW;
+	}
+	uchar *base = d->hist, *start = base + d->histlen, *op = start;
+	uchar *opend = start + LZ_MAXBLOCK;
+	const uchar *ip = in, *end = in + len;
+	while (ip < end) {
+		uchar token = *ip++;
+		int nlits = token >> 4;
+		if (nlits == 15) {
+			int more = getlen(&ip, end);
+			if_cold (more < 0) return -1;
+			nlits += more;
+		}
+		if_cold (nlits > end - ip || nlits > opend - op) return -1;
+		memcpy(op, ip, nlits); op += nlits; ip += nlits;
+		if (ip == end) break; // final token: literals only
+		if_cold (end - ip < 2) return -1;
+		uint off = ip[0] | ip[1] << 8;
+		ip += 2;
+		int mlen = (token & 15) + MINMATCH;
+		if ((token & 15) == 15) {
+			int more = getlen(&ip, end);
+			if_cold (more < 0) return -1;
+			mlen += more;
+		}
+		if_cold (!off || off > op - base || mlen > opend - op) return -1;
+		// byte at a time, since matches are allowed to overlap themselves
+		for (const uchar *mp = op - off; mlen; --mlen) *op++ = *mp++;
+	}
+	d->histlen = op - base;
+	*out = start;
+	return op - start;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
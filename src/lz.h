@@ -0,0 +1,74 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef INC_LZ_H
+#define INC_LZ_H
+
+#include "intdefs.h"
+
+/*
+ * A small streaming LZ77 codec, used for custom demo data. Each call compresses
+ * one block, but matches can refer back into any earlier blocks in the same
+ * stream, up to LZ_WINDOW bytes back. This means lots of small, repetitive
+ * blocks (such as input logs) still compress well, as long as they're decoded
+ * in order by a decoder which has seen everything since the last reset.
+ *
+ * The block format is the same as LZ4's: a sequence of tokens, each giving a
+ * literal run and a match, with the final token having literals only.
+ */
+
+#define LZ_WINDOW 32768 /* maximum distance back a match can refer to */
+#define LZ_MAXBLOCK 16384 /* maximum uncompressed size of a single block */
+#define LZ_HASHBITS 12
+
+/* Worst-case compressed size of a block of n bytes. */
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+struct lz_enc {
+	uint histlen;
+	uint hashtab[1 << LZ_HASHBITS];
+	uchar hist[LZ_WINDOW + LZ_MAXBLOCK];
+};
+
+struct lz_dec {
+	uint histlen;
+	uchar hist[LZ_WINDOW + LZ_MAXBLOCK];
+};
+
+/* Resets an encoder to begin a new stream, forgetting all previous data. */
+void lz_enc_reset(struct lz_enc *e);
+
+/*
+ * Compresses a block of len bytes (at most LZ_MAXBLOCK) into out, which must
+ * have room for at least LZ_BOUND(len) bytes. Returns the compressed size.
+ */
+int lz_compress(struct lz_enc *e, uchar *out, const uchar *in, int len);
+
+/* Resets a decoder to begin a new stream, forgetting all previous data. */
+void lz_dec_reset(struct lz_dec *d);
+
+/*
+ * Decompresses a block of len bytes produced by lz_compress(). On success,
+ * points *out at the decompressed data, which remains valid until the next call
+ * on the same decoder, and returns its size. Returns -1 if the data is invalid,
+ * in which case the decoder must be reset before it can be used again.
+ */
+int lz_decompress(struct lz_dec *d, const uchar **out, const uchar *in,
+		int len);
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -74,6 +74,17 @@ void os_close(int f) {
 	CloseHandle((void *)(ssize)f);
 }
 
+const void *os_mapfile(int f, vlong len) {
+	if_cold (len > (usize)-1) return 0;
+	void *m = CreateFileMappingW((void *)(ssize)f, 0, PAGE_READONLY, 0, 0, 0);
+	if_cold (!m) return 0;
+	void *ret = MapViewOfFile(m, FILE_MAP_READ, 0, 0, len);
+	CloseHandle(m); // the view keeps the mapping object alive by itself
+	return ret;
+}
+
+void os_unmapfile(const void *p, vlong len) { UnmapViewOfFile(p); }
+
 void os_getcwd(ushort buf[static 260]) { GetCurrentDirectoryW(260, buf); }
 
 bool os_mkdir(const ushort *path) { return CreateDirectoryW(path, 0); }
@@ -106,6 +117,11 @@ bool os_mprot(void *addr, int len, int mode) {
 	return !!VirtualProtect(addr, len, mode, &old);
 }
 
+void *os_pagealloc(void *hint, int len, int mode) {
+	return VirtualAlloc(hint, len, MEM_RESERVE | MEM_COMMIT, mode);
+}
+void os_pagefree(void *p, int len) { VirtualFree(p, 0, MEM_RELEASE); }
+
 #else
 
 int os_lasterror() { return errno; }
@@ -125,10 +141,20 @@ void os_close(int f) { close(f); }
 
 vlong os_fsize(int f) {
 	struct stat s;
-	if_cold (stat(f, &s) == -1) return -1;
+	if_cold (fstat(f, &s) == -1) return -1;
 	return s.st_size;
 }
 
+const void *os_mapfile(int f, vlong len) {
+	if_cold (len > (usize)-1) return 0;
+	void *ret = mmap(0, len, PROT_READ, MAP_PRIVATE, f, 0);
+	if_cold (ret == MAP_FAILED) return 0;
+	madvise(ret, len, MADV_SEQUENTIAL);
+	return ret;
+}
+
+void os_unmapfile(const void *p, vlong len) { munmap((void *)p, len); }
+
 void os_getcwd(char buf[PATH_MAX]) { getcwd(buf, PATH_MAX); }
 
 bool os_mkdir(const char *path) { return mkdir(path, 0555) != -1; }
@@ -146,6 +172,12 @@ bool os_mprot(void *addr, int len, int mode) {
 	return mprotect(addr, len, mode) != -1;
 }
 
+void *os_pagealloc(void *hint, int len, int mode) {
+	void *ret = mmap(hint, len, mode, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return ret == MAP_FAILED ? 0 : ret;
+}
+void os_pagefree(void *p, int len) { munmap(p, len); }
+
 void os_randombytes(void *buf, int sz) { while (getentropy(buf, sz) == -1); }
 
 #endif
@@ -171,6 +171,18 @@ int os_write(int f, const void *buf, int len);
  */
 long long os_fsize(int f);
 
+/*
+ * Maps the first len bytes of the file referred to by OS-specific file handle f
+ * into memory, read-only. Returns a pointer to the mapping, or null on error.
+ * The file handle may be closed straight afterwards; the mapping stays valid
+ * until it is released with os_unmapfile(). Access is assumed to be mostly
+ * sequential, which lets the OS read ahead more aggressively on some systems.
+ */
+const void *os_mapfile(int f, long long len);
+
+/* Releases a mapping of len bytes returned by os_mapfile(). */
+void os_unmapfile(const void *p, long long len);
+
 /*
  * Closes the OS-specific file handle f. On Windows, this causes pending writes
  * to be flushed; on Unix-likes, this generally happens asynchronously. If
@@ -237,6 +249,17 @@ int os_dlfile(void *lib, os_char *buf, int sz);
  */
 bool os_mprot(void *addr, int len, int mode);
 
+/*
+ * Allocates len bytes of zeroed, page-aligned memory straight from the OS, with
+ * protection given by one of the PAGE_* flags above. If hint is non-null, the
+ * OS is asked to put the memory there, but may put it elsewhere instead or, on
+ * Windows, just fail. Returns null on failure.
+ */
+void *os_pagealloc(void *hint, int len, int mode);
+
+/* Frees memory previously allocated by os_pagealloc(). */
+void os_pagefree(void *p, int len);
+
 /*
  * Fills buf with up to sz cryptographically random bytes. sz has an OS-specific
  * upper limit - a safe value across all major operating systems is 256.
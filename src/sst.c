@@ -537,6 +537,10 @@ static void do_unload() {
 #endif
 	}
 	endfeatures();
+	// on a normal exit, features leave their inline hooks in place and the
+	// game might still call through them, so the trampolines have to outlive
+	// us, just as they would if they were part of the module itself
+	if_cold (sst_userunloaded) hook_fini();
 	con_disconnect();
 	freevars();
 }
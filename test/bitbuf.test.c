@@ -41,4 +41,233 @@ TEST("Aligning to the next byte should work as intended") {
 	return true;
 }
 
+// quick and dirty deterministic PRNG, so failures are reproducible
+static uint rngstate = 0x5EED1234;
+static uint rng() {
+	rngstate ^= rngstate << 13; rngstate ^= rngstate >> 17;
+	rngstate ^= rngstate << 5;
+	return rngstate;
+}
+
+static struct bitbuf_reader rd = {{bb_buf.buf}, 512, 512 * 8, 0, false, false,
+		"test"};
+
+TEST("Reading should give back exactly what was appended") {
+	static uint vals[256]; static int lens[256];
+	bitbuf_reset(&bb);
+	int n = 0;
+	while (bb.curbit < 480 * 8) {
+		lens[n] = rng() % 32 + 1;
+		vals[n] = rng() & (uint)-1 >> (32 - lens[n]);
+		bitbuf_appendbits(&bb, vals[n], lens[n]);
+		++n;
+	}
+	rd.curbit = 0; rd.overflow = false;
+	for (int i = 0; i < n; ++i) {
+		if (bitbuf_readbits(&rd, lens[i]) != vals[i]) return false;
+	}
+	return !rd.overflow && rd.curbit == bb.curbit;
+}
+
+TEST("Reading bytes at every bit offset should match appended bytes") {
+	char src[64];
+	for (int i = 0; i < 64; ++i) src[i] = rng();
+	for (int off = 0; off < 16; ++off) {
+		bitbuf_reset(&bb);
+		bitbuf_appendbits(&bb, 0, off); // (no-op for off == 0, that's fine)
+		for (int i = 0; i < 64; ++i) bitbuf_appendbyte(&bb, src[i]);
+		rd.curbit = off; rd.overflow = false;
+		char out[64];
+		bitbuf_readbuf(&rd, out, 61);
+		out[61] = bitbuf_readbyte(&rd);
+		bitbuf_skipbits(&rd, 8);
+		out[62] = src[62];
+		out[63] = bitbuf_readbyte(&rd);
+		if (rd.overflow || memcmp(out, src, 64)) return false;
+	}
+	return true;
+}
+
+TEST("Reading past the end should set the overflow flag and give zeros") {
+	memset(bb_buf.buf, 0xFF, sizeof(bb_buf.buf));
+	rd.curbit = 512 * 8 - 4; rd.overflow = false;
+	if (bitbuf_readbits(&rd, 4) != 15 || rd.overflow) return false;
+	if (bitbuf_readbits(&rd, 1) != 0 || !rd.overflow) return false;
+	// once overflowed, further reads shouldn't go anywhere weird either
+	if (bitbuf_readbits(&rd, 32) != 0) return false;
+	char out[8];
+	rd.curbit = 512 * 8 - 60; rd.overflow = false;
+	bitbuf_readbuf(&rd, out, 8);
+	for (int i = 0; i < 8; ++i) if (out[i]) return false;
+	return rd.overflow;
+}
+
+static union {
+	char buf[512];
+	bitbuf_cell buf_align[512 / sizeof(bitbuf_cell)];
+} ref_buf;
+static struct bitbuf ref = {ref_buf.buf, 512, 512 * 8, 0, false, false, "ref"};
+
+// fills in both buffers via different paths, then compares them all
+static bool appendbuf_matches(int simd) {
+	static char src[448 + 32];
+	for (int i = 0; i < sizeof(src); ++i) src[i] = rng();
+	int lead = rng() % 64, srcoff = rng() % 32, len = rng() % 448;
+	int trail = rng() % 32 + 1;
+	uint trailbits = rng() & (uint)-1 >> (32 - trail);
+	bitbuf_reset(&bb); bitbuf_reset(&ref);
+	// leave junk past the end to catch anything that isn't masked/cleared
+	memset(bb_buf.buf, 0xA5, sizeof(bb_buf.buf));
+	memset(ref_buf.buf, 0x5A, sizeof(ref_buf.buf));
+	bb.cells[0] = 0; ref.cells[0] = 0;
+	for (int n = lead; n > 0; n -= 16) {
+		int nbits = n < 16 ? n : 16;
+		uint x = rng() & (1u << nbits) - 1;
+		bitbuf_appendbits(&bb, x, nbits); bitbuf_appendbits(&ref, x, nbits);
+	}
+	_bitbuf_appendbuf_simd(&bb, src + srcoff, len, simd);
+	for (int i = 0; i < len; ++i) bitbuf_appendbyte(&ref, src[srcoff + i]);
+	bitbuf_appendbits(&bb, trailbits, trail);
+	bitbuf_appendbits(&ref, trailbits, trail);
+	if (bb.curbit != ref.curbit) return false;
+	// last byte might be partial, and is already zero-padded by the invariant
+	return !memcmp(bb.buf, ref.buf, (bb.curbit + 7) >> 3);
+}
+
+TEST("Appending buffers should match appending bytes one at a time") {
+#ifdef _BITBUF_SIMD
+	int maxsimd = _bitbuf_detectsimd();
+#else
+	int maxsimd = 0;
+#endif
+	// also test the public function, with whatever it picks by itself
+	for (int i = 0; i < 2000; ++i) {
+		bitbuf_reset(&bb); bitbuf_reset(&ref);
+		int lead = rng() % 32, len = rng() % 400;
+		char src[400];
+		for (int j = 0; j < len; ++j) src[j] = rng();
+		bitbuf_appendbits(&bb, 0, lead); bitbuf_appendbits(&ref, 0, lead);
+		bitbuf_appendbuf(&bb, src, len);
+		for (int j = 0; j < len; ++j) bitbuf_appendbyte(&ref, src[j]);
+		if (memcmp(bb.buf, ref.buf, (bb.curbit + 7) >> 3)) return false;
+	}
+	for (int simd = 0; simd <= maxsimd; ++simd) {
+		for (int i = 0; i < 5000; ++i) {
+			if (!appendbuf_matches(simd)) {
+				fprintf(stderr, "mismatch with SIMD level %d\n", simd);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// straightforward versions of the engine's encodings, written like tier1 does
+static void ref_ubitvar(struct bitbuf *bb, uint x) {
+	if (x < 0x10u) { bitbuf_appendbits(bb, 0, 2); bitbuf_appendbits(bb, x, 4); }
+	else if (x < 0x100u) {
+		bitbuf_appendbits(bb, 1, 2); bitbuf_appendbits(bb, x, 8);
+	}
+	else if (x < 0x1000u) {
+		bitbuf_appendbits(bb, 2, 2); bitbuf_appendbits(bb, x, 12);
+	}
+	else { bitbuf_appendbits(bb, 3, 2); bitbuf_appendbits(bb, x, 32); }
+}
+
+static void ref_varint32(struct bitbuf *bb, uint x) {
+	for (; x > 0x7F; x >>= 7) bitbuf_appendbyte(bb, x & 0x7F | 0x80);
+	bitbuf_appendbyte(bb, x);
+}
+
+static void ref_coord(struct bitbuf *bb, float f) {
+	int neg = f <= -1.0f / BITBUF_COORD_DENOM;
+	int intval = (int)(f < 0 ? -f : f);
+	int fracval = (int)(f * BITBUF_COORD_DENOM);
+	fracval = (fracval < 0 ? -fracval : fracval) & BITBUF_COORD_DENOM - 1;
+	bitbuf_appendbits(bb, !!intval, 1);
+	bitbuf_appendbits(bb, !!fracval, 1);
+	if (intval || fracval) {
+		bitbuf_appendbits(bb, neg, 1);
+		if (intval) bitbuf_appendbits(bb, intval - 1, BITBUF_COORD_INTBITS);
+		if (fracval) bitbuf_appendbits(bb, fracval, BITBUF_COORD_FRACBITS);
+	}
+}
+
+static void ref_normal(struct bitbuf *bb, float f) {
+	int neg = f <= -1.0f / BITBUF_NORMAL_DENOM;
+	int fracval = (int)(f * BITBUF_NORMAL_DENOM);
+	if (fracval < 0) fracval = -fracval;
+	if (fracval > BITBUF_NORMAL_DENOM) fracval = BITBUF_NORMAL_DENOM;
+	bitbuf_appendbits(bb, neg, 1);
+	bitbuf_appendbits(bb, fracval, BITBUF_NORMAL_FRACBITS);
+}
+
+// random values with a random number of significant bits, to hit every size
+static uint rngbits() { return rng() >> rng() % 32; }
+
+TEST("Compact encodings should match the engine and round-trip") {
+	// 24 of each at worst is 444 bytes, so do several rounds to cover more
+	for (int round = 0; round < 50; ++round) {
+		uint ints[24]; float coords[24], normals[24];
+		bitbuf_reset(&bb); bitbuf_reset(&ref);
+		for (int i = 0; i < 24; ++i) {
+			ints[i] = rngbits();
+			coords[i] = (int)(rng() % 0x100000 - 0x80000) / 32.0f;
+			normals[i] = (int)(rng() % 4200 - 2100) / 2047.0f;
+			if (!(i % 8)) coords[i] = 0; // make sure the special case gets hit
+			bitbuf_appendubitvar(&bb, ints[i]); ref_ubitvar(&ref, ints[i]);
+			bitbuf_appendvarint32(&bb, ints[i]); ref_varint32(&ref, ints[i]);
+			bitbuf_appendcoord(&bb, coords[i]); ref_coord(&ref, coords[i]);
+			bitbuf_appendnormal(&bb, normals[i]); ref_normal(&ref, normals[i]);
+			bitbuf_appendsvarint32(&bb, -(int)ints[i] >> 1);
+			bitbuf_appendsvarint32(&ref, -(int)ints[i] >> 1);
+		}
+		if (bb.curbit != ref.curbit) return false;
+		if (memcmp(bb.buf, ref.buf, (bb.curbit + 7) >> 3)) return false;
+		rd.curbit = 0; rd.overflow = false;
+		for (int i = 0; i < 24; ++i) {
+			if (bitbuf_readubitvar(&rd) != ints[i]) return false;
+			if (bitbuf_readvarint32(&rd) != ints[i]) return false;
+			if (bitbuf_readcoord(&rd) != coords[i]) return false;
+			float n = bitbuf_readnormal(&rd), expect = normals[i];
+			if (expect > 1) expect = 1; else if (expect < -1) expect = -1;
+			if (n - expect > 0.0001f || expect - n > 0.0001f) return false;
+			if (bitbuf_readsvarint32(&rd) != -(int)ints[i] >> 1) return false;
+		}
+		if (rd.overflow || rd.curbit != bb.curbit) return false;
+	}
+	return true;
+}
+
+TEST("Copying bits between buffers should work at any pair of offsets") {
+	static union {
+		char buf[512];
+		bitbuf_cell buf_align[512 / sizeof(bitbuf_cell)];
+	} src_buf;
+	for (int i = 0; i < sizeof(src_buf.buf); ++i) src_buf.buf[i] = rng();
+	struct bitbuf_reader src = {{src_buf.buf}, 512, 512 * 8, 0, false, false,
+			"src"};
+	struct bitbuf_reader check = src;
+	for (int i = 0; i < 3000; ++i) {
+		uint srcoff = rng() % (256 * 8), dstoff = rng() % 32;
+		uint nbits = rng() % (200 * 8);
+		bitbuf_reset(&bb); bitbuf_reset(&ref);
+		bitbuf_appendbits(&bb, 0, dstoff); bitbuf_appendbits(&ref, 0, dstoff);
+		src.curbit = srcoff;
+		bitbuf_copybits(&bb, &src, nbits);
+		// slowest possible way to do it, as a reference
+		check.curbit = srcoff;
+		for (uint j = 0; j < nbits; ++j) {
+			bitbuf_appendbits(&ref, bitbuf_readbits(&check, 1), 1);
+		}
+		if (src.overflow || src.curbit != srcoff + nbits) return false;
+		if (bb.curbit != ref.curbit) return false;
+		if (memcmp(bb.buf, ref.buf, (bb.curbit + 7) >> 3)) return false;
+	}
+	src.curbit = 512 * 8 - 10;
+	bitbuf_reset(&bb);
+	bitbuf_copybits(&bb, &src, 11);
+	return src.overflow && bb.curbit == 0;
+}
+
 // vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,253 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "fastspin locks and events"};
+
+// test with the stats enabled, since that's a superset of the normal code
+#define FASTSPIN_STATS
+#include "../src/chunklets/fastspin.c"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+
+#include <pthread.h>
+#include <time.h>
+
+static uvlong ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+static void sleepms(int n) {
+	nanosleep(&(struct timespec){n / 1000, n % 1000 * 1000000}, 0);
+}
+
+TEST("trylock should only succeed when nobody holds the lock") {
+	volatile int l = 0;
+	if (!fastspin_trylock(&l)) return false;
+	if (fastspin_trylock(&l)) return false;
+	fastspin_unlock(&l);
+	if (!fastspin_trylock(&l)) return false;
+	fastspin_unlock(&l);
+	return l == 0;
+}
+
+TEST("Timed waits should give up if nothing is raised") {
+	volatile int ev = 0;
+	uvlong start = ms();
+	if (fastspin_wait_timeout(&ev, 0) != 0) return false;
+	if (fastspin_wait_timeout(&ev, 50) != 0) return false;
+	uvlong t = ms() - start;
+	// a raise after a timeout should still be seen by the next wait
+	fastspin_raise(&ev, 3);
+	return t >= 50 && t < 500 && fastspin_wait_timeout(&ev, 50) == 3 &&
+			fastspin_wait(&ev) == 3;
+}
+
+static void *raiser(void *p) {
+	sleepms(20);
+	fastspin_raise(p, 7);
+	return 0;
+}
+
+TEST("Timed waits should return the raised value if it arrives in time") {
+	volatile int ev = 0;
+	pthread_t thr;
+	pthread_create(&thr, 0, &raiser, (void *)&ev);
+	int ret = fastspin_wait_timeout(&ev, 800);
+	pthread_join(thr, 0);
+	return ret == 7;
+}
+
+static volatile int waitev = 0, nwoken = 0;
+static void *waiter(void *p) {
+	if (fastspin_wait(&waitev) == 5) {
+		__atomic_fetch_add(&nwoken, 1, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+TEST("Raising an event should wake up every waiter") {
+	pthread_t thrs[8];
+	for (int i = 0; i < 8; ++i) pthread_create(thrs + i, 0, &waiter, 0);
+	sleepms(30); // give everyone time to go to sleep
+	fastspin_raise(&waitev, 5);
+	for (int i = 0; i < 8; ++i) pthread_join(thrs[i], 0);
+	return nwoken == 8;
+}
+
+static void *holder(void *p) {
+	fastspin_lock(p);
+	sleepms(100);
+	fastspin_unlock(p);
+	return 0;
+}
+
+TEST("Timed locks should give up while someone else holds the lock") {
+	volatile int l = 0;
+	pthread_t thr;
+	pthread_create(&thr, 0, &holder, (void *)&l);
+	// wait until the other thread definitely has the lock
+	while (!__atomic_load_n(&l, __ATOMIC_RELAXED)) sleepms(1);
+	uvlong start = ms();
+	bool gaveup = !fastspin_lock_timeout(&l, 20);
+	uvlong t = ms() - start;
+	// the lock should then become available once it's released
+	bool gotit = fastspin_lock_timeout(&l, 800);
+	pthread_join(thr, 0);
+	if (gotit) fastspin_unlock(&l);
+	return gaveup && t >= 20 && t < 100 && gotit && l == 0;
+}
+
+static volatile int ctrlock = 0;
+static uint ctr = 0;
+static void *incrementer(void *p) {
+	for (int i = 0; i < 100000; ++i) {
+		switch (i % 3) {
+			case 0: fastspin_lock(&ctrlock); break;
+			case 1: while (!fastspin_trylock(&ctrlock)); break;
+			case 2: while (!fastspin_lock_timeout(&ctrlock, 1));
+		}
+		++ctr;
+		fastspin_unlock(&ctrlock);
+	}
+	return 0;
+}
+
+TEST("All the ways of taking a lock should exclude each other",
+		.timeout = 5000) {
+	pthread_t thrs[8];
+	for (int i = 0; i < 8; ++i) pthread_create(thrs + i, 0, &incrementer, 0);
+	for (int i = 0; i < 8; ++i) pthread_join(thrs[i], 0);
+	return ctr == 800000 && ctrlock == 0;
+}
+
+TEST("Read locks should be shared but exclude writers") {
+	volatile int l = 0;
+	fastspin_rdlock(&l);
+	if (!fastspin_tryrdlock(&l)) return false;
+	if (fastspin_trywrlock(&l)) return false;
+	fastspin_rdunlock(&l);
+	if (fastspin_trywrlock(&l)) return false;
+	fastspin_rdunlock(&l);
+	if (!fastspin_trywrlock(&l)) return false;
+	if (fastspin_tryrdlock(&l) || fastspin_trywrlock(&l)) return false;
+	fastspin_wrunlock(&l);
+	return l == 0;
+}
+
+// writers keep these two equal; readers check that they always see them equal
+static volatile int rwl = 0;
+static uint rwa = 0, rwb = 0, rwbad = 0;
+static void *rwworker(void *p) {
+	for (int i = 0; i < 50000; ++i) {
+		if (i % 16 == (int)(ssize)p) {
+			fastspin_wrlock(&rwl);
+			++rwa; ++rwb;
+			fastspin_wrunlock(&rwl);
+		}
+		else {
+			fastspin_rdlock(&rwl);
+			if (__atomic_load_n(&rwa, __ATOMIC_RELAXED) !=
+					__atomic_load_n(&rwb, __ATOMIC_RELAXED)) {
+				__atomic_fetch_add(&rwbad, 1, __ATOMIC_RELAXED);
+			}
+			fastspin_rdunlock(&rwl);
+		}
+	}
+	return 0;
+}
+
+TEST("Readers should never see a write in progress", .timeout = 5000) {
+	pthread_t thrs[8];
+	for (int i = 0; i < 8; ++i) {
+		pthread_create(thrs + i, 0, &rwworker, (void *)(ssize)i);
+	}
+	for (int i = 0; i < 8; ++i) pthread_join(thrs[i], 0);
+	return !rwbad && rwa == 8 * 3125 && rwl == 0;
+}
+
+static volatile int busyl = 0, stopreading = 0;
+static void *busyreader(void *p) {
+	while (!__atomic_load_n(&stopreading, __ATOMIC_RELAXED)) {
+		fastspin_rdlock(&busyl);
+		sleepms(1);
+		fastspin_rdunlock(&busyl);
+	}
+	return 0;
+}
+
+TEST("A writer should get in even if readers never stop coming") {
+	pthread_t thrs[4];
+	for (int i = 0; i < 4; ++i) {
+		pthread_create(thrs + i, 0, &busyreader, 0);
+		sleepms(1); // stagger them so there's always someone holding the lock
+	}
+	// if readers could keep the writer out indefinitely, this would time out
+	fastspin_wrlock(&busyl);
+	__atomic_store_n(&stopreading, 1, __ATOMIC_RELAXED);
+	fastspin_wrunlock(&busyl);
+	for (int i = 0; i < 4; ++i) pthread_join(thrs[i], 0);
+	return busyl == 0;
+}
+
+TEST("Semaphores should count correctly") {
+	volatile int sem = 2;
+	if (!fastspin_sem_trywait(&sem) || !fastspin_sem_trywait(&sem)) {
+		return false;
+	}
+	if (fastspin_sem_trywait(&sem)) return false;
+	if (fastspin_sem_wait_timeout(&sem, 20)) return false;
+	fastspin_sem_post(&sem, 3);
+	fastspin_sem_wait(&sem);
+	if (!fastspin_sem_wait_timeout(&sem, 20)) return false;
+	return sem == 1;
+}
+
+static volatile int items = 0;
+static uint consumed = 0;
+static void *consumer(void *p) {
+	for (int i = 0; i < 20000; ++i) {
+		fastspin_sem_wait(&items);
+		__atomic_fetch_add(&consumed, 1, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+TEST("Semaphores should hand out exactly as much as was posted",
+		.timeout = 5000) {
+	pthread_t thrs[4];
+	for (int i = 0; i < 4; ++i) pthread_create(thrs + i, 0, &consumer, 0);
+	for (int i = 0; i < 80000; i += 4) {
+		if (i % 1024 == 0) sleepms(1); // let consumers run dry and sleep
+		fastspin_sem_post(&items, 4);
+	}
+	for (int i = 0; i < 4; ++i) pthread_join(thrs[i], 0);
+	return consumed == 80000 && items == 0;
+}
+
+TEST("Stats should count up contended acquisitions") {
+	volatile int l = 0;
+	fastspin_stats_label(&l, "test");
+	fastspin_lock(&l); fastspin_unlock(&l);
+	pthread_t thr;
+	pthread_create(&thr, 0, &holder, (void *)&l);
+	while (!__atomic_load_n(&l, __ATOMIC_RELAXED)) sleepms(1);
+	fastspin_lock(&l); // should have to wait about 100ms
+	fastspin_unlock(&l);
+	pthread_join(thr, 0);
+	struct fastspin_stats st[FASTSPIN_STATS_SLOTS + 1];
+	int n = fastspin_stats_get(st, countof(st));
+	struct fastspin_stats *s = 0;
+	for (int i = 0; i < n; ++i) if (st[i].lock == &l) s = st + i;
+	if (!s || strcmp(s->label, "test")) return false;
+	// 2 from here, 1 from the other thread
+	if (s->acquires != 3 || s->contended != 1 || !s->sleeps) return false;
+	// a 100ms wait is way more than 2^15 us, so should land in the last bucket
+	for (int i = 0; i < FASTSPIN_STATS_BUCKETS; ++i) {
+		if (s->waits[i] != (i == FASTSPIN_STATS_BUCKETS - 1)) return false;
+	}
+	fastspin_stats_reset();
+	return fastspin_stats_get(st, countof(st)) == 0;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -66,6 +66,33 @@ TEST("Multiple functions should be able to be inline-hooked at once") {
 	return func2(5, 5) == 5;
 }
 
+TEST("Trampolines should keep working beyond a single page") {
+	if (!hook_init()) return false;
+	// this used to overrun the old fixed trampoline buffer after a few hundred
+	void *trampolines[1000];
+	for (int i = 0; i < 1000; ++i) {
+		void *t;
+		if (hook_inline_prep((void *)&func2, &t).err) return false;
+		trampolines[i] = t;
+	}
+	orig_func1 = (testfunc)test_hook_inline((void *)&func1, (void *)&hook1);
+	if (!orig_func1 || func1(5, 5) != 15) return false;
+	for (int i = 0; i < 1000; ++i) {
+		if (((testfunc)trampolines[i])(5, 5) != 0) return false;
+	}
+	return true;
+}
+
+TEST("Unhooking should free trampolines for reuse") {
+	if (!hook_init()) return false;
+	orig_func1 = (testfunc)test_hook_inline((void *)&func1, (void *)&hook1);
+	if (!orig_func1) return false;
+	void *first = (void *)orig_func1;
+	unhook_inline((void *)orig_func1);
+	orig_func1 = (testfunc)test_hook_inline((void *)&func1, (void *)&hook1);
+	return (void *)orig_func1 == first && func1(5, 5) == 15;
+}
+
 #endif
 
 // vi: sw=4 ts=4 noet tw=80 cc=80
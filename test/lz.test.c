@@ -0,0 +1,85 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "the streaming LZ codec"};
+
+#include "../src/lz.c"
+#include "../src/intdefs.h"
+
+#include <string.h>
+
+static struct lz_enc enc;
+static struct lz_dec dec;
+static uchar comp[LZ_BOUND(LZ_MAXBLOCK)];
+
+static uint rngstate = 0xC0DEC123;
+static uint rng() {
+	rngstate ^= rngstate << 13; rngstate ^= rngstate >> 17;
+	rngstate ^= rngstate << 5;
+	return rngstate;
+}
+
+// vaguely log-like data: records which mostly look the same as each other
+static void fill(uchar *buf, int len) {
+	static const char *const recs[] = {
+		"\x92\xA8" "KeyInput\x82\xA3" "key?\xA3" "btn\xA4" "DOWN",
+		"\x92\xA8" "KeyInput\x82\xA3" "key?\xA3" "btn\xA2" "UP",
+		"\x92\xA7" "FakeKey\x83\xA2" "vk?\xA4" "scan?\xA2" "us\xCF\x01??"
+	};
+	for (int i = 0; i < len;) {
+		const char *r = recs[rng() % countof(recs)];
+		// sprinkle in a few random bytes in place of the question marks
+		for (; *r && i < len; ++r, ++i) buf[i] = *r == '?' ? rng() : *r;
+	}
+}
+
+static bool roundtrip(const uchar *in, int len) {
+	int clen = lz_compress(&enc, comp, in, len);
+	if (clen > LZ_BOUND(len)) return false;
+	const uchar *out;
+	int dlen = lz_decompress(&dec, &out, comp, clen);
+	return dlen == len && !memcmp(out, in, len);
+}
+
+TEST("Random data should survive a round trip") {
+	static uchar buf[LZ_MAXBLOCK];
+	lz_enc_reset(&enc); lz_dec_reset(&dec);
+	for (int i = 0; i < 20; ++i) {
+		int len = i ? rng() % LZ_MAXBLOCK + 1 : 0; // include an empty block
+		for (int j = 0; j < len; ++j) buf[j] = rng();
+		if (!roundtrip(buf, len)) return false;
+	}
+	return true;
+}
+
+TEST("Small blocks should compress well using earlier blocks") {
+	static uchar buf[256];
+	lz_enc_reset(&enc); lz_dec_reset(&dec);
+	int total = 0, totalc = 0;
+	// go well past the window size to make sure sliding works on both ends
+	for (int i = 0; i < 2000; ++i) {
+		int len = rng() % sizeof(buf) + 1;
+		fill(buf, len);
+		int clen = lz_compress(&enc, comp, buf, len);
+		total += len; totalc += clen;
+		const uchar *out;
+		if (lz_decompress(&dec, &out, comp, clen) != len) return false;
+		if (memcmp(out, buf, len)) return false;
+	}
+	// the data is mostly repeated words, so this should be easy
+	return totalc < total / 2;
+}
+
+TEST("Garbage input shouldn't make the decoder go out of bounds") {
+	static uchar buf[512];
+	for (int i = 0; i < 20000; ++i) {
+		lz_dec_reset(&dec);
+		int len = rng() % sizeof(buf);
+		for (int j = 0; j < len; ++j) buf[j] = rng();
+		const uchar *out;
+		int dlen = lz_decompress(&dec, &out, buf, len);
+		if (dlen > LZ_MAXBLOCK) return false;
+	}
+	return true;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
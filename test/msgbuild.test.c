@@ -0,0 +1,296 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "msgpack size calculation and building"};
+
+#include "../src/chunklets/msg.c"
+#include "../src/chunklets/msgbuild.c"
+#include "../src/chunklets/msgdec.c"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+
+#include <string.h>
+
+static uint rngstate = 0xB111D123;
+static uint rng() {
+	rngstate ^= rngstate << 13; rngstate ^= rngstate >> 17;
+	rngstate ^= rngstate << 5;
+	return rngstate;
+}
+
+// values either side of every encoding boundary, plus some random ones
+static const vlong edges[] = {
+	0, 1, 15, 16, 31, 32, 127, 128, 255, 256, 32767, 32768, 65535, 65536,
+	2147483647ll, 2147483648ll, 4294967295ll, 4294967296ll,
+	0x7FFFFFFFFFFFFFFFll, -1, -32, -33, -128, -129, -32768, -32769,
+	-2147483648ll, -2147483649ll, -0x7FFFFFFFFFFFFFFFll - 1
+};
+
+static vlong randval() {
+	vlong x = (uvlong)rng() << 32 | rng();
+	return x >> (rng() & 63);
+}
+
+// checks that the put and rput functions both give the size they're meant to
+#define CHECK(sz, put, rput, val) do { \
+	uchar _b[9]; \
+	if (put(_b, val) != sz || rput(_b + 9, val) != sz) return false; \
+} while (0)
+
+TEST("Integer sizes should match what actually gets written") {
+	for (int i = 0; i < countof(edges) + 10000; ++i) {
+		vlong s = i < countof(edges) ? edges[i] : randval();
+		uvlong u = s;
+		CHECK(msg_sizes(s), msg_puts, msg_rputs, s);
+		CHECK(msg_sizeu(u), msg_putu, msg_rputu, u);
+		if (s == (int)s) CHECK(msg_sizes(s), msg_puts32, msg_rputs32, s);
+		if (s == (short)s) CHECK(msg_sizes(s), msg_puts16, msg_rputs16, s);
+		if (s == (schar)s) CHECK(msg_sizes(s), msg_puts8, msg_rputs8, s);
+		if (u == (uint)u) CHECK(msg_sizeu(u), msg_putu32, msg_rputu32, u);
+		if (u == (ushort)u) CHECK(msg_sizeu(u), msg_putu16, msg_rputu16, u);
+		if (u == (uchar)u) CHECK(msg_sizeu(u), msg_putu8, msg_rputu8, u);
+	}
+	return msg_sizeu(0xFFFFFFFFFFFFFFFFull) == 9;
+}
+
+TEST("Double sizes should match what actually gets written") {
+	static const double vals[] = {0, 0.5, 1.5f, 0.1, 1e300, -1e-300, 16777217};
+	for (int i = 0; i < countof(vals); ++i) {
+		CHECK(msg_sized(vals[i]), msg_putd, msg_rputd, vals[i]);
+	}
+	return true;
+}
+
+TEST("Container sizes should match what actually gets written") {
+	for (int i = 0; i < countof(edges) + 10000; ++i) {
+		uint sz = i < countof(edges) ? edges[i] : randval();
+		if (i < countof(edges) && edges[i] != sz) continue;
+		CHECK(msg_sizessz(sz), msg_putssz, msg_rputssz, sz);
+		CHECK(msg_sizebsz(sz), msg_putbsz, msg_rputbsz, sz);
+		CHECK(msg_sizeasz(sz), msg_putasz, msg_rputasz, sz);
+		CHECK(msg_sizemsz(sz), msg_putmsz, msg_rputmsz, sz);
+		if (sz <= 65535) {
+			CHECK(msg_sizessz(sz), msg_putssz16, msg_rputssz16, sz);
+			CHECK(msg_sizebsz(sz), msg_putbsz16, msg_rputbsz16, sz);
+			CHECK(msg_sizeasz(sz), msg_putasz16, msg_rputasz16, sz);
+			CHECK(msg_sizemsz(sz), msg_putmsz16, msg_rputmsz16, sz);
+		}
+		if (sz <= 255) CHECK(msg_sizessz(sz), msg_putssz8, msg_rputssz8, sz);
+	}
+	return true;
+}
+
+static int nallocs;
+static uint failabove = 0xFFFFFFFF;
+
+static void *testalloc(void *ctx, void *old, uint oldsz, uint newsz) {
+	if (!newsz) { free(old); return 0; }
+	if (newsz > failabove) return 0;
+	++nallocs;
+	return realloc(old, newsz);
+}
+
+// the sort of thing that might get written on every tick, with a blob that
+// makes the size vary a lot
+static bool putrecord(struct msgbuild *b, uvlong tick, const uchar *blob,
+		uint bloblen) {
+	uint sz = msg_sizeasz(2) + msg_sizestr(4) + msg_sizemsz(2) +
+			msg_sizestr(4) + msg_sizeu(tick) + msg_sizestr(4) +
+			msg_sizebin(bloblen);
+	uchar *p = msgbuild_alloc(b, sz);
+	if (!p) return false;
+	uchar *end = p + sz;
+	msg_putasz4(p++, 2);
+		msg_putssz5(p++, 4); memcpy(p, "Tick", 4); p += 4;
+		msg_putmsz4(p++, 2);
+			msg_putssz5(p++, 4); memcpy(p, "tick", 4); p += 4;
+				p += msg_putu(p, tick);
+			msg_putssz5(p++, 4); memcpy(p, "blob", 4); p += 4;
+				p += msg_putbsz(p, bloblen); memcpy(p, blob, bloblen);
+				p += bloblen;
+	return p == end;
+}
+
+static bool checkrecords(const struct msgbuild *b, int n, uint *lens) {
+	const uchar *p = b->buf, *end = b->buf + b->len;
+	for (int i = 0; i < n; ++i) {
+		struct msgdec_val v;
+		for (int j = 0; j < 5; ++j) {
+			if (msgdec_get(&p, end, &v) != MSGDEC_OK) return false;
+		}
+		if (v.type != MSGDEC_UINT || v.u != (uvlong)i << (i & 63)) {
+			return false;
+		}
+		if (msgdec_get(&p, end, &v) != MSGDEC_OK) return false;
+		if (msgdec_get(&p, end, &v) != MSGDEC_OK) return false;
+		if (v.type != MSGDEC_BIN || v.len != lens[i]) return false;
+	}
+	return p == end;
+}
+
+TEST("Building messages should allocate exactly and reuse the arena") {
+	static uchar blob[70000];
+	static uint lens[200];
+	struct msgbuild b;
+	msgbuild_init(&b, &testalloc, 0);
+	for (int i = 0; i < countof(lens); ++i) {
+		lens[i] = rng() % (i % 50 ? 300 : sizeof(blob));
+		if (!putrecord(&b, (uvlong)i << (i & 63), blob, lens[i])) return false;
+	}
+	if (!checkrecords(&b, countof(lens), lens)) return false;
+	if (b.len > b.cap) return false;
+	// the same workload again should fit without any more allocation
+	int n = nallocs;
+	msgbuild_reset(&b);
+	for (int i = 0; i < countof(lens); ++i) {
+		if (!putrecord(&b, (uvlong)i << (i & 63), blob, lens[i])) return false;
+	}
+	if (nallocs != n || !checkrecords(&b, countof(lens), lens)) return false;
+	msgbuild_free(&b);
+	return !b.buf && !b.cap;
+}
+
+TEST("Failing to grow should leave the arena as it was") {
+	struct msgbuild b;
+	msgbuild_init(&b, &testalloc, 0);
+	failabove = 1024;
+	uchar *p = msgbuild_alloc(&b, 1000);
+	if (!p) return false;
+	memset(p, 'x', 1000);
+	uint cap = b.cap;
+	uchar *buf = b.buf;
+	if (msgbuild_alloc(&b, 100)) return false;
+	if (msgbuild_alloc(&b, 0xFFFFFFFF)) return false;
+	failabove = 0xFFFFFFFF;
+	if (b.len != 1000 || b.cap != cap || b.buf != buf) return false;
+	for (int i = 0; i < 1000; ++i) if (buf[i] != 'x') return false;
+	msgbuild_free(&b);
+	return true;
+}
+
+// decodes an array written by one of the msg_puta*() functions and checks that
+// it has the expected size and values
+static bool checkarray(const uchar *buf, uint len, uint n, const vlong *want) {
+	const uchar *p = buf, *end = buf + len;
+	struct msgdec_val v;
+	if (msgdec_get(&p, end, &v) != MSGDEC_OK) return false;
+	if (v.type != MSGDEC_ARRAY || v.n != n) return false;
+	for (uint i = 0; i < n; ++i) {
+		if (msgdec_get(&p, end, &v) != MSGDEC_OK) return false;
+		if (want[i] < 0 ? v.type != MSGDEC_SINT || v.s != want[i] :
+				v.type != MSGDEC_UINT || v.u != want[i]) {
+			return false;
+		}
+	}
+	return p == end;
+}
+
+TEST("Bulk integer arrays should decode to the same values") {
+	static uchar u8s[300], buf[300 * 5 + 5];
+	static ushort u16s[300];
+	static uint u32s[300];
+	static int s32s[300];
+	static vlong want[300];
+	for (int round = 0; round < 2000; ++round) {
+		uint n = rng() % (round & 1 ? 300 : 20);
+		int shift = rng() % 33;
+		for (uint i = 0; i < n; ++i) {
+			s32s[i] = shift == 32 ? 0 : (int)rng() >> shift;
+			u32s[i] = shift == 32 ? 0 : rng() >> shift;
+			u16s[i] = u32s[i]; u8s[i] = u32s[i];
+		}
+		uint len;
+#define ARRCHECK(type, vals) do { \
+	for (uint i = 0; i < n; ++i) want[i] = vals[i]; \
+	len = msg_puta##type(buf, vals, n); \
+	if (len != msg_sizea##type(vals, n)) return false; \
+	if (!checkarray(buf, len, n, want)) return false; \
+} while (0)
+		ARRCHECK(u8, u8s);
+		ARRCHECK(u16, u16s);
+		ARRCHECK(u32, u32s);
+		ARRCHECK(s32, s32s);
+#undef ARRCHECK
+	}
+	return true;
+}
+
+TEST("Bulk integer arrays should use the narrowest uniform encoding") {
+	static const int s[] = {5, -32, 127, 0};
+	static const uint u[] = {5, 255, 0};
+	uchar buf[32];
+	if (msg_putas32(buf, s, 4) != 5 || buf[2] != 0xE0) return false;
+	if (msg_putau32(buf, u, 3) != 7 || buf[1] != 0xCC || buf[2] != 5) {
+		return false;
+	}
+	static const int s2[] = {-129, 1};
+	return msg_putas32(buf, s2, 2) == 7 && buf[4] == 0xD1 && buf[6] == 1;
+}
+
+TEST("Float arrays should decode to the same values") {
+	static float vals[100];
+	static uchar buf[100 * 5 + 3];
+	for (int i = 0; i < 100; ++i) vals[i] = (int)rng() / 3e5f;
+	uint len = msg_putaf(buf, vals, 100);
+	if (len != msg_sizeaf(100)) return false;
+	const uchar *p = buf, *end = buf + len;
+	struct msgdec_val v;
+	if (msgdec_get(&p, end, &v) != MSGDEC_OK || v.n != 100) return false;
+	for (int i = 0; i < 100; ++i) {
+		if (msgdec_get(&p, end, &v) != MSGDEC_OK) return false;
+		if (v.type != MSGDEC_FLOAT || v.f != vals[i]) return false;
+	}
+	return p == end;
+}
+
+static uint getbe32(const uchar *p) {
+	return (uint)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+TEST("Packed arrays should give big-endian data in an extension value") {
+	static uchar buf[70000 * 4 + 6];
+	static uint u32s[70000];
+	static ushort u16s[70000];
+	static float fs[70000];
+	// sizes chosen to hit each of the fixext/ext8/ext16/ext32 header forms
+	static const uint ns[] = {0, 1, 2, 4, 3, 63, 64, 16383, 16384, 70000};
+	for (int i = 0; i < 70000; ++i) {
+		u32s[i] = rng(); u16s[i] = u32s[i]; fs[i] = (int)rng() / 7.0f;
+	}
+	for (int i = 0; i < countof(ns); ++i) {
+		uint n = ns[i];
+		const uchar *p = buf;
+		struct msgdec_val v;
+		uint len = msg_putpacku32(buf, 42, u32s, n);
+		if (len != msg_sizeext(n * 4)) return false;
+		if (msgdec_get(&p, buf + len, &v) != MSGDEC_OK) return false;
+		if (p != buf + len || v.type != MSGDEC_EXT || v.ext != 42) return false;
+		if (v.len != n * 4) return false;
+		for (uint j = 0; j < n; ++j) {
+			if (getbe32(v.data + j * 4) != u32s[j]) return false;
+		}
+		p = buf;
+		len = msg_putpacku16(buf, -3, u16s, n);
+		if (len != msg_sizeext(n * 2)) return false;
+		if (msgdec_get(&p, buf + len, &v) != MSGDEC_OK) return false;
+		if (v.ext != -3 || v.len != n * 2) return false;
+		for (uint j = 0; j < n; ++j) {
+			if ((v.data[j * 2] << 8 | v.data[j * 2 + 1]) != u16s[j]) {
+				return false;
+			}
+		}
+		p = buf;
+		len = msg_putpackf(buf, 7, fs, n);
+		if (msgdec_get(&p, buf + len, &v) != MSGDEC_OK) return false;
+		for (uint j = 0; j < n; ++j) {
+			union { uint i; float f; } u = {getbe32(v.data + j * 4)};
+			if (u.f != fs[j]) return false;
+		}
+		p = buf;
+		len = msg_putpacku8(buf, 1, (const uchar *)fs, n);
+		if (msgdec_get(&p, buf + len, &v) != MSGDEC_OK) return false;
+		if (v.len != n || memcmp(v.data, fs, n)) return false;
+	}
+	return true;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,217 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "the msgpack decoder"};
+
+#include "../src/chunklets/msg.c"
+#include "../src/chunklets/msgdec.c"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+
+#include <string.h>
+
+static uint rngstate = 0xDEC0DE12;
+static uint rng() {
+	rngstate ^= rngstate << 13; rngstate ^= rngstate >> 17;
+	rngstate ^= rngstate << 5;
+	return rngstate;
+}
+
+TEST("Integers should decode to the same values they were encoded from") {
+	static const vlong vals[] = {
+		0, 1, 127, 128, 255, 256, 65535, 65536, 4294967295ll, 4294967296ll,
+		0x7FFFFFFFFFFFFFFFll, -1, -32, -33, -128, -129, -32768, -32769,
+		-2147483648ll, -2147483649ll, -0x7FFFFFFFFFFFFFFFll - 1
+	};
+	uchar buf[9];
+	for (int i = 0; i < countof(vals); ++i) {
+		int len = msg_puts(buf, vals[i]);
+		const uchar *p = buf;
+		struct msgdec_val v;
+		if (msgdec_get(&p, buf + len, &v) != MSGDEC_OK) return false;
+		if (p != buf + len) return false;
+		if (vals[i] < 0 ? v.type != MSGDEC_SINT || v.s != vals[i] :
+				v.type != MSGDEC_UINT || v.u != vals[i]) {
+			return false;
+		}
+	}
+	// and the one value that doesn't fit in a signed long long
+	int len = msg_putu(buf, 0xFFFFFFFFFFFFFFFFull);
+	const uchar *p = buf;
+	struct msgdec_val v;
+	if (msgdec_get(&p, buf + len, &v) != MSGDEC_OK) return false;
+	return v.type == MSGDEC_UINT && v.u == 0xFFFFFFFFFFFFFFFFull;
+}
+
+TEST("Strings, bins, floats and containers should decode correctly") {
+	uchar buf[512], *q = buf;
+	*q++ = 0x93; // [
+	msg_putssz5(q++, 5); memcpy(q, "hello", 5); q += 5;
+	q += msg_putbsz16(q, 300); memset(q, 0xAB, 300); q += 300;
+	*q++ = 0x82; // {
+	msg_putf(q, 1.5f); q += 5; q += msg_putd(q, 0.1);
+	*q++ = 0xC3; *q++ = 0xC0; // true: nil
+	*q++ = 0xD6; *q++ = 0xFE; memcpy(q, "abcd", 4); q += 4; // fixext4, type -2
+	const uchar *p = buf;
+	struct msgdec_val v;
+	if (msgdec_get(&p, q, &v) != MSGDEC_OK) return false;
+	if (v.type != MSGDEC_ARRAY || v.n != 3) return false;
+	if (msgdec_get(&p, q, &v) != MSGDEC_OK) return false;
+	if (v.type != MSGDEC_STR || v.len != 5 || v.datalen != 5 ||
+			memcmp(v.data, "hello", 5)) {
+		return false;
+	}
+	if (msgdec_get(&p, q, &v) != MSGDEC_OK) return false;
+	if (v.type != MSGDEC_BIN || v.len != 300 || v.data != buf + 10) {
+		return false;
+	}
+	if (msgdec_get(&p, q, &v) != MSGDEC_OK) return false;
+	if (v.type != MSGDEC_MAP || v.n != 2) return false;
+	if (msgdec_get(&p, q, &v) != MSGDEC_OK) return false;
+	if (v.type != MSGDEC_FLOAT || v.f != 1.5f) return false;
+	if (msgdec_get(&p, q, &v) != MSGDEC_OK) return false;
+	if (v.type != MSGDEC_DOUBLE || v.d != 0.1) return false;
+	if (msgdec_get(&p, q, &v) != MSGDEC_OK) return false;
+	if (v.type != MSGDEC_BOOL || !v.b) return false;
+	if (msgdec_get(&p, q, &v) != MSGDEC_OK) return false;
+	if (v.type != MSGDEC_NIL) return false;
+	if (msgdec_get(&p, q, &v) != MSGDEC_OK) return false;
+	if (v.type != MSGDEC_EXT || v.ext != -2 || v.len != 4 ||
+			memcmp(v.data, "abcd", 4)) {
+		return false;
+	}
+	return p == q;
+}
+
+// a few records of the sort SST writes, with a long string in the middle
+static int genrecords(uchar *buf) {
+	uchar *q = buf;
+	for (int i = 0; i < 20; ++i) {
+		*q++ = 0x92; // [
+		msg_putssz5(q++, 8); memcpy(q, "KeyInput", 8); q += 8;
+		*q++ = 0x83; // {
+		msg_putssz5(q++, 3); memcpy(q, "key", 3); q += 3;
+		q += msg_putu(q, rng() >> (rng() & 31));
+		msg_putssz5(q++, 3); memcpy(q, "pos", 3); q += 3;
+		*q++ = 0x93;
+		for (int j = 0; j < 3; ++j) { msg_putf(q, rng() / 1e5f); q += 5; }
+		msg_putssz5(q++, 4); memcpy(q, "blob", 4); q += 4;
+		int n = rng() % 300;
+		q += msg_putbsz(q, n);
+		for (int j = 0; j < n; ++j) *q++ = rng();
+	}
+	return q - buf;
+}
+
+TEST("Truncated input should be reported without reading out of bounds") {
+	static uchar buf[16384];
+	int len = genrecords(buf);
+	for (int cut = 0; cut < len; ++cut) {
+		// copy to a tight allocation so that ASan can spot overreads
+		uchar *tight = malloc(cut ? cut : 1);
+		memcpy(tight, buf, cut);
+		const uchar *p = tight, *end = tight + cut;
+		int ret;
+		const uchar *last;
+		do last = p; while ((ret = msgdec_skip(&p, end)) == MSGDEC_OK);
+		bool ok = ret == MSGDEC_SHORT && p == last; // no advancing on failure
+		free(tight);
+		if (!ok) return false;
+	}
+	return true;
+}
+
+TEST("The never-used 0xC1 byte should be rejected") {
+	static const uchar buf[] = {0x92, 0x01, 0xC1};
+	const uchar *p = buf;
+	if (msgdec_skip(&p, buf + sizeof(buf)) != MSGDEC_BAD) return false;
+	return p == buf;
+}
+
+TEST("Skipping very deeply nested data shouldn't overflow the stack") {
+	enum { DEPTH = 1000000 };
+	uchar *buf = malloc(DEPTH + 1);
+	memset(buf, 0x91, DEPTH); // [[[[...
+	buf[DEPTH] = 0xC0; // ...nil]]]]
+	const uchar *p = buf;
+	bool ok = msgdec_skip(&p, buf + DEPTH + 1) == MSGDEC_OK &&
+			p == buf + DEPTH + 1;
+	free(buf);
+	return ok;
+}
+
+// decodes buf in one go, and again split up at random points, and checks that
+// the streaming decoder gives back the same values and the same data
+static bool streamcheck(const uchar *buf, int len, int maxpiece) {
+	struct msgdec_stream s;
+	msgdec_stream_init(&s);
+	const uchar *p = buf, *end = buf + len;
+	int fed = 0;
+	while (p != end) {
+		struct msgdec_val want = {0}, got = {0};
+		if (msgdec_get(&p, end, &want) != MSGDEC_OK) return false;
+		int ret;
+		while ((ret = msgdec_stream_next(&s, &got)) == MSGDEC_SHORT) {
+			if (fed == len) return false;
+			int n = rng() % maxpiece + (maxpiece == 1);
+			if (n > len - fed) n = len - fed;
+			msgdec_stream_feed(&s, buf + fed, n);
+			fed += n;
+		}
+		if (ret != MSGDEC_OK || got.type != want.type) return false;
+		if (want.type == MSGDEC_STR || want.type == MSGDEC_BIN ||
+				want.type == MSGDEC_EXT) {
+			if (got.len != want.len) return false;
+			// slices point straight into the input, so compare pointers!
+			const uchar *expect = want.data;
+			for (;;) {
+				if (got.data != expect) return false;
+				expect += got.datalen;
+				if (!got.more) break;
+				while ((ret = msgdec_stream_next(&s, &got)) == MSGDEC_SHORT) {
+					int n = rng() % maxpiece + 1;
+					if (n > len - fed) n = len - fed;
+					msgdec_stream_feed(&s, buf + fed, n);
+					fed += n;
+				}
+				if (ret != MSGDEC_OK || got.type != MSGDEC_CONT) return false;
+			}
+			if (expect != want.data + want.len) return false;
+		}
+		else if (got.u != want.u) { // (compares the whole union)
+			return false;
+		}
+	}
+	return msgdec_stream_atboundary(&s);
+}
+
+TEST("Streaming should give the same results however the input is split") {
+	static uchar buf[16384];
+	int len = genrecords(buf);
+	if (!streamcheck(buf, len, 1)) return false;
+	for (int i = 0; i < 200; ++i) {
+		if (!streamcheck(buf, len, rng() % 600 + 2)) return false;
+	}
+	return true;
+}
+
+TEST("Streaming should know where top-level values end") {
+	static const uchar buf[] = {
+		0x92, 0xA3, 'a', 'b', 'c', 0x81, 0x01, 0xC4, 0x02, 0xFF, 0xFF, // [..]
+		0x05 // 5
+	};
+	struct msgdec_stream s;
+	msgdec_stream_init(&s);
+	struct msgdec_val v;
+	// feed the first record a byte at a time and the second one separately
+	for (int i = 0; i < 11; ++i) {
+		if (msgdec_stream_atboundary(&s) != (i == 0)) return false;
+		msgdec_stream_feed(&s, buf + i, 1);
+		while (msgdec_stream_next(&s, &v) == MSGDEC_OK);
+	}
+	if (!msgdec_stream_atboundary(&s)) return false;
+	msgdec_stream_feed(&s, buf + 11, 1);
+	if (msgdec_stream_next(&s, &v) != MSGDEC_OK) return false;
+	return v.type == MSGDEC_UINT && v.u == 5 && msgdec_stream_atboundary(&s);
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,119 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "the work-stealing thread pool"};
+
+#include "../src/chunklets/fastspin.c"
+#include "../src/chunklets/pool.c"
+#include "../src/intdefs.h"
+
+#ifdef _WIN32
+void __stdcall Sleep(unsigned long ms);
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+static void sleepms(int n) {
+#ifdef _WIN32
+	Sleep(n);
+#else
+	nanosleep(&(struct timespec){n / 1000, n % 1000 * 1000000}, 0);
+#endif
+}
+
+static _Atomic uint nran = 0;
+static void count(void *ctx) {
+	atomic_fetch_add_explicit(&nran, 1, memory_order_relaxed);
+}
+
+TEST("Every submitted task should run exactly once") {
+	struct pool *p = pool_start(4);
+	if (!p) return false;
+	// enough to make the inbox grow a few times over
+	for (int i = 0; i < 10000; ++i) pool_submit(p, &count, 0);
+	pool_finish(p);
+	return nran == 10000;
+}
+
+static struct pool *splitpool;
+static _Atomic uint leaves = 0;
+static void split(void *ctx) {
+	uint n = (uint)(usize)ctx;
+	if (n == 1) {
+		atomic_fetch_add_explicit(&leaves, 1, memory_order_relaxed);
+		return;
+	}
+	// push lots onto our own deque, so it has to grow and others have to steal
+	pool_submit(splitpool, &split, (void *)(usize)(n / 2));
+	pool_submit(splitpool, &split, (void *)(usize)(n - n / 2));
+}
+
+TEST("Tasks submitted from inside tasks should all run", .timeout = 5000) {
+	splitpool = pool_start(4);
+	if (!splitpool) return false;
+	pool_submit(splitpool, &split, (void *)(usize)100000);
+	pool_finish(splitpool);
+	return leaves == 100000;
+}
+
+static struct pool *sharedpool;
+static _Atomic uint nshared = 0;
+static void sharedtask(void *ctx) {
+	atomic_fetch_add_explicit(&nshared, 1, memory_order_relaxed);
+}
+#ifdef _WIN32
+static unsigned long __stdcall submitter(void *ctx) {
+#else
+static void *submitter(void *ctx) {
+#endif
+	for (int i = 0; i < 5000; ++i) pool_submit(sharedpool, &sharedtask, 0);
+	return 0;
+}
+
+TEST("Submitting from several outside threads at once should work",
+		.timeout = 5000) {
+	sharedpool = pool_start(3);
+	if (!sharedpool) return false;
+	thread thrs[4]; // (from pool.c)
+#ifdef _WIN32
+	for (int i = 0; i < 4; ++i) {
+		thrs[i] = CreateThread(0, 0, &submitter, 0, 0, 0);
+	}
+	for (int i = 0; i < 4; ++i) {
+		WaitForSingleObject(thrs[i], INFINITE);
+		CloseHandle(thrs[i]);
+	}
+#else
+	for (int i = 0; i < 4; ++i) pthread_create(thrs + i, 0, &submitter, 0);
+	for (int i = 0; i < 4; ++i) pthread_join(thrs[i], 0);
+#endif
+	pool_finish(sharedpool);
+	return nshared == 20000;
+}
+
+static _Atomic uint nslow = 0;
+static void slow(void *ctx) {
+	sleepms(1);
+	atomic_fetch_add_explicit(&nslow, 1, memory_order_relaxed);
+}
+
+TEST("Workers should wake back up after going idle", .timeout = 5000) {
+	struct pool *p = pool_start(0);
+	if (!p || pool_nthreads(p) < 1) return false;
+	for (int round = 0; round < 20; ++round) {
+		// give everyone time to run dry and go to sleep in between
+		sleepms(5);
+		for (int i = 0; i < 5; ++i) pool_submit(p, &slow, 0);
+	}
+	pool_finish(p);
+	return nslow == 100;
+}
+
+TEST("A pool with one thread and no tasks should still finish") {
+	struct pool *p = pool_start(1);
+	if (!p || pool_nthreads(p) != 1) return false;
+	pool_finish(p);
+	return true;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,105 @@
+/* This file is dedicated to the public domain. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "../src/bitbuf.h"
+#include "../src/intdefs.h"
+
+/*
+ * Quick hacked-up microbenchmark for the fiddlier parts of bitbuf.h, mainly
+ * bitbuf_copybits(). This is not run as part of the build; it is just here for
+ * development and reference purposes. To compile:
+ * Unix: $CC -O2 -o.build/bitbufbench tools/bitbufbench.c
+ * Windows: clang-cl -fuse-ld=lld -O2 -Fe.build/bitbufbench.exe
+ *   tools/bitbufbench.c
+ */
+
+#define BUFSZ (64 * 1024 * 1024)
+
+static double now() {
+#ifdef _WIN32
+	LARGE_INTEGER freq, t;
+	QueryPerformanceFrequency(&freq); QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / freq.QuadPart;
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
+static void report(const char *what, double start, double nbytes) {
+	double secs = now() - start;
+	fprintf(stderr, "%-44s %8.1f MB/s\n", what, nbytes / secs / 1e6);
+}
+
+int main(void) {
+	// + 64 so there's room for the destination offset and the extra cell
+	char *srcbuf = malloc(BUFSZ), *dstbuf = malloc(BUFSZ + 64);
+	if (!srcbuf || !dstbuf) { fputs("out of memory\n", stderr); return 1; }
+	for (int i = 0; i < BUFSZ; ++i) srcbuf[i] = rand();
+	memset(dstbuf, 0, BUFSZ + 64); // fault it all in before timing anything
+	struct bitbuf dst = {{dstbuf}, BUFSZ + 64, (BUFSZ + 64) * 8, 0, false,
+			false, "dst"};
+	struct bitbuf_reader src = {{srcbuf}, BUFSZ, BUFSZ * 8, 0, false, false,
+			"src"};
+	static const struct { uint srcoff, dstoff; } offs[] = {
+		{0, 0}, {0, 3}, {5, 0}, {5, 3}, {13, 29}
+	};
+	char what[64];
+	for (int i = 0; i < sizeof(offs) / sizeof(*offs); ++i) {
+		uint nbits = (BUFSZ - 64) * 8;
+		bitbuf_reset(&dst);
+		bitbuf_appendbits(&dst, 0, offs[i].dstoff);
+		src.curbit = offs[i].srcoff;
+		double start = now();
+		bitbuf_copybits(&dst, &src, nbits);
+		snprintf(what, sizeof(what), "copybits, src +%u, dst +%u",
+				offs[i].srcoff, offs[i].dstoff);
+		report(what, start, nbits / 8);
+	}
+	// and for comparison, the obvious bit-at-a-time approach
+	{
+		uint nbits = 4 * 1024 * 1024 * 8;
+		bitbuf_reset(&dst);
+		bitbuf_appendbits(&dst, 0, 3);
+		src.curbit = 5;
+		double start = now();
+		for (uint i = 0; i < nbits; ++i) {
+			bitbuf_appendbits(&dst, bitbuf_readbits(&src, 1), 1);
+		}
+		report("bit-by-bit loop, src +5, dst +3", start, nbits / 8);
+	}
+	// compact encodings, with values spanning all the different sizes
+	{
+		uint *vals = malloc(BUFSZ / 32 * sizeof(uint));
+		if (!vals) { fputs("out of memory\n", stderr); return 1; }
+		int nvals = BUFSZ / 32;
+		for (int i = 0; i < nvals; ++i) vals[i] = (uint)rand() >> rand() % 32;
+		bitbuf_reset(&dst);
+		double start = now();
+		for (int i = 0; i < nvals; ++i) bitbuf_appendubitvar(&dst, vals[i]);
+		report("appendubitvar (output rate)", start, dst.curbit / 8);
+		bitbuf_reset(&dst);
+		start = now();
+		for (int i = 0; i < nvals; ++i) bitbuf_appendvarint32(&dst, vals[i]);
+		report("appendvarint32 (output rate)", start, dst.curbit / 8);
+		struct bitbuf_reader rd = {{dstbuf}, dst.curbit / 8 + 1, dst.curbit,
+				0, false, false, "rd"};
+		uint sum = 0;
+		start = now();
+		for (int i = 0; i < nvals; ++i) sum += bitbuf_readvarint32(&rd);
+		report("readvarint32 (input rate)", start, dst.curbit / 8);
+		if (rd.overflow) fprintf(stderr, "overflowed?! (sum %u)\n", sum);
+	}
+	return 0;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,255 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "../src/chunklets/pool.h"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "../src/os.h"
+#include "demofile.h"
+#include "demolist.h"
+#include "sstdata.h"
+
+#ifdef _WIN32
+#define fS "S"
+#else
+#define fS "s"
+#endif
+
+/*
+ * Checks lots of demos at once, using every core. Takes any number of demo
+ * files and/or directories (which are searched recursively for .dem files), and
+ * prints one line per demo followed by a summary. Each demo is a task in a
+ * work-stealing pool; demos bigger than CHUNKSZ get split up further, with each
+ * chunk of frames scanned for custom data separately and then the results
+ * stitched together in order by whichever chunk finishes last. Exits with
+ * status 2 if any demo had problems.
+ *
+ * Usage: demobatch [-j nthreads] files-or-dirs...
+ */
+
+#define CHUNKSZ (32 * 1024 * 1024)
+
+static cold noreturn die(int status, const char *s) {
+	fprintf(stderr, "demobatch: fatal: %s\n", s);
+	exit(status);
+}
+
+// a custom data message found while scanning a chunk, to be reassembled later
+struct found {
+	const uchar *data;
+	int len, flags, tick;
+};
+
+struct chunk {
+	struct job *job;
+	usize start, end; // frames starting in this range of the file
+	struct found *msgs;
+	int nmsgs, cap;
+	bool oom;
+};
+
+struct job {
+	const os_char *path;
+	struct demofile d;
+	const char *err;
+	usize erroff; // for frame errors
+	vlong nframes, npackets, nblocks, sstbytes;
+	int mintick, maxtick;
+	bool anyticks;
+	struct chunk *chunks;
+	int nchunks;
+	_Atomic int chunksleft;
+};
+
+static struct job *jobs;
+static int njobs;
+static struct pool *pool;
+
+static void finishjob(struct job *j) {
+	struct sstdata_asm a = {0};
+	sstdata_asminit(&a);
+	for (int i = 0; i < j->nchunks; ++i) {
+		struct chunk *c = j->chunks + i;
+		if_cold (c->oom && !j->err) j->err = "out of memory";
+		for (int k = 0; k < c->nmsgs; ++k) {
+			struct sstdata_msg m = {c->msgs[k].data, c->msgs[k].len,
+					c->msgs[k].flags};
+			const uchar *buf;
+			int len = sstdata_push(&a, &m, &buf);
+			if_cold (len < 0 && !j->err) j->err = "invalid custom data";
+			if (len > 0) { ++j->nblocks; j->sstbytes += len; }
+		}
+		free(c->msgs);
+	}
+	sstdata_asmfree(&a);
+	free(j->chunks);
+	demofile_close(&j->d);
+}
+
+static void scanchunk(void *c_) {
+	struct chunk *c = c_;
+	struct job *j = c->job;
+	int lenbits = sstdata_lenbits(&j->d);
+	struct demo_iter it = {&j->d, c->start};
+	struct demo_frame f;
+	while (it.off < c->end && demofile_next(&it, &f)) {
+		if (f.cmd != DEMO_CMD_PACKET) continue;
+		struct sstdata_scan s;
+		sstdata_scaninit(&s, f.data, f.datalen, lenbits);
+		struct sstdata_msg m;
+		while (sstdata_nextmsg(&s, &m)) {
+			if (c->nmsgs == c->cap) {
+				int cap = c->cap ? c->cap * 2 : 64;
+				struct found *msgs = realloc(c->msgs, cap * sizeof(*msgs));
+				if_cold (!msgs) { c->oom = true; goto done; }
+				c->msgs = msgs; c->cap = cap;
+			}
+			c->msgs[c->nmsgs++] = (struct found){m.data, m.len, m.flags, f.tick};
+		}
+	}
+done:
+	// last one out puts everything together
+	if (atomic_fetch_sub_explicit(&j->chunksleft, 1, memory_order_acq_rel) == 1) {
+		finishjob(j);
+	}
+}
+
+static void dojob(void *j_) {
+	struct job *j = j_;
+	if_cold (!demofile_open(&j->d, j->path)) { j->err = j->d.err; return; }
+	// first, a quick pass over just the frame headers for the stats, also
+	// noting where to split the file up for the more expensive part
+	int maxchunks = j->d.sz / CHUNKSZ + 1;
+	j->chunks = calloc(maxchunks, sizeof(*j->chunks));
+	if_cold (!j->chunks) {
+		j->err = "out of memory";
+		demofile_close(&j->d);
+		return;
+	}
+	usize nextsplit = CHUNKSZ;
+	j->nchunks = 1;
+	j->chunks[0] = (struct chunk){j, 0};
+	struct demo_iter it = {&j->d};
+	struct demo_frame f;
+	while (demofile_next(&it, &f)) {
+		if (f.off >= nextsplit && j->nchunks < maxchunks) {
+			j->chunks[j->nchunks - 1].end = f.off;
+			j->chunks[j->nchunks++] = (struct chunk){j, f.off};
+			nextsplit = f.off + CHUNKSZ;
+		}
+		++j->nframes;
+		if (f.cmd == DEMO_CMD_PACKET) {
+			++j->npackets;
+			if (!j->anyticks || f.tick < j->mintick) j->mintick = f.tick;
+			if (!j->anyticks || f.tick > j->maxtick) j->maxtick = f.tick;
+			j->anyticks = true;
+		}
+	}
+	j->chunks[j->nchunks - 1].end = it.off;
+	if_cold (it.err) { j->err = it.err; j->erroff = it.off; }
+	j->chunksleft = j->nchunks;
+	// hand off all but one chunk to be stolen by whoever's idle
+	for (int i = 1; i < j->nchunks; ++i) pool_submit(pool, &scanchunk,
+			j->chunks + i);
+	scanchunk(j->chunks);
+}
+
+static double now() {
+#ifdef _WIN32
+	LARGE_INTEGER freq, t;
+	QueryPerformanceFrequency(&freq); QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / freq.QuadPart;
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
+static int parsenum(const os_char *s) {
+	int ret = 0;
+	for (; *s; ++s) {
+		if_cold (*s < '0' || *s > '9' || ret > 9999) return -1;
+		ret = ret * 10 + *s - '0';
+	}
+	return ret;
+}
+
+int OS_MAIN(int argc, os_char *argv[]) {
+	int nthreads = 0;
+	struct demolist l = {0};
+	for (int i = 1; i < argc; ++i) {
+		if (!os_strcmp(argv[i], OS_LIT("-j"))) {
+			if_cold (++i == argc) die(1, "missing thread count after -j");
+			nthreads = parsenum(argv[i]);
+			if_cold (nthreads < 0) die(1, "invalid thread count");
+			continue;
+		}
+		if_cold (!demolist_add(&l, argv[i])) {
+			fprintf(stderr, "demobatch: %" fS ": %s\n",
+					l.errpath ? l.errpath : argv[i], l.err);
+		}
+	}
+	if_cold (!l.n) die(1, "no demo files given");
+	njobs = l.n;
+	jobs = calloc(njobs, sizeof(*jobs));
+	if_cold (!jobs) die(100, "couldn't allocate memory");
+	for (int i = 0; i < njobs; ++i) jobs[i].path = l.paths[i];
+	double start = now();
+	pool = pool_start(nthreads);
+	if_cold (!pool) die(100, "couldn't start worker threads");
+	nthreads = pool_nthreads(pool);
+	for (int i = 0; i < njobs; ++i) pool_submit(pool, &dojob, jobs + i);
+	pool_finish(pool);
+	double secs = now() - start;
+
+	int nbad = 0;
+	vlong totalsz = 0, totalframes = 0, totalblocks = 0;
+	for (int i = 0; i < njobs; ++i) {
+		const struct job *j = jobs + i;
+		totalsz += j->d.sz;
+		totalframes += j->nframes;
+		totalblocks += j->nblocks;
+		printf("%s %" fS ": %lld frames", j->err ? "FAIL" : "ok  ", j->path,
+				j->nframes);
+		if (j->anyticks) printf(", ticks %d-%d", j->mintick, j->maxtick);
+		printf(", %lld SST blocks (%lld bytes)", j->nblocks, j->sstbytes);
+		if (j->err) {
+			++nbad;
+			if (j->erroff) printf(": %s at offset %lld", j->err,
+					(vlong)j->erroff);
+			else printf(": %s", j->err);
+		}
+		putchar('\n');
+	}
+	printf("%d demos, %d with problems; %lld frames, %lld SST blocks; "
+			"%.1f MB in %.2f s (%.1f MB/s) on %d threads\n", njobs, nbad,
+			totalframes, totalblocks, totalsz / 1e6, secs, totalsz / secs / 1e6,
+			nthreads);
+	demolist_free(&l);
+	return nbad ? 2 : 0;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
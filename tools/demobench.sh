@@ -0,0 +1,69 @@
+#!/bin/sh -e
+# This file is dedicated to the public domain.
+
+# Runs each of the offline demo tools over a synthetic corpus from gendemo and
+# reports throughput, to catch parsing performance regressions without needing
+# anyone's real demos. Run ./compile first, then from the repo root:
+#
+#   tools/demobench.sh [ndemos] [ticks]
+#
+# The corpus is made to look like one autorecorded run (bench.dem, bench_2.dem
+# and so on) with a mix of games and compressed and uncompressed custom data,
+# and is deleted again afterwards. The sealed records are checked with gendemo's
+# test key, so sstverify also has to pass. Uses GNU date for sub-second timing.
+
+ndemos="${1:-8}"
+ticks="${2:-50000}"
+b=.build
+dir="`mktemp -d`"
+trap 'rm -rf "$dir"' EXIT
+
+frames=0
+i=1
+while [ $i -le $ndemos ]; do
+	if [ $i = 1 ]; then f="$dir/bench.dem"; else f="$dir/bench_$i.dem"; fi
+	case $((i % 4)) in
+		0) opts="-g l4d2" ;;
+		1) opts="" ;;
+		2) opts="-z" ;;
+		3) opts="-c 400 -z" ;;
+	esac
+	n="`$b/gendemo -t $ticks -s $i $opts "$f" | cut -d' ' -f1`"
+	frames=$((frames + n))
+	i=$((i + 1))
+done
+bytes="`cat "$dir"/*.dem | wc -c`"
+echo "corpus: $ndemos demos, $frames frames, $bytes bytes"
+
+now() { date +%s%N; }
+
+bench() {
+	_what="$1"; shift
+	_start="`now`"
+	"$@" >/dev/null
+	_end="`now`"
+	awk -v w="$_what" -v ns=$((_end - _start)) -v b=$bytes -v f=$frames \
+			'BEGIN { s = ns / 1e9; printf "%-24s %8.3f s %10.1f MB/s %12.0f frames/s\n",
+			w, s, b / s / 1e6, f / s }'
+}
+
+bench demostat $b/demostat "$dir"/*.dem
+bench sstdump $b/sstdump "$dir"/*.dem
+bench demobatch $b/demobatch "$dir"
+bench "demobatch -j 1" $b/demobatch -j 1 "$dir"
+# the private key that gendemo seals everything for (see the top of gendemo.c)
+echo 67656E64656D6F2074657374206B65792C206E6F742061207365637265742121 \
+		>"$dir/test.key"
+bench sstverify $b/sstverify -k "$dir/test.key" "$dir"
+bench "sstverify -j 1" $b/sstverify -k "$dir/test.key" -j 1 "$dir"
+bench "demoidx (build)" $b/demoidx "$dir"/*.dem
+bench "demoidx -c" $b/demoidx -c "$dir"/*.dem
+bench "demorun -c" $b/demorun -c "$dir/bench.sstrun" "$dir/bench.dem"
+mkdir "$dir/x"
+bench "demorun -x" $b/demorun -x "$dir/bench.sstrun" "$dir/x"
+rm -rf "$dir/x" "$dir"/*.idx "$dir/bench.sstrun"
+# these two only read headers, so MB/s and frames/s are nominal here
+bench "lsdemos (cold)" $b/lsdemos "$dir"
+bench "lsdemos (cached)" $b/lsdemos "$dir"
+
+# vi: sw=4 ts=4 noet tw=80 cc=80
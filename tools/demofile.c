@@ -0,0 +1,187 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "../src/demodefs.h"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "../src/os.h"
+#include "demofile.h"
+
+_Static_assert(sizeof(struct demo_hdr) == 1072, "demo_hdr has the wrong size");
+
+// everything in the file is little endian, and may well be unaligned
+static inline int get32(const uchar *p) {
+	return (int)((uint)p[0] | (uint)p[1] << 8 | (uint)p[2] << 16 |
+			(uint)p[3] << 24);
+}
+
+static bool inithdr(struct demofile *d) {
+	const struct demo_hdr *h = (const struct demo_hdr *)d->base;
+	if_cold (d->sz < sizeof(*h)) { d->err = "file too short"; return false; }
+	if_cold (memcmp(h->sig, "HL2DEMO", 8)) {
+		d->err = "not a demo file";
+		return false;
+	}
+	d->hdr = h;
+	// see also the DEMO_PROTO_* enum. these numbers were mostly gathered from
+	// Uncrafted's parser, since he did the legwork across all the old builds
+	switch (h->demover) {
+		case 2: d->proto = DEMO_PROTO_HL2OE; break;
+		case 3:
+			if (h->netver == 7) d->proto = DEMO_PROTO_PORTAL_3420;
+			else if (h->netver == 14) d->proto = DEMO_PROTO_PORTAL_5135;
+			else d->proto = DEMO_PROTO_PORTAL_STEAM;
+			break;
+		case 4:
+			if (h->netver == 2001) d->proto = DEMO_PROTO_PORTAL2;
+			else if (h->netver >= 2042) d->proto = DEMO_PROTO_L4D2042;
+			else d->proto = DEMO_PROTO_L4D2000; // (also L4D1, near enough)
+			break;
+		default: d->err = "unsupported demo protocol version"; return false;
+	}
+	d->hasslot = h->demover >= 4;
+	// L4D branch games have up to 4 split screen players, Portal 2 has 2
+	d->nslots = h->demover < 4 ? 1 : d->proto == DEMO_PROTO_PORTAL2 ? 2 : 4;
+	d->err = 0;
+	return true;
+}
+
+bool demofile_init(struct demofile *d, const void *buf, usize sz) {
+	d->base = buf;
+	d->sz = sz;
+	d->mapped = false;
+	return inithdr(d);
+}
+
+bool demofile_open(struct demofile *d, const os_char *path) {
+	d->mapped = false;
+	int f = os_open_read(path);
+	if_cold (f == -1) { d->err = "couldn't open file"; return false; }
+	vlong sz = os_fsize(f);
+	if_cold (sz == -1) {
+		d->err = "couldn't get file size";
+		os_close(f);
+		return false;
+	}
+	// mapping an empty file fails, so give a more helpful error for that case
+	if_cold (sz < ssizeof(struct demo_hdr)) {
+		d->err = "file too short";
+		os_close(f);
+		return false;
+	}
+	d->base = os_mapfile(f, sz);
+	os_close(f);
+	if_cold (!d->base) { d->err = "couldn't map file"; return false; }
+	d->sz = sz;
+	d->mapped = true;
+	if_cold (!inithdr(d)) { demofile_close(d); return false; }
+	return true;
+}
+
+void demofile_close(struct demofile *d) {
+	if (d->mapped) os_unmapfile(d->base, d->sz);
+	d->base = 0;
+	d->mapped = false;
+}
+
+// reads a length-prefixed blob at *p, making sure it actually fits in the file
+static bool getblob(const uchar **p, const uchar *end, const uchar **data,
+		int *len) {
+	if_cold (end - *p < 4) return false;
+	int n = get32(*p);
+	*p += 4;
+	if_cold (n < 0 || n > end - *p) return false;
+	*data = *p; *len = n;
+	*p += n;
+	return true;
+}
+
+bool demofile_next(struct demo_iter *it, struct demo_frame *f) {
+	const struct demofile *d = it->d;
+	if (!it->off) it->off = sizeof(struct demo_hdr);
+	const uchar *p = d->base + it->off, *end = d->base + d->sz;
+	it->err = 0;
+	if (it->stopped || p == end) return false; // (no stop frame is also fine)
+	// cmd, tick, and optionally the player slot
+	if_cold (end - p < 5 + d->hasslot) goto trunc;
+	f->off = it->off;
+	f->cmd = p[0];
+	f->tick = get32(p + 1);
+	p += 5;
+	f->slot = d->hasslot ? *p++ : 0;
+	f->cmdinfo = 0; f->data = 0; f->datalen = 0;
+	f->seqin = 0; f->seqout = 0; f->cbidx = 0;
+	switch (f->cmd) {
+		case DEMO_CMD_SIGNON: case DEMO_CMD_PACKET:
+			if_cold (end - p < d->nslots * DEMO_CMDINFO_SZ + 8) goto trunc;
+			f->cmdinfo = p;
+			p += d->nslots * DEMO_CMDINFO_SZ;
+			f->seqin = get32(p); f->seqout = get32(p + 4);
+			p += 8;
+			if_cold (!getblob(&p, end, &f->data, &f->datalen)) goto trunc;
+			break;
+		case DEMO_CMD_SYNC:
+			break;
+		case DEMO_CMD_STOP:
+			// anything after this is junk as far as the game is concerned
+			it->stopped = true;
+			break;
+		case DEMO_CMD_CONCMD: case DEMO_CMD_DATATABLES:
+			if_cold (!getblob(&p, end, &f->data, &f->datalen)) goto trunc;
+			break;
+		case DEMO_CMD_USERCMD:
+			if_cold (end - p < 4) goto trunc;
+			f->seqout = get32(p);
+			p += 4;
+			if_cold (!getblob(&p, end, &f->data, &f->datalen)) goto trunc;
+			break;
+		case 8: // DEMO_CMD_STRINGTABLES14 or DEMO_CMD_CUSTOMDATA
+			if (d->hasslot) {
+				if_cold (end - p < 4) goto trunc;
+				f->cbidx = get32(p);
+				p += 4;
+			}
+			if_cold (!getblob(&p, end, &f->data, &f->datalen)) goto trunc;
+			break;
+		case DEMO_CMD_STRINGTABLES36:
+			if_cold (!d->hasslot) goto bad;
+			if_cold (!getblob(&p, end, &f->data, &f->datalen)) goto trunc;
+			break;
+		default: goto bad;
+	}
+	it->off = p - d->base;
+	return true;
+trunc:
+	it->err = "truncated frame";
+	return false;
+bad:
+	it->err = "invalid frame type";
+	return false;
+}
+
+const char *demofile_walk(const struct demofile *d,
+		bool (*cb)(void *ctx, const struct demo_frame *f), void *ctx) {
+	struct demo_iter it = {d};
+	struct demo_frame f;
+	while (demofile_next(&it, &f)) {
+		if (!cb(ctx, &f)) break;
+	}
+	return it.err;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,99 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef INC_DEMOFILE_H
+#define INC_DEMOFILE_H
+
+#include "../src/demodefs.h"
+#include "../src/intdefs.h"
+#include "../src/os.h"
+
+/*
+ * Offline demo file reader, for use by host-side tools. Demos are memory-mapped
+ * and all the frame data handed out points straight into the mapping, so
+ * nothing gets copied unless the caller decides to copy it.
+ */
+
+struct demofile {
+	const uchar *base; // the entire file
+	usize sz;
+	const struct demo_hdr *hdr; // (same as base, for convenience)
+	int proto; // DEMO_PROTO_*
+	int nslots; // number of split screen view infos in each packet frame
+	bool hasslot; // whether frames have a player slot byte (demover 4+)
+	bool mapped; // whether base needs to be unmapped when closing
+	const char *err; // reason for the last failure, if any
+};
+
+/* A single frame in a demo. Pointers are only valid while the file is open. */
+struct demo_frame {
+	usize off; // offset of the start of the frame in the file
+	int cmd; // enum demo_cmd
+	int tick;
+	int slot; // split screen player slot, or 0 for older demos
+	// for signon/packet frames: nslots view infos, 76 bytes each; else null
+	const uchar *cmdinfo;
+	int seqin, seqout; // for signon/packet frames (seqout also for usercmds)
+	int cbidx; // for custom data frames: the callback index
+	const uchar *data; // the frame's main payload, if any (else null)
+	int datalen;
+};
+
+#define DEMO_CMDINFO_SZ 76
+
+/*
+ * Opens and memory-maps the demo at path and validates its header. Returns
+ * true on success. On failure, returns false and sets d->err.
+ */
+bool demofile_open(struct demofile *d, const os_char *path);
+
+/*
+ * Sets up d to read a demo which is already in memory, validating its header.
+ * The buffer must stay around until the demofile is no longer used. Returns
+ * true on success. On failure, returns false and sets d->err.
+ */
+bool demofile_init(struct demofile *d, const void *buf, usize sz);
+
+/* Releases the mapping set up by demofile_open(), if any. */
+void demofile_close(struct demofile *d);
+
+/*
+ * Iterator over the frames in a demo, in file order. Zero-initialise, set the
+ * file, and then call demofile_next() until it returns false. Afterwards, err
+ * is null if the demo ended cleanly (on a stop frame or exactly at EOF), or an
+ * error description otherwise, with off pointing at the offending frame.
+ */
+struct demo_iter {
+	const struct demofile *d;
+	usize off; // offset of the next frame; 0 means right after the header
+	const char *err;
+	bool stopped; // set once the stop frame has been returned
+};
+
+/* Reads the next frame into f. Returns false at the end or on error. */
+bool demofile_next(struct demo_iter *it, struct demo_frame *f);
+
+/*
+ * Calls cb for each frame in the demo, stopping early if it returns false.
+ * Returns null if there were no problems (including if the callback stopped
+ * early), or else an error description.
+ */
+const char *demofile_walk(const struct demofile *d,
+		bool (*cb)(void *ctx, const struct demo_frame *f), void *ctx);
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
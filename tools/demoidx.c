@@ -0,0 +1,170 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "../src/os.h"
+#include "demofile.h"
+#include "demoindex.h"
+
+#ifdef _WIN32
+#define fS "S"
+#else
+#define fS "s"
+#endif
+
+/*
+ * Builds or uses the sidecar index files described in demoindex.h.
+ *
+ *   demoidx demos...          writes foo.dem.idx for each foo.dem
+ *   demoidx -c demos...       checks that each index matches its demo
+ *   demoidx -t tick demos...  looks up a tick via each index
+ *
+ * Exits with status 2 if any demo or index has a problem.
+ */
+
+static cold noreturn die(int status, const char *s) {
+	fprintf(stderr, "demoidx: fatal: %s\n", s);
+	exit(status);
+}
+
+static os_char *idxpath(const os_char *path) {
+	static const os_char ext[] = OS_LIT(DEMOINDEX_EXT);
+	int len = os_strlen(path);
+	os_char *ret = malloc((len + countof(ext)) * sizeof(os_char));
+	if_cold (!ret) die(100, "couldn't allocate memory");
+	os_spancopy(ret, path, len);
+	os_spancopy(ret + len, ext, countof(ext));
+	return ret;
+}
+
+static bool build(const os_char *path, const struct demofile *d,
+		const os_char *ipath) {
+	const char *frameerr;
+	const char *err = demoindex_build(d, ipath, &frameerr);
+	if_cold (err) {
+		fprintf(stderr, "demoidx: %" fS ": %s\n", ipath, err);
+		return false;
+	}
+	struct demoindex x;
+	if_cold (!demoindex_open(&x, ipath)) {
+		fprintf(stderr, "demoidx: %" fS ": %s\n", ipath, x.err);
+		return false;
+	}
+	printf("%" fS ": %u ticks, %u marks, %u SST chunks\n", path,
+			x.hdr->nticks, x.hdr->nmarks, x.hdr->nsst);
+	demoindex_close(&x);
+	if_cold (frameerr) {
+		fprintf(stderr, "demoidx: %" fS ": %s (indexed up to there)\n", path,
+				frameerr);
+		return false;
+	}
+	return true;
+}
+
+static bool check(const os_char *path, const struct demofile *d,
+		const os_char *ipath) {
+	struct demoindex x;
+	if_cold (!demoindex_open(&x, ipath)) {
+		fprintf(stderr, "demoidx: %" fS ": %s\n", ipath, x.err);
+		return false;
+	}
+	bool ok = demoindex_matches(&x, d, true);
+	printf("%s %" fS "\n", ok ? "ok   " : "STALE", path);
+	demoindex_close(&x);
+	return ok;
+}
+
+static bool lookup(const os_char *path, const struct demofile *d,
+		const os_char *ipath, int tick) {
+	struct demoindex x;
+	if_cold (!demoindex_open(&x, ipath)) {
+		fprintf(stderr, "demoidx: %" fS ": %s\n", ipath, x.err);
+		return false;
+	}
+	// only a quick check here, since hashing the whole demo would defeat the
+	// whole point of having an index
+	if_cold (!demoindex_matches(&x, d, false)) {
+		fprintf(stderr, "demoidx: %" fS ": index is out of date\n", path);
+		demoindex_close(&x);
+		return false;
+	}
+	int i = demoindex_findtick(&x, tick);
+	if (i == -1) printf("%" fS ": tick %d: before the start", path, tick);
+	else printf("%" fS ": tick %d: frame at offset %llu (tick %d)", path, tick,
+			x.ticks[i].off, x.ticks[i].tick);
+	int j = demoindex_findsst(&x, tick);
+	if (j < x.hdr->nsst) {
+		printf(", next SST chunk at offset %llu (tick %d)\n", x.sst[j].off,
+				x.sst[j].tick);
+	}
+	else {
+		fputs(", no more SST chunks\n", stdout);
+	}
+	demoindex_close(&x);
+	return true;
+}
+
+static int parsetick(const os_char *s) {
+	bool neg = *s == '-';
+	int ret = 0;
+	s += neg;
+	if_cold (!*s) die(1, "invalid tick number");
+	for (; *s; ++s) {
+		if_cold (*s < '0' || *s > '9' || ret > 99999999) {
+			die(1, "invalid tick number");
+		}
+		ret = ret * 10 + *s - '0';
+	}
+	return neg ? -ret : ret;
+}
+
+int OS_MAIN(int argc, os_char *argv[]) {
+	enum { BUILD, CHECK, LOOKUP } mode = BUILD;
+	int tick = 0, i = 1;
+	if (argc > 1 && !os_strcmp(argv[1], OS_LIT("-c"))) {
+		mode = CHECK;
+		++i;
+	}
+	else if (argc > 1 && !os_strcmp(argv[1], OS_LIT("-t"))) {
+		if_cold (argc < 3) die(1, "missing tick number after -t");
+		mode = LOOKUP;
+		tick = parsetick(argv[2]);
+		i += 2;
+	}
+	if_cold (i == argc) die(1, "no demo files given");
+	bool ok = true;
+	for (; i < argc; ++i) {
+		struct demofile d;
+		if_cold (!demofile_open(&d, argv[i])) {
+			fprintf(stderr, "demoidx: %" fS ": %s\n", argv[i], d.err);
+			ok = false;
+			continue;
+		}
+		os_char *ipath = idxpath(argv[i]);
+		if (mode == BUILD) ok &= build(argv[i], &d, ipath);
+		else if (mode == CHECK) ok &= check(argv[i], &d, ipath);
+		else ok &= lookup(argv[i], &d, ipath, tick);
+		free(ipath);
+		demofile_close(&d);
+	}
+	return ok ? 0 : 2;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,216 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/3p/monocypher/monocypher.h"
+#include "../src/demodefs.h"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "../src/os.h"
+#include "demofile.h"
+#include "demoindex.h"
+#include "sstdata.h"
+
+// the index is read in place, so its layout has to be nailed down exactly
+_Static_assert(sizeof(struct demoindex_hdr) == 72, "wrong index header size");
+_Static_assert(sizeof(struct demoindex_ent) == 16, "wrong index entry size");
+
+static const char magic[8] = "SSTDMIDX";
+
+struct table {
+	struct demoindex_ent *ents;
+	uint n, cap;
+};
+
+static bool add(struct table *t, uvlong off, int tick, uint info) {
+	if (t->n == t->cap) {
+		uint cap = t->cap ? t->cap * 2 : 1024;
+		struct demoindex_ent *ents = realloc(t->ents, cap * sizeof(*ents));
+		if_cold (!ents) return false;
+		t->ents = ents; t->cap = cap;
+	}
+	t->ents[t->n++] = (struct demoindex_ent){off, tick, info};
+	return true;
+}
+
+static bool writeall(int f, const void *buf, usize len) {
+	for (const char *p = buf; len;) {
+		int n = os_write(f, p, len > 1 << 30 ? 1 << 30 : len);
+		if_cold (n <= 0) return false;
+		p += n; len -= n;
+	}
+	return true;
+}
+
+const char *demoindex_build(const struct demofile *d, const os_char *outpath,
+		const char **frameerr) {
+	struct table ticks = {0}, marks = {0}, sst = {0};
+	const char *err = 0;
+	int lenbits = sstdata_lenbits(d);
+	bool anytick = false, sstunordered = false;
+	int maxtick = 0;
+	struct demo_iter it = {d};
+	struct demo_frame f;
+	while (demofile_next(&it, &f)) {
+		// signon frames all claim to be tick 0 and are easily found via marks
+		if (f.cmd != DEMO_CMD_SIGNON && (!anytick || f.tick > maxtick)) {
+			if_cold (!add(&ticks, f.off, f.tick, f.cmd)) goto oom;
+			anytick = true;
+			maxtick = f.tick;
+		}
+		switch (f.cmd) {
+			case DEMO_CMD_SIGNON: case DEMO_CMD_SYNC: case DEMO_CMD_STOP:
+				if_cold (!add(&marks, f.off, f.tick, f.cmd)) goto oom;
+				break;
+			case DEMO_CMD_PACKET:;
+				struct sstdata_scan s;
+				sstdata_scaninit(&s, f.data, f.datalen, lenbits);
+				struct sstdata_msg m;
+				while (sstdata_nextmsg(&s, &m)) {
+					if_cold (sst.n && f.tick < sst.ents[sst.n - 1].tick) {
+						sstunordered = true;
+					}
+					if_cold (!add(&sst, m.data - d->base, f.tick,
+							m.len | m.flags << 8)) {
+						goto oom;
+					}
+				}
+		}
+	}
+	if (frameerr) *frameerr = it.err;
+	struct demoindex_hdr h = {
+		.version = DEMOINDEX_VERSION,
+		.flags = (it.err ? DEMOINDEX_F_TRUNCATED : 0) |
+				(sstunordered ? DEMOINDEX_F_SSTUNORDERED : 0),
+		.nticks = ticks.n, .nmarks = marks.n, .nsst = sst.n,
+		.demosz = d->sz
+	};
+	memcpy(h.magic, magic, sizeof(h.magic));
+	crypto_blake2b(h.demohash, sizeof(h.demohash), d->base, d->sz);
+	int out = os_open_writetrunc(outpath);
+	if_cold (out == -1) { err = "couldn't create index file"; goto e; }
+	if_cold (!writeall(out, &h, sizeof(h)) ||
+			!writeall(out, ticks.ents, ticks.n * sizeof(*ticks.ents)) ||
+			!writeall(out, marks.ents, marks.n * sizeof(*marks.ents)) ||
+			!writeall(out, sst.ents, sst.n * sizeof(*sst.ents))) {
+		err = "couldn't write index file";
+	}
+	os_close(out);
+	goto e;
+oom:
+	err = "out of memory";
+e:	free(ticks.ents); free(marks.ents); free(sst.ents);
+	return err;
+}
+
+bool demoindex_open(struct demoindex *x, const os_char *path) {
+	int f = os_open_read(path);
+	if_cold (f == -1) { x->err = "couldn't open index file"; return false; }
+	vlong sz = os_fsize(f);
+	if_cold (sz == -1) {
+		x->err = "couldn't get index file size";
+		os_close(f);
+		return false;
+	}
+	if_cold (sz < ssizeof(struct demoindex_hdr)) {
+		x->err = "index file too short";
+		os_close(f);
+		return false;
+	}
+	x->base = os_mapfile(f, sz);
+	os_close(f);
+	if_cold (!x->base) { x->err = "couldn't map index file"; return false; }
+	x->sz = sz;
+	const struct demoindex_hdr *h = (const struct demoindex_hdr *)x->base;
+	if_cold (memcmp(h->magic, magic, sizeof(magic))) {
+		x->err = "not a demo index file";
+		goto e;
+	}
+	if_cold (h->version != DEMOINDEX_VERSION) {
+		x->err = "unsupported index version";
+		goto e;
+	}
+	uvlong nents = (uvlong)h->nticks + h->nmarks + h->nsst;
+	if_cold (sizeof(*h) + nents * sizeof(struct demoindex_ent) != x->sz) {
+		x->err = "index file has the wrong size";
+		goto e;
+	}
+	x->hdr = h;
+	x->ticks = (const struct demoindex_ent *)(h + 1);
+	x->marks = x->ticks + h->nticks;
+	x->sst = x->marks + h->nmarks;
+	// catch anything that would send callers off the end of the demo, so that
+	// they don't each have to worry about it
+	for (uvlong i = 0; i < nents; ++i) {
+		const struct demoindex_ent *e = x->ticks + i;
+		uvlong end = e->off + (e >= x->sst ? e->info & 0xFF : 1);
+		if_cold (end > h->demosz) { x->err = "corrupt index file"; goto e; }
+	}
+	for (uint i = 1; i < h->nticks; ++i) {
+		if_cold (x->ticks[i].tick <= x->ticks[i - 1].tick) {
+			x->err = "corrupt index file";
+			goto e;
+		}
+	}
+	x->err = 0;
+	return true;
+e:	os_unmapfile(x->base, x->sz);
+	x->base = 0;
+	return false;
+}
+
+void demoindex_close(struct demoindex *x) {
+	if (x->base) os_unmapfile(x->base, x->sz);
+	x->base = 0;
+}
+
+bool demoindex_matches(const struct demoindex *x, const struct demofile *d,
+		bool full) {
+	if (x->hdr->demosz != d->sz) return false;
+	if (!full) return true;
+	uchar hash[32];
+	crypto_blake2b(hash, sizeof(hash), d->base, d->sz);
+	return !crypto_verify32(hash, x->hdr->demohash);
+}
+
+int demoindex_findtick(const struct demoindex *x, int tick) {
+	// find the first entry after tick; the one before that is the answer
+	int lo = 0, hi = x->hdr->nticks;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (x->ticks[mid].tick <= tick) lo = mid + 1; else hi = mid;
+	}
+	return lo - 1;
+}
+
+int demoindex_findsst(const struct demoindex *x, int tick) {
+	int n = x->hdr->nsst;
+	if_cold (x->hdr->flags & DEMOINDEX_F_SSTUNORDERED) {
+		int i = 0;
+		for (; i < n && x->sst[i].tick < tick; ++i);
+		return i;
+	}
+	int lo = 0, hi = n;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (x->sst[mid].tick < tick) lo = mid + 1; else hi = mid;
+	}
+	return lo;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,130 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef INC_DEMOINDEX_H
+#define INC_DEMOINDEX_H
+
+#include "../src/intdefs.h"
+#include "../src/os.h"
+#include "demofile.h"
+#include "sstdata.h"
+
+/*
+ * Sidecar index files for demos, so that tools can jump straight to a given
+ * tick or to SST's custom data without rescanning what could be gigabytes of
+ * demo. The index lives next to the demo, as foo.dem.idx, and is laid out as a
+ * header followed by three tables of fixed-size entries, all little endian:
+ *
+ *   ticks: the first frame of each new tick, in increasing tick order. Ticks
+ *          which go backwards (e.g. signon frames, which are all tick 0) are
+ *          skipped, so that this can always be binary searched.
+ *   marks: every signon, sync and stop frame, in file order.
+ *   sst:   every chunk of SST's custom data, in file order, with the offset of
+ *          the chunk's data in the file, ready to be reassembled.
+ *
+ * The header records the size and BLAKE2b hash of the demo, so that a stale
+ * index can be detected if the demo is replaced.
+ */
+
+#define DEMOINDEX_VERSION 1
+#define DEMOINDEX_EXT ".idx"
+
+struct demoindex_hdr {
+	char magic[8]; // "SSTDMIDX"
+	uint version;
+	uint flags; // DEMOINDEX_F_*
+	uint nticks, nmarks, nsst;
+	uint _pad;
+	uvlong demosz;
+	uchar demohash[32]; // BLAKE2b-256 of the whole demo file
+};
+
+enum {
+	// the demo had a bad frame; everything before it is still indexed
+	DEMOINDEX_F_TRUNCATED = 1,
+	// sst ticks go backwards somewhere, so demoindex_findsst() can't bisect
+	DEMOINDEX_F_SSTUNORDERED = 2
+};
+
+struct demoindex_ent {
+	uvlong off; // ticks/marks: offset of the frame; sst: offset of the data
+	int tick;
+	// ticks/marks: the frame's command (enum demo_cmd);
+	// sst: the chunk length in the low byte and its marker flags above that
+	uint info;
+};
+
+/* An index which has been opened and validated. */
+struct demoindex {
+	const uchar *base;
+	usize sz;
+	const struct demoindex_hdr *hdr;
+	const struct demoindex_ent *ticks, *marks, *sst;
+	const char *err; // reason for the last failure, if any
+};
+
+/*
+ * Scans the demo and writes an index for it to outpath. Returns null on
+ * success, or else an error description. A demo with a bad frame still gets an
+ * index covering the frames before it, with DEMOINDEX_F_TRUNCATED set, and the
+ * frame error is returned via *frameerr if frameerr is non-null.
+ */
+const char *demoindex_build(const struct demofile *d, const os_char *outpath,
+		const char **frameerr);
+
+/*
+ * Opens and maps the index at path, checking that it's well-formed. Returns
+ * true on success. On failure, returns false and sets x->err.
+ */
+bool demoindex_open(struct demoindex *x, const os_char *path);
+
+/* Releases the mapping set up by demoindex_open(). */
+void demoindex_close(struct demoindex *x);
+
+/*
+ * Checks whether the index belongs to the given demo. The size is always
+ * checked; the hash is only checked if full is true, since that means reading
+ * the entire demo. Returns true if everything checked matches.
+ */
+bool demoindex_matches(const struct demoindex *x, const struct demofile *d,
+		bool full);
+
+/*
+ * Returns the index into x->ticks of the last entry at or before the given
+ * tick, which is where to start reading to get every frame from that tick on.
+ * Returns -1 if the tick comes before any indexed tick.
+ */
+int demoindex_findtick(const struct demoindex *x, int tick);
+
+/*
+ * Returns the index into x->sst of the first chunk with a tick at or after the
+ * given one, or x->hdr->nsst if there isn't one.
+ */
+int demoindex_findsst(const struct demoindex *x, int tick);
+
+/* Turns an sst entry back into a message, as if found by sstdata_nextmsg(). */
+static inline void demoindex_sstmsg(const struct demoindex *x,
+		const struct demofile *d, int i, struct sstdata_msg *m) {
+	const struct demoindex_ent *e = x->sst + i;
+	m->data = d->base + e->off;
+	m->len = e->info & 0xFF;
+	m->flags = e->info >> 8;
+	m->bitoff = 0; // not recorded
+}
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
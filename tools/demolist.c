@@ -0,0 +1,150 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "../src/os.h"
+#include "demolist.h"
+
+static os_char *copypath(const os_char *path) {
+	int len = os_strlen(path);
+	os_char *ret = malloc((len + 1) * sizeof(os_char));
+	if_hot (ret) os_spancopy(ret, path, len + 1);
+	return ret;
+}
+
+static os_char *joinpath(const os_char *dir, const os_char *name) {
+	int dlen = os_strlen(dir), nlen = os_strlen(name);
+	os_char *ret = malloc((dlen + nlen + 2) * sizeof(os_char));
+	if_cold (!ret) return 0;
+	os_spancopy(ret, dir, dlen);
+	ret[dlen] = OS_LIT('/');
+	os_spancopy(ret + dlen + 1, name, nlen + 1);
+	return ret;
+}
+
+static bool fail(struct demolist *l, const char *err, const os_char *path) {
+	free(l->errpath);
+	l->err = err;
+	l->errpath = copypath(path); // (if this fails, well, oh well)
+	return false;
+}
+
+// takes ownership of path
+static bool addfile(struct demolist *l, os_char *path) {
+	if (l->n == l->cap) {
+		int cap = l->cap ? l->cap * 2 : 256;
+		os_char **paths = realloc(l->paths, cap * sizeof(*paths));
+		if_cold (!paths) { free(path); return false; }
+		l->paths = paths; l->cap = cap;
+	}
+	l->paths[l->n++] = path;
+	return true;
+}
+
+static bool isdemo(const os_char *name) {
+	int len = os_strlen(name);
+	return len > 4 && !os_strcmp(name + len - 4, OS_LIT(".dem"));
+}
+
+static int cmppath(const void *a, const void *b) {
+	return os_strcmp(*(os_char *const *)a, *(os_char *const *)b);
+}
+
+static bool adddir(struct demolist *l, const os_char *dir) {
+	int first = l->n;
+	bool ok = true;
+#ifdef _WIN32
+	os_char *pat = joinpath(dir, L"*");
+	if_cold (!pat) return fail(l, "out of memory", dir);
+	WIN32_FIND_DATAW fd;
+	HANDLE h = FindFirstFileW(pat, &fd);
+	free(pat);
+	if_cold (h == INVALID_HANDLE_VALUE) {
+		return fail(l, "couldn't list directory", dir);
+	}
+	do {
+		const os_char *name = fd.cFileName;
+		if (name[0] == L'.') continue; // ., .. and hidden stuff
+		bool isdir = fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+		if (!isdir && !isdemo(name)) continue;
+		os_char *path = joinpath(dir, name);
+		if_cold (!path) { ok = fail(l, "out of memory", dir); break; }
+#else
+	DIR *d = opendir(dir);
+	if_cold (!d) return fail(l, "couldn't list directory", dir);
+	for (struct dirent *ent; ent = readdir(d);) {
+		const os_char *name = ent->d_name;
+		if (name[0] == '.') continue; // ., .. and hidden stuff
+		bool isdir = ent->d_type == DT_DIR;
+		if (!isdir && ent->d_type != DT_UNKNOWN && !isdemo(name)) continue;
+		os_char *path = joinpath(dir, name);
+		if_cold (!path) { ok = fail(l, "out of memory", dir); break; }
+		if (ent->d_type == DT_UNKNOWN) { // some filesystems don't tell us
+			struct os_stat s;
+			isdir = os_stat(path, &s) != -1 && S_ISDIR(s.st_mode);
+			if (!isdir && !isdemo(name)) { free(path); continue; }
+		}
+#endif
+		if (isdir) {
+			// keep going even if a subdirectory fails; err will say which
+			ok &= adddir(l, path);
+			free(path);
+		}
+		else if_cold (!addfile(l, path)) {
+			ok = fail(l, "out of memory", dir);
+			break;
+		}
+#ifdef _WIN32
+	} while (FindNextFileW(h, &fd));
+	FindClose(h);
+#else
+	}
+	closedir(d);
+#endif
+	// directory listing order is arbitrary, so sort for a consistent order.
+	// note that this puts subdirectories' files in with this directory's, but
+	// since they all share a prefix, the end result is the same
+	qsort(l->paths + first, l->n - first, sizeof(*l->paths), &cmppath);
+	return ok;
+}
+
+bool demolist_add(struct demolist *l, const os_char *path) {
+	struct os_stat s;
+	if (os_stat(path, &s) != -1 && S_ISDIR(s.st_mode)) return adddir(l, path);
+	// anything else is assumed to be a demo, even if it doesn't look like one;
+	// it'll fail later if it doesn't exist
+	os_char *copy = copypath(path);
+	if_cold (!copy || !addfile(l, copy)) return fail(l, "out of memory", path);
+	return true;
+}
+
+void demolist_free(struct demolist *l) {
+	for (int i = 0; i < l->n; ++i) free(l->paths[i]);
+	free(l->paths);
+	free(l->errpath);
+	l->paths = 0; l->errpath = 0;
+	l->n = 0; l->cap = 0;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
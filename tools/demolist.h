@@ -0,0 +1,48 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef INC_DEMOLIST_H
+#define INC_DEMOLIST_H
+
+#include "../src/intdefs.h"
+#include "../src/os.h"
+
+/*
+ * Builds up a list of demo files from command line arguments, for tools that
+ * work on lots of demos at once.
+ */
+
+struct demolist {
+	os_char **paths;
+	int n, cap;
+	const char *err; // reason for the last failure, if any
+	os_char *errpath; // the file or directory that caused it
+};
+
+/*
+ * Adds path to the list, or if it's a directory, every .dem file in it and its
+ * subdirectories, sorted by path within each directory. Returns false on
+ * failure, setting l->err and l->errpath; anything found up to that point stays
+ * in the list, and it's fine to carry on adding more.
+ */
+bool demolist_add(struct demolist *l, const os_char *path);
+
+/* Frees everything in the list. */
+void demolist_free(struct demolist *l);
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
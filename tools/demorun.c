@@ -0,0 +1,494 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/3p/monocypher/monocypher.h"
+#include "../src/demodefs.h"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "../src/os.h"
+#include "demofile.h"
+
+#ifdef _WIN32
+#define fS "S"
+#else
+#define fS "s"
+#endif
+
+/*
+ * Packs a sequence of demos, as split up by demorec (foo.dem, foo_2.dem, ...),
+ * into a single run archive, and gets them back out again byte for byte.
+ *
+ *   demorun -c out.sstrun foo.dem [foo_2.dem...]
+ *   demorun -l run.sstrun
+ *   demorun -x run.sstrun outdir [num]
+ *
+ * If -c is only given one demo, the rest of its sequence is picked up from the
+ * same directory automatically. Extracted demos are named after the archive,
+ * so foo.sstrun gives back foo.dem, foo_2.dem and so on.
+ *
+ * Every demo in a run starts by sending mostly the same signon data, string
+ * tables and data tables, so the payloads of those frames are deduplicated by
+ * their BLAKE2b hashes and everything else is stored as-is. The archive is:
+ *
+ *   header (struct hdr)
+ *   table of contents: nsegs × struct seg, then npieces × struct piece
+ *   data
+ *
+ * Each segment (i.e. original demo) is the concatenation of its pieces, each
+ * of which is a range of the data area. Pieces of different segments can point
+ * at the same range, which is where the savings come from. Each segment also
+ * records a hash of the original file, which extraction checks.
+ */
+
+#define VERSION 1
+
+struct hdr {
+	char magic[8]; // "SSTDMRUN"
+	uint version;
+	uint nsegs, npieces;
+	uint _pad;
+	uvlong datasz;
+};
+
+struct seg {
+	uvlong size;
+	uint firstpiece, npieces;
+	uchar hash[32];
+};
+
+struct piece {
+	uvlong off; // relative to the start of the data area
+	uint len;
+	uint shared; // 1 if this is a deduplicated payload
+};
+
+_Static_assert(sizeof(struct hdr) == 32, "wrong header size");
+_Static_assert(sizeof(struct seg) == 48, "wrong segment size");
+_Static_assert(sizeof(struct piece) == 16, "wrong piece size");
+
+static const char magic[8] = "SSTDMRUN";
+
+// payloads smaller than this aren't worth a table entry of their own
+#define MINSHARED 256
+
+static cold noreturn die(int status, const char *s) {
+	fprintf(stderr, "demorun: fatal: %s\n", s);
+	exit(status);
+}
+
+static void *xrealloc(void *p, usize sz) {
+	void *ret = realloc(p, sz);
+	if_cold (!ret) die(100, "couldn't allocate memory");
+	return ret;
+}
+
+static bool writeall(int f, const void *buf, usize len) {
+	for (const char *p = buf; len;) {
+		int n = os_write(f, p, len > 1 << 30 ? 1 << 30 : len);
+		if_cold (n <= 0) return false;
+		p += n; len -= n;
+	}
+	return true;
+}
+
+// archive under construction. pieces that add new data also remember where
+// that data lives in the (still mapped) input demo, so it can be copied later
+struct builder {
+	struct seg *segs;
+	uint nsegs;
+	struct piece *pieces;
+	const uchar **srcs; // per piece; null if the data is already in the archive
+	uint npieces, cappieces;
+	uvlong datasz;
+	struct blob { uchar hash[32]; uvlong off; uint len; } *blobs;
+	uint nblobs, capblobs; // capblobs is a power of 2 (open addressing)
+	uvlong savedsz;
+};
+
+static void addpiece(struct builder *b, uvlong off, uint len, bool shared,
+		const uchar *src) {
+	if (src && !shared && b->npieces > b->segs[b->nsegs - 1].firstpiece) {
+		// extend the last piece if it's also new, unshared data right before
+		struct piece *last = b->pieces + b->npieces - 1;
+		const uchar *lastsrc = b->srcs[b->npieces - 1];
+		if (!last->shared && lastsrc && lastsrc + last->len == src &&
+				last->off + last->len == off && (uvlong)last->len + len <=
+				UINT_MAX) {
+			last->len += len;
+			return;
+		}
+	}
+	if (b->npieces == b->cappieces) {
+		b->cappieces = b->cappieces ? b->cappieces * 2 : 1024;
+		b->pieces = xrealloc(b->pieces, b->cappieces * sizeof(*b->pieces));
+		b->srcs = xrealloc(b->srcs, b->cappieces * sizeof(*b->srcs));
+	}
+	b->pieces[b->npieces] = (struct piece){off, len, shared};
+	b->srcs[b->npieces] = src;
+	++b->npieces;
+}
+
+static void addliteral(struct builder *b, const uchar *p, usize len) {
+	// pieces are capped at 4 GiB, not that a demo frame should ever get close
+	while (len) {
+		uint n = len > UINT_MAX ? UINT_MAX : len;
+		addpiece(b, b->datasz, n, false, p);
+		b->datasz += n;
+		p += n; len -= n;
+	}
+}
+
+static struct blob *findblob(struct builder *b, const uchar hash[static 32],
+		uint len) {
+	uvlong h;
+	memcpy(&h, hash, sizeof(h));
+	for (uint i = h & (b->capblobs - 1);; i = (i + 1) & (b->capblobs - 1)) {
+		struct blob *bl = b->blobs + i;
+		if (!bl->len) return bl;
+		if (bl->len == len && !memcmp(bl->hash, hash, 32)) return bl;
+	}
+}
+
+static void growblobs(struct builder *b) {
+	struct blob *old = b->blobs;
+	uint oldcap = b->capblobs;
+	b->capblobs = oldcap ? oldcap * 2 : 1024;
+	b->blobs = calloc(b->capblobs, sizeof(*b->blobs));
+	if_cold (!b->blobs) die(100, "couldn't allocate memory");
+	for (uint i = 0; i < oldcap; ++i) {
+		if (old[i].len) *findblob(b, old[i].hash, old[i].len) = old[i];
+	}
+	free(old);
+}
+
+static void addshared(struct builder *b, const uchar *p, uint len) {
+	if (b->nblobs * 2 >= b->capblobs) growblobs(b);
+	uchar hash[32];
+	crypto_blake2b(hash, sizeof(hash), p, len);
+	struct blob *bl = findblob(b, hash, len);
+	if (bl->len) {
+		addpiece(b, bl->off, len, true, 0);
+		b->savedsz += len;
+		return;
+	}
+	memcpy(bl->hash, hash, sizeof(hash));
+	bl->off = b->datasz;
+	bl->len = len;
+	++b->nblobs;
+	addpiece(b, b->datasz, len, true, p);
+	b->datasz += len;
+}
+
+static bool isshareable(const struct demofile *d, const struct demo_frame *f) {
+	if (!f->data || f->datalen < MINSHARED) return false;
+	switch (f->cmd) {
+		case DEMO_CMD_SIGNON: case DEMO_CMD_DATATABLES:
+		case DEMO_CMD_STRINGTABLES36:
+			return true;
+		case 8: return !d->hasslot; // DEMO_CMD_STRINGTABLES14
+	}
+	return false;
+}
+
+static void addseg(struct builder *b, const os_char *path,
+		const struct demofile *d) {
+	b->segs = xrealloc(b->segs, (b->nsegs + 1) * sizeof(*b->segs));
+	struct seg *s = b->segs + b->nsegs++;
+	s->size = d->sz;
+	s->firstpiece = b->npieces;
+	crypto_blake2b(s->hash, sizeof(s->hash), d->base, d->sz);
+	usize done = 0;
+	struct demo_iter it = {d};
+	struct demo_frame f;
+	while (demofile_next(&it, &f)) {
+		if (!isshareable(d, &f)) continue;
+		usize off = f.data - d->base;
+		addliteral(b, d->base + done, off - done);
+		addshared(b, f.data, f.datalen);
+		done = off + f.datalen;
+	}
+	// a broken tail (e.g. from a crash) still has to come back out intact
+	if_cold (it.err) {
+		fprintf(stderr, "demorun: %" fS ": %s (storing the rest as-is)\n",
+				path, it.err);
+	}
+	addliteral(b, d->base + done, d->sz - done);
+	s->npieces = b->npieces - s->firstpiece;
+}
+
+// given foo.dem, makes foo_<num>.dem
+static os_char *seqpath(const os_char *first, int num) {
+	int len = os_strlen(first) - 4;
+	os_char *ret = xrealloc(0, (len + 16) * sizeof(os_char));
+	os_spancopy(ret, first, len);
+	os_char *p = ret + len, digits[12];
+	int ndigits = 0;
+	*p++ = OS_LIT('_');
+	do digits[ndigits++] = OS_LIT('0') + num % 10; while (num /= 10);
+	while (ndigits) *p++ = digits[--ndigits];
+	os_spancopy(p, OS_LIT(".dem"), 5);
+	return ret;
+}
+
+static bool isdempath(const os_char *path) {
+	int len = os_strlen(path);
+	return len > 4 && !os_strcmp(path + len - 4, OS_LIT(".dem"));
+}
+
+static int create(const os_char *outpath, os_char **paths, int npaths) {
+	bool autoseq = npaths == 1 && isdempath(paths[0]);
+	struct builder b = {0};
+	struct demofile *demos = 0;
+	int ndemos = 0;
+	for (int i = 0;; ++i) {
+		os_char *seq = 0;
+		const os_char *path;
+		if (i < npaths) path = paths[i];
+		else if (autoseq) path = seq = seqpath(paths[0], i + 1);
+		else break;
+		demos = xrealloc(demos, (ndemos + 1) * sizeof(*demos));
+		struct demofile *d = demos + ndemos;
+		if (!demofile_open(d, path)) {
+			// the sequence ends when the next demo number doesn't exist
+			bool end = i >= npaths;
+			if (!end) fprintf(stderr, "demorun: %" fS ": %s\n", path, d->err);
+			free(seq);
+			if (end) break;
+			return 2;
+		}
+		++ndemos;
+		addseg(&b, path, d);
+		free(seq);
+	}
+	int out = os_open_writetrunc(outpath);
+	if_cold (out == -1) die(100, "couldn't create output file");
+	struct hdr h = {
+		.version = VERSION, .nsegs = b.nsegs, .npieces = b.npieces,
+		.datasz = b.datasz
+	};
+	memcpy(h.magic, magic, sizeof(magic));
+	if_cold (!writeall(out, &h, sizeof(h)) ||
+			!writeall(out, b.segs, b.nsegs * sizeof(*b.segs)) ||
+			!writeall(out, b.pieces, b.npieces * sizeof(*b.pieces))) {
+		die(100, "couldn't write output file");
+	}
+	// new data was given out offsets in order, so just write it all in order
+	for (uint i = 0; i < b.npieces; ++i) {
+		if (b.srcs[i] && !writeall(out, b.srcs[i], b.pieces[i].len)) {
+			die(100, "couldn't write output file");
+		}
+	}
+	os_close(out);
+	uvlong insz = 0;
+	for (int i = 0; i < ndemos; ++i) {
+		insz += demos[i].sz;
+		demofile_close(demos + i);
+	}
+	uvlong outsz = sizeof(h) + b.nsegs * sizeof(*b.segs) +
+			b.npieces * sizeof(*b.pieces) + b.datasz;
+	printf("%" fS ": %u demos, %llu bytes -> %llu (%llu deduplicated)\n",
+			outpath, b.nsegs, insz, outsz, b.savedsz);
+	free(demos); free(b.segs); free(b.pieces); free(b.srcs); free(b.blobs);
+	return 0;
+}
+
+struct archive {
+	const uchar *base;
+	usize sz;
+	const struct hdr *hdr;
+	const struct seg *segs;
+	const struct piece *pieces;
+	const uchar *data;
+};
+
+static void openarchive(struct archive *a, const os_char *path) {
+	int f = os_open_read(path);
+	if_cold (f == -1) die(100, "couldn't open archive");
+	vlong sz = os_fsize(f);
+	if_cold (sz == -1) die(100, "couldn't get archive size");
+	if_cold (sz < ssizeof(struct hdr)) die(2, "archive is too short");
+	a->base = os_mapfile(f, sz);
+	os_close(f);
+	if_cold (!a->base) die(100, "couldn't map archive");
+	a->sz = sz;
+	a->hdr = (const struct hdr *)a->base;
+	if_cold (memcmp(a->hdr->magic, magic, sizeof(magic))) {
+		die(2, "not a demo run archive");
+	}
+	if_cold (a->hdr->version != VERSION) die(2, "unsupported archive version");
+	uvlong tocsz = (uvlong)a->hdr->nsegs * sizeof(struct seg) +
+			(uvlong)a->hdr->npieces * sizeof(struct piece);
+	if_cold (sizeof(struct hdr) + tocsz + a->hdr->datasz != a->sz) {
+		die(2, "archive has the wrong size");
+	}
+	a->segs = (const struct seg *)(a->hdr + 1);
+	a->pieces = (const struct piece *)(a->segs + a->hdr->nsegs);
+	a->data = (const uchar *)(a->pieces + a->hdr->npieces);
+	// check everything up front so nothing later has to worry about it
+	for (uint i = 0; i < a->hdr->nsegs; ++i) {
+		const struct seg *s = a->segs + i;
+		if_cold ((uvlong)s->firstpiece + s->npieces > a->hdr->npieces) {
+			die(2, "corrupt archive");
+		}
+		uvlong total = 0;
+		for (uint j = 0; j < s->npieces; ++j) {
+			const struct piece *p = a->pieces + s->firstpiece + j;
+			if_cold (p->off + p->len > a->hdr->datasz) {
+				die(2, "corrupt archive");
+			}
+			total += p->len;
+		}
+		if_cold (total != s->size) die(2, "corrupt archive");
+	}
+}
+
+static int list(const os_char *path) {
+	struct archive a;
+	openarchive(&a, path);
+	uvlong total = 0;
+	for (uint i = 0; i < a.hdr->nsegs; ++i) {
+		const struct seg *s = a.segs + i;
+		uvlong shared = 0;
+		for (uint j = 0; j < s->npieces; ++j) {
+			const struct piece *p = a.pieces + s->firstpiece + j;
+			if (p->shared) shared += p->len;
+		}
+		printf("%5u: %llu bytes, %u pieces, %llu bytes shared\n", i + 1,
+				s->size, s->npieces, shared);
+		total += s->size;
+	}
+	printf("%u demos, %llu bytes in %llu bytes (%.1f%%)\n", a.hdr->nsegs,
+			total, (uvlong)a.sz, total ? a.sz * 100.0 / total : 100.0);
+	os_unmapfile(a.base, a.sz);
+	return 0;
+}
+
+// gets the run name from the archive path, e.g. foo from some/dir/foo.sstrun
+static void runname(const os_char *path, const os_char **name, int *len) {
+	const os_char *p = path, *start = path, *dot = 0;
+	for (; *p; ++p) {
+#ifdef _WIN32
+		if (*p == L'/' || *p == L'\\') { start = p + 1; dot = 0; }
+#else
+		if (*p == '/') { start = p + 1; dot = 0; }
+#endif
+		else if (*p == OS_LIT('.')) dot = p;
+	}
+	*name = start;
+	*len = (dot && dot != start ? dot : p) - start;
+}
+
+static bool extractone(const struct archive *a, uint i, const os_char *outdir,
+		const os_char *name, int namelen) {
+	int dirlen = os_strlen(outdir);
+	os_char *path = xrealloc(0, (dirlen + namelen + 20) * sizeof(os_char));
+	os_spancopy(path, outdir, dirlen);
+	path[dirlen] = OS_LIT('/');
+	os_spancopy(path + dirlen + 1, name, namelen);
+	os_spancopy(path + dirlen + 1 + namelen, OS_LIT(".dem"), 5);
+	if (i) { // 2nd and later: foo_2.dem etc.
+		os_char *p = seqpath(path, i + 1);
+		free(path);
+		path = p;
+	}
+	const struct seg *s = a->segs + i;
+	bool ok = false;
+	int out = os_open_writetrunc(path);
+	if_cold (out == -1) {
+		fprintf(stderr, "demorun: %" fS ": couldn't create file\n", path);
+		goto e;
+	}
+	crypto_blake2b_ctx ctx;
+	crypto_blake2b_init(&ctx, 32);
+	for (uint j = 0; j < s->npieces; ++j) {
+		const struct piece *p = a->pieces + s->firstpiece + j;
+		crypto_blake2b_update(&ctx, a->data + p->off, p->len);
+		if_cold (!writeall(out, a->data + p->off, p->len)) {
+			fprintf(stderr, "demorun: %" fS ": couldn't write file\n", path);
+			os_close(out);
+			goto e;
+		}
+	}
+	os_close(out);
+	uchar hash[32];
+	crypto_blake2b_final(&ctx, hash);
+	if_cold (crypto_verify32(hash, s->hash)) {
+		fprintf(stderr, "demorun: %" fS ": doesn't match the original\n", path);
+		goto e;
+	}
+	printf("%" fS "\n", path);
+	ok = true;
+e:	free(path);
+	return ok;
+}
+
+static int extract(const os_char *path, const os_char *outdir,
+		const os_char *numarg) {
+	struct archive a;
+	openarchive(&a, path);
+	uint first = 0, end = a.hdr->nsegs;
+	if (numarg) {
+		uint num = 0;
+		for (const os_char *p = numarg; *p; ++p) {
+			if_cold (*p < '0' || *p > '9' || num > 99999999) {
+				die(1, "invalid demo number");
+			}
+			num = num * 10 + *p - '0';
+		}
+		if_cold (!num || num > a.hdr->nsegs) die(1, "no such demo in archive");
+		first = num - 1; end = num;
+	}
+	const os_char *name;
+	int namelen;
+	runname(path, &name, &namelen);
+	bool ok = true;
+	for (uint i = first; i < end; ++i) {
+		ok &= extractone(&a, i, outdir, name, namelen);
+	}
+	os_unmapfile(a.base, a.sz);
+	return ok ? 0 : 2;
+}
+
+static noreturn usage() {
+	fprintf(stderr, "usage: demorun -c out.sstrun demos...\n"
+			"       demorun -l archive.sstrun\n"
+			"       demorun -x archive.sstrun outdir [num]\n");
+	exit(1);
+}
+
+int OS_MAIN(int argc, os_char *argv[]) {
+	if (argc < 3) usage();
+	if (!os_strcmp(argv[1], OS_LIT("-c"))) {
+		if (argc < 4) usage();
+		return create(argv[2], argv + 3, argc - 3);
+	}
+	if (!os_strcmp(argv[1], OS_LIT("-l"))) {
+		if (argc != 3) usage();
+		return list(argv[2]);
+	}
+	if (!os_strcmp(argv[1], OS_LIT("-x"))) {
+		if (argc != 4 && argc != 5) usage();
+		return extract(argv[2], argv[3], argc == 5 ? argv[4] : 0);
+	}
+	usage();
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,132 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/demodefs.h"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "../src/os.h"
+#include "demofile.h"
+
+#ifdef _WIN32
+#define fS "S"
+#else
+#define fS "s"
+#endif
+
+/*
+ * Prints a summary of the frames in each demo given on the command line. Exits
+ * with status 2 if any of them couldn't be parsed all the way through.
+ */
+
+static cold noreturn die(int status, const char *s) {
+	fprintf(stderr, "demostat: fatal: %s\n", s);
+	exit(status);
+}
+
+static const char *const protonames[] = {
+	[DEMO_PROTO_HL2OE] = "HL2 OE",
+	[DEMO_PROTO_PORTAL_5135] = "Portal 5135",
+	[DEMO_PROTO_PORTAL_3420] = "Portal 3420",
+	[DEMO_PROTO_PORTAL_STEAM] = "Orange Box (Steam)",
+	[DEMO_PROTO_PORTAL2] = "Portal 2",
+	[DEMO_PROTO_L4D2000] = "L4D (pre-2042)",
+	[DEMO_PROTO_L4D2042] = "L4D2 (2042+)",
+	[DEMO_PROTO_UNKNOWN] = "unknown"
+};
+
+#define NCMDS 10 // highest DEMO_CMD_* plus one
+
+static const char *cmdname(const struct demofile *d, int cmd) {
+	switch (cmd) {
+		case DEMO_CMD_SIGNON: return "signon";
+		case DEMO_CMD_PACKET: return "packet";
+		case DEMO_CMD_SYNC: return "synctick";
+		case DEMO_CMD_CONCMD: return "consolecmd";
+		case DEMO_CMD_USERCMD: return "usercmd";
+		case DEMO_CMD_DATATABLES: return "datatables";
+		case DEMO_CMD_STOP: return "stop";
+		case 8: return d->hasslot ? "customdata" : "stringtables";
+		case DEMO_CMD_STRINGTABLES36: return "stringtables";
+	}
+	return "?";
+}
+
+struct stats {
+	vlong count[NCMDS], bytes[NCMDS];
+	int mintick, maxtick;
+	vlong nframes;
+	bool anyticks;
+};
+
+static void countframe(struct stats *s, const struct demo_frame *f) {
+	++s->nframes;
+	++s->count[f->cmd];
+	s->bytes[f->cmd] += f->datalen;
+	// signon frames all have tick 0 or thereabouts, ignore them for the range
+	if (f->cmd != DEMO_CMD_SIGNON && f->cmd != DEMO_CMD_STOP) {
+		if (!s->anyticks || f->tick < s->mintick) s->mintick = f->tick;
+		if (!s->anyticks || f->tick > s->maxtick) s->maxtick = f->tick;
+		s->anyticks = true;
+	}
+}
+
+static bool dofile(const os_char *path) {
+	struct demofile d;
+	if_cold (!demofile_open(&d, path)) {
+		fprintf(stderr, "demostat: %" fS ": %s\n", path, d.err);
+		return false;
+	}
+	struct stats s = {0};
+	struct demo_iter it = {&d};
+	struct demo_frame f;
+	while (demofile_next(&it, &f)) countframe(&s, &f);
+	const struct demo_hdr *h = d.hdr;
+	printf("%" fS ":\n", path);
+	printf("  protocol:  %d/%d (%s)\n", h->demover, h->netver,
+			protonames[d.proto]);
+	printf("  player:    %.*s\n", DEMO_HDR_STRLEN, h->playername);
+	printf("  server:    %.*s\n", DEMO_HDR_STRLEN, h->servername);
+	printf("  map:       %.*s\n", DEMO_HDR_STRLEN, h->mapname);
+	printf("  game:      %.*s\n", DEMO_HDR_STRLEN, h->gamedir);
+	printf("  header:    %d ticks, %d frames, %.3f s\n", h->nticks,
+			h->nframes, h->realtime);
+	if (s.anyticks) {
+		printf("  ticks:     %d - %d\n", s.mintick, s.maxtick);
+	}
+	printf("  frames:    %lld in %lld bytes\n", s.nframes, (vlong)d.sz);
+	for (int i = 0; i < NCMDS; ++i) if (s.count[i]) {
+		printf("    %-13s %9lld frames %11lld bytes\n", cmdname(&d, i),
+				s.count[i], s.bytes[i]);
+	}
+	if (it.err) {
+		fprintf(stderr, "demostat: %" fS ": %s at offset %lld\n", path,
+				it.err, (vlong)it.off);
+	}
+	demofile_close(&d);
+	return !it.err;
+}
+
+int OS_MAIN(int argc, os_char *argv[]) {
+	if_cold (argc < 2) die(1, "no demo files given");
+	bool ok = true;
+	for (int i = 1; i < argc; ++i) ok &= dofile(argv[i]);
+	return ok ? 0 : 2;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
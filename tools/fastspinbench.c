@@ -0,0 +1,354 @@
+/* This file is dedicated to the public domain. */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/chunklets/cacheline.h"
+#include "../src/chunklets/fastspin.h"
+#include "../src/intdefs.h"
+
+/*
+ * Quick hacked-up contention benchmark for fastspin, with pthreads as the
+ * baseline. This is not run as part of the build; it is just here for
+ * development and reference purposes, mainly to sanity-check changes to the
+ * spinning and sleeping policy. Linux (or other pthreads systems) only.
+ * To compile:
+ *   $CC -O2 -pthread -o .build/fastspinbench tools/fastspinbench.c \
+ *       src/chunklets/fastspin.c
+ *
+ * Usage: fastspinbench [-t maxthreads] [-d seconds] [lock|event]...
+ *
+ * The lock benchmark has every thread repeatedly take a lock, do a given
+ * amount of work on some shared data, release it, then do some work of its own.
+ * Latency is the time spent in the lock call. The event benchmark has one
+ * thread raise an event for all the others to wait on, either straight away or
+ * after a gap long enough for the waiters to have gone to sleep. Latency is the
+ * time from the raise call to each waiter waking up.
+ *
+ * Timings are taken with clock_gettime() around every operation, which costs
+ * a few tens of ns. That applies equally to everything, so it's fine for
+ * comparisons but means the absolute numbers for fast cases are pessimistic.
+ */
+
+static inline uvlong now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Log-linear latency histogram: 16 buckets per power of two, so percentiles
+// come out within about 6% while the whole thing stays small enough to have
+// one per thread.
+#define SUB 16
+#define NBUCKETS (60 * SUB)
+struct hist { uvlong n[NBUCKETS]; };
+
+static inline int bucket(uvlong ns) {
+	if (ns < SUB) return ns;
+	int e = 63 - __builtin_clzll(ns) - 4; // 4 = log2(SUB)
+	return (e + 1) * SUB + (int)(ns >> e) - SUB;
+}
+
+static inline uvlong bucketval(int i) {
+	if (i < SUB) return i;
+	int e = i / SUB - 1;
+	return (uvlong)(i % SUB + SUB) << e;
+}
+
+static inline void record(struct hist *h, uvlong ns) { ++h->n[bucket(ns)]; }
+
+static void merge(struct hist *dst, const struct hist *src) {
+	for (int i = 0; i < NBUCKETS; ++i) dst->n[i] += src->n[i];
+}
+
+static void printhist(const struct hist *h, uvlong total, double secs) {
+	static const double pcts[] = {50, 90, 99, 99.9};
+	printf("%11.0f/s", total / secs);
+	uvlong seen = 0;
+	int p = 0, maxi = 0;
+	for (int i = 0; i < NBUCKETS; ++i) {
+		if (!h->n[i]) continue;
+		maxi = i;
+		seen += h->n[i];
+		for (; p < sizeof(pcts) / sizeof(*pcts) &&
+				seen >= total * pcts[p] / 100; ++p) {
+			printf(" %8llu", bucketval(i));
+		}
+	}
+	for (; p < sizeof(pcts) / sizeof(*pcts); ++p) printf(" %8s", "-");
+	printf(" %9llu\n", bucketval(maxi));
+}
+
+static void printheader(const char *what) {
+	printf("\n%-31s%13s %8s %8s %8s %8s %9s\n", what, "throughput",
+			"p50 ns", "p90", "p99", "p99.9", "max");
+}
+
+// keeps the compiler from optimising away the busywork
+static inline void spin(uint *p, int n) {
+	uint x = *p;
+	for (int i = 0; i < n; ++i) {
+		x = x * 1103515245 + 12345;
+		__asm__ volatile ("" : "+r" (x));
+	}
+	*p = x;
+}
+
+static volatile int stop;
+static pthread_barrier_t barrier;
+
+/* ---- lock benchmark ---- */
+
+struct lockimpl {
+	const char *name;
+	void (*init)(void *l);
+	void (*lock)(void *l);
+	void (*unlock)(void *l);
+};
+
+static void fs_init(void *l) { *(volatile int *)l = 0; }
+static void fs_lock(void *l) { fastspin_lock(l); }
+static void fs_unlock(void *l) { fastspin_unlock(l); }
+
+static void pt_init(void *l) { pthread_mutex_init(l, 0); }
+static void pt_lock(void *l) { pthread_mutex_lock(l); }
+static void pt_unlock(void *l) { pthread_mutex_unlock(l); }
+
+#ifdef PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
+static void pta_init(void *l) {
+	pthread_mutexattr_t a;
+	pthread_mutexattr_init(&a);
+	pthread_mutexattr_settype(&a, PTHREAD_MUTEX_ADAPTIVE_NP);
+	pthread_mutex_init(l, &a);
+	pthread_mutexattr_destroy(&a);
+}
+#endif
+
+static const struct lockimpl lockimpls[] = {
+	{"fastspin", &fs_init, &fs_lock, &fs_unlock},
+	{"pthread", &pt_init, &pt_lock, &pt_unlock},
+#ifdef PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
+	{"pthread-adaptive", &pta_init, &pt_lock, &pt_unlock},
+#endif
+};
+
+// lock and the data it protects share a line, as the README suggests
+static struct {
+	_Alignas(CACHELINE_FALSESHARE_SIZE) union {
+		volatile int fs;
+		pthread_mutex_t pt;
+	} l;
+	uint data;
+} shared;
+
+struct lockthread {
+	pthread_t thr;
+	const struct lockimpl *impl;
+	int cs, outside;
+	uvlong ops;
+	struct hist h;
+};
+
+static void *lockthread(void *p) {
+	struct lockthread *t = p;
+	uint mine = 0;
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		uvlong t0 = now();
+		t->impl->lock(&shared.l);
+		record(&t->h, now() - t0);
+		spin(&shared.data, t->cs);
+		t->impl->unlock(&shared.l);
+		spin(&mine, t->outside);
+		++t->ops;
+	}
+	return 0;
+}
+
+static void benchlock(const struct lockimpl *impl, int nthreads, int cs,
+		double secs) {
+	struct lockthread *t = calloc(nthreads, sizeof(*t));
+	if (!t) { fputs("out of memory\n", stderr); exit(1); }
+	impl->init(&shared.l);
+	stop = 0;
+	pthread_barrier_init(&barrier, 0, nthreads + 1);
+	for (int i = 0; i < nthreads; ++i) {
+		t[i].impl = impl; t[i].cs = cs; t[i].outside = 100;
+		pthread_create(&t[i].thr, 0, &lockthread, t + i);
+	}
+	pthread_barrier_wait(&barrier);
+	uvlong start = now();
+	usleep(secs * 1e6);
+	stop = 1;
+	uvlong total = 0;
+	for (int i = 0; i < nthreads; ++i) {
+		pthread_join(t[i].thr, 0);
+		total += t[i].ops;
+		if (i) merge(&t[0].h, &t[i].h);
+	}
+	double elapsed = (now() - start) * 1e-9;
+	pthread_barrier_destroy(&barrier);
+	printf("%-16s %2d thr cs %4d", impl->name, nthreads, cs);
+	printhist(&t[0].h, total, elapsed);
+	free(t);
+}
+
+/* ---- event benchmark ---- */
+
+#define ROUNDS 4096
+
+struct evimpl {
+	const char *name;
+	void (*raise)(int round);
+	void (*wait)(int round);
+};
+
+// fastspin events are one-shot, so use a fresh one for each round. each gets
+// its own line so that waiters for the next round don't disturb this one.
+static struct { _Alignas(CACHELINE_FALSESHARE_SIZE) volatile int ev; }
+		*fsevents;
+static void fs_raise(int round) { fastspin_raise(&fsevents[round].ev, 1); }
+static void fs_wait(int round) { fastspin_wait(&fsevents[round].ev); }
+
+static pthread_mutex_t ptmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ptcond = PTHREAD_COND_INITIALIZER;
+static int ptround;
+static void pt_raise(int round) {
+	pthread_mutex_lock(&ptmutex);
+	ptround = round + 1;
+	pthread_cond_broadcast(&ptcond);
+	pthread_mutex_unlock(&ptmutex);
+}
+static void pt_wait(int round) {
+	pthread_mutex_lock(&ptmutex);
+	while (ptround <= round) pthread_cond_wait(&ptcond, &ptmutex);
+	pthread_mutex_unlock(&ptmutex);
+}
+
+static const struct evimpl evimpls[] = {
+	{"fastspin", &fs_raise, &fs_wait},
+	{"pthread-cond", &pt_raise, &pt_wait}
+};
+
+static volatile uvlong raisetime[ROUNDS];
+static volatile int arrived[ROUNDS];
+
+struct evthread {
+	pthread_t thr;
+	const struct evimpl *impl;
+	int rounds;
+	struct hist h;
+};
+
+static void *evthread(void *p) {
+	struct evthread *t = p;
+	pthread_barrier_wait(&barrier);
+	for (int r = 0; r < t->rounds; ++r) {
+		__atomic_fetch_add(&arrived[r], 1, __ATOMIC_RELAXED);
+		t->impl->wait(r);
+		record(&t->h, now() - raisetime[r]);
+	}
+	return 0;
+}
+
+static void benchevent(const struct evimpl *impl, int nwaiters, int gapus,
+		double secs) {
+	struct evthread *t = calloc(nwaiters, sizeof(*t));
+	if (!t) { fputs("out of memory\n", stderr); exit(1); }
+	memset(fsevents, 0, ROUNDS * sizeof(*fsevents));
+	memset((void *)arrived, 0, sizeof(arrived));
+	ptround = 0;
+	// guess at a round count that'll take about as long as asked for
+	int rounds = gapus ? secs * 1e6 / (gapus + 10) : ROUNDS;
+	if (rounds > ROUNDS) rounds = ROUNDS;
+	pthread_barrier_init(&barrier, 0, nwaiters + 1);
+	for (int i = 0; i < nwaiters; ++i) {
+		t[i].impl = impl; t[i].rounds = rounds;
+		pthread_create(&t[i].thr, 0, &evthread, t + i);
+	}
+	pthread_barrier_wait(&barrier);
+	uvlong start = now();
+	for (int r = 0; r < rounds; ++r) {
+		while (__atomic_load_n(&arrived[r], __ATOMIC_RELAXED) < nwaiters) {
+			sched_yield();
+		}
+		if (gapus) usleep(gapus);
+		raisetime[r] = now();
+		impl->raise(r);
+	}
+	for (int i = 0; i < nwaiters; ++i) {
+		pthread_join(t[i].thr, 0);
+		if (i) merge(&t[0].h, &t[i].h);
+	}
+	double elapsed = (now() - start) * 1e-9;
+	pthread_barrier_destroy(&barrier);
+	printf("%-16s %2d thr gap %3d", impl->name, nwaiters, gapus);
+	printhist(&t[0].h, (uvlong)rounds * nwaiters, elapsed);
+	free(t);
+}
+
+/* ---- */
+
+static void usage(void) {
+	fputs("usage: fastspinbench [-t maxthreads] [-d seconds] [lock|event]...\n",
+			stderr);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	int maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	double secs = 0.25;
+	for (int c; (c = getopt(argc, argv, "t:d:")) != -1;) {
+		switch (c) {
+			case 't': maxthreads = atoi(optarg); break;
+			case 'd': secs = atof(optarg); break;
+			default: usage();
+		}
+	}
+	if (maxthreads < 1 || secs <= 0) usage();
+	bool dolock = optind == argc, doevent = optind == argc;
+	for (int i = optind; i < argc; ++i) {
+		if (!strcmp(argv[i], "lock")) dolock = true;
+		else if (!strcmp(argv[i], "event")) doevent = true;
+		else usage();
+	}
+	// 1, 2, 4, ... and then the actual maximum if it's not a power of two
+	int nthreads[32], nn = 0;
+	for (int n = 1; n < maxthreads; n *= 2) nthreads[nn++] = n;
+	nthreads[nn++] = maxthreads;
+	if (dolock) {
+		static const int cslens[] = {0, 50, 500};
+		printheader("lock (cs = work units)");
+		for (int c = 0; c < sizeof(cslens) / sizeof(*cslens); ++c) {
+			for (int n = 0; n < nn; ++n) {
+				for (int i = 0; i < sizeof(lockimpls) / sizeof(*lockimpls);
+						++i) {
+					benchlock(lockimpls + i, nthreads[n], cslens[c], secs);
+				}
+			}
+		}
+	}
+	if (doevent) {
+		fsevents = aligned_alloc(CACHELINE_FALSESHARE_SIZE,
+				ROUNDS * sizeof(*fsevents));
+		if (!fsevents) { fputs("out of memory\n", stderr); return 1; }
+		static const int gaps[] = {0, 200};
+		printheader("event (gap = us before raise)");
+		for (int g = 0; g < sizeof(gaps) / sizeof(*gaps); ++g) {
+			for (int n = 0; n < nn; ++n) {
+				for (int i = 0; i < sizeof(evimpls) / sizeof(*evimpls); ++i) {
+					benchevent(evimpls + i, nthreads[n], gaps[g], secs);
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,338 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/bitbuf.h"
+#include "../src/chunklets/msg.h"
+#include "../src/crypto.h"
+#include "../src/demodefs.h"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "../src/lz.h"
+#include "../src/os.h"
+#include "demofile.h"
+
+#include <demorecords.gen.h> // generated by src/build/mkrecords.c
+
+/*
+ * Writes synthetic demos for testing and benchmarking the offline tools, so
+ * that there's no need to hand around real players' demos. The result has the
+ * same overall shape as a real demo: signon data, data tables and string
+ * tables up front, then a packet and a usercmd frame every tick, with SST's
+ * custom data framed exactly as democustom.c does it. The custom data itself is
+ * what ac.c writes: a SessionKey record, then a FakeKey record per keypress,
+ * each sealed in a bin. The network messages themselves are just random bits,
+ * so the game won't actually play these back.
+ *
+ *   gendemo [options] out.dem
+ *     -t ticks    number of ticks (default 10000)
+ *     -p bytes    average bytes of other packet data per tick (default 400)
+ *     -c n        custom data records per 100 ticks (default 100)
+ *     -z          compress custom data, like sst_demo_compressdata 1
+ *     -g game     demo format: p2 (default), l4d2 or ob (Orange Box)
+ *     -s seed     random seed (default 1)
+ *
+ * The same options and seed always give the same file. Signon data doesn't
+ * depend on the seed, as in a real run of demos on the same map. Records are
+ * sealed for a fixed leaderboard key, whose private half is the 32 bytes of
+ * "gendemo test key, not a secret!!"; as a key file for sstverify -k, that's
+ *
+ *   67656E64656D6F2074657374206B65792C206E6F742061207365637265742121
+ */
+
+static cold noreturn die(int status, const char *s) {
+	fprintf(stderr, "gendemo: fatal: %s\n", s);
+	exit(status);
+}
+
+static uvlong rngstate;
+
+// xorshift64*; rand() differs between C libraries, and output needs to match
+static uint rng() {
+	rngstate ^= rngstate >> 12;
+	rngstate ^= rngstate << 25;
+	rngstate ^= rngstate >> 27;
+	return (rngstate * 0x2545F4914F6CDD1Dull) >> 32;
+}
+
+static void rngbytes(uchar *p, int n) { while (n--) *p++ = rng(); }
+
+static int outfd;
+static uchar outbuf[1 << 20];
+static int outlen = 0;
+static uvlong outtotal = 0;
+
+static void flushout() {
+	for (const uchar *p = outbuf; outlen;) {
+		int n = os_write(outfd, p, outlen);
+		if_cold (n <= 0) die(100, "couldn't write output file");
+		p += n; outlen -= n;
+	}
+}
+
+static void put(const void *p, int n) {
+	outtotal += n;
+	if (outlen + n > ssizeof(outbuf)) flushout();
+	if (n > ssizeof(outbuf)) {
+		// too big to buffer; doesn't happen with the sizes used below anyway
+		for (const uchar *q = p; n;) {
+			int w = os_write(outfd, q, n);
+			if_cold (w <= 0) die(100, "couldn't write output file");
+			q += w; n -= w;
+		}
+		return;
+	}
+	memcpy(outbuf + outlen, p, n);
+	outlen += n;
+}
+
+static void put32(int x) {
+	uchar b[4] = {x, x >> 8, x >> 16, x >> 24};
+	put(b, 4);
+}
+
+static void putbyte(int x) { uchar b = x; put(&b, 1); }
+
+static struct {
+	int demover, netver;
+	int nslots; // see demofile.c
+	int lenbits; // see sstdata_lenbits()
+	int stringtables; // frame type
+} fmt;
+
+static void framehdr(int cmd, int tick) {
+	putbyte(cmd);
+	put32(tick);
+	if (fmt.demover >= 4) putbyte(0); // player slot
+}
+
+static void cmdinfo() {
+	static const uchar zero[DEMO_CMDINFO_SZ * 4];
+	put(zero, fmt.nslots * DEMO_CMDINFO_SZ);
+	put32(0); put32(0); // seqin, seqout
+}
+
+static void blobframe(int cmd, int tick, const uchar *data, int len) {
+	framehdr(cmd, tick);
+	if (cmd == DEMO_CMD_SIGNON || cmd == DEMO_CMD_PACKET) cmdinfo();
+	put32(len);
+	put(data, len);
+}
+
+// packet bitstream, with room for the noise and up to a few dozen records
+static union {
+	char x[256 * 1024 + sizeof(bitbuf_cell)];
+	bitbuf_cell _align;
+} pktbuf;
+static struct bitbuf pkt = {
+	{pktbuf.x}, ssizeof(pktbuf), ssizeof(pktbuf) * 8, 0, false, false, "pkt"
+};
+
+// same as createhdr() in democustom.c
+#define CHUNKSZ 252
+static void createhdr(int len, int flags) {
+	bitbuf_appendbits(&pkt, 23, 6);
+	bitbuf_appendbyte(&pkt, 2);
+	uint datastart = pkt.curbit + fmt.lenbits + 16;
+	int datalen = 16 + (-datastart & 7) + len * 8;
+	bitbuf_appendbits(&pkt, datalen, fmt.lenbits);
+	bitbuf_appendbyte(&pkt, 0);
+	bitbuf_appendbyte(&pkt, DEMO_SST_MARKER | flags);
+	bitbuf_roundup(&pkt);
+}
+
+static void appendchunks(const uchar *buf, int len, int flags) {
+	for (; len > CHUNKSZ; len -= CHUNKSZ, buf += CHUNKSZ) {
+		createhdr(CHUNKSZ, flags);
+		bitbuf_appendbuf(&pkt, (const char *)buf, CHUNKSZ);
+	}
+	createhdr(len, flags | DEMO_SSTF_LAST);
+	bitbuf_appendbuf(&pkt, (const char *)buf, len);
+}
+
+static struct lz_enc lzenc;
+static uchar lzout[LZ_BOUND(LZ_MAXBLOCK)];
+static bool compress = false, lzreset = true;
+
+static void appendblock(const uchar *buf, int len) {
+	if (!compress) { appendchunks(buf, len, 0); return; }
+	do {
+		int flags = DEMO_SSTF_LZ;
+		if (lzreset) {
+			lz_enc_reset(&lzenc);
+			flags |= DEMO_SSTF_LZRESET;
+			lzreset = false;
+		}
+		int n = len < LZ_MAXBLOCK ? len : LZ_MAXBLOCK;
+		int clen = lz_compress(&lzenc, lzout, buf, n);
+		appendchunks(lzout, clen, flags);
+		buf += n; len -= n;
+	} while (len);
+}
+
+// see the comment at the top; this is only good for testing, obviously!
+static const uchar testlbprv[32] = "gendemo test key, not a secret!!";
+static uchar sessionshr[32];
+static uvlong nonce;
+
+// makes up a session keypair and writes the public key record, deriving the
+// shared key the same way as newsessionkeys() in ac.c
+static int gensessionkey(uchar *p) {
+	uchar prv[32], buf[96]; // shared secret, public key, leaderboard public key
+	rngbytes(prv, sizeof(prv));
+	crypto_x25519_public_key(buf + 32, prv);
+	crypto_x25519_public_key(buf + 64, testlbprv);
+	crypto_x25519(buf, prv, buf + 64);
+	crypto_blake2b(sessionshr, sizeof(sessionshr), buf, sizeof(buf));
+	nonce = 0;
+	return demorec_put_SessionKey(p, buf + 32);
+}
+
+// writes one sealed FakeKey record, just as sealpost() in ac.c does
+static int genrecord(uchar *p, int tick) {
+	uchar rec[DEMOREC_FakeKey_MAXSZ], n[8];
+	// input timestamps are in microseconds, a little after the tick started
+	uvlong us = tick * 16667ull + rng() % 16667;
+	int len = demorec_put_FakeKey(rec, rng() % 256, rng() % 128, us);
+	msg_putbsz8(p, len + 16);
+	++nonce;
+	for (int i = 0; i < 8; ++i) n[i] = nonce >> (i * 8);
+	crypto_aead_lock_djb(p + 2, p + 2 + len, sessionshr, n, 0, 0, rec, len);
+	return 2 + len + 16;
+}
+
+static int parseint(const os_char *s, int max, const char *what) {
+	vlong ret = 0;
+	if_cold (!*s) die(1, what);
+	for (; *s; ++s) {
+		if_cold (*s < '0' || *s > '9') die(1, what);
+		ret = ret * 10 + *s - '0';
+		if_cold (ret > max) die(1, what);
+	}
+	return ret;
+}
+
+int OS_MAIN(int argc, os_char *argv[]) {
+	int nticks = 10000, pktbytes = 400, density = 100, seed = 1;
+	fmt.demover = 4; fmt.netver = 2001; fmt.nslots = 2; fmt.lenbits = 12;
+	fmt.stringtables = DEMO_CMD_STRINGTABLES36;
+	int i = 1;
+	for (; i < argc - 1 && argv[i][0] == '-'; ++i) {
+		if (!os_strcmp(argv[i], OS_LIT("-z"))) { compress = true; continue; }
+		if_cold (argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 == argc) {
+			die(1, "invalid option");
+		}
+		const os_char *arg = argv[++i];
+		switch (argv[i - 1][1]) {
+			case 't':
+				nticks = parseint(arg, 10000000, "invalid tick count");
+				break;
+			case 'p':
+				pktbytes = parseint(arg, 65536, "invalid packet size");
+				break;
+			case 'c': density = parseint(arg, 3200, "invalid density"); break;
+			case 's': seed = parseint(arg, INT_MAX, "invalid seed"); break;
+			case 'g':
+				if (!os_strcmp(arg, OS_LIT("p2"))) break;
+				if (!os_strcmp(arg, OS_LIT("l4d2"))) {
+					fmt.netver = 2042; fmt.nslots = 4; fmt.lenbits = 11;
+				}
+				else if (!os_strcmp(arg, OS_LIT("ob"))) {
+					fmt.demover = 3; fmt.netver = 24; fmt.nslots = 1;
+					fmt.stringtables = DEMO_CMD_STRINGTABLES14;
+				}
+				else {
+					die(1, "unknown game (expected p2, l4d2 or ob)");
+				}
+				break;
+			default: die(1, "invalid option");
+		}
+	}
+	if_cold (i != argc - 1) {
+		fprintf(stderr, "usage: gendemo [-t ticks] [-p bytes] [-c n] [-z] "
+				"[-g game] [-s seed] out.dem\n");
+		return 1;
+	}
+	outfd = os_open_writetrunc(argv[i]);
+	if_cold (outfd == -1) die(100, "couldn't create output file");
+
+	// 3 signon frames, data tables, string tables, sync, 2 per tick, and stop
+	int nframes = 3 + 1 + 1 + 1 + 2 * nticks + 1;
+	struct demo_hdr h = {
+		"HL2DEMO", fmt.demover, fmt.netver, "localhost:27015", "Player",
+		"sp_a2_triple_laser", "portal2", nticks / 60.0f, nticks, nframes,
+		0 // signonlen (filled in below)
+	};
+	// signon data comes from a fixed seed, so it's the same in every demo
+	rngstate = 0x5357545354535354ull;
+	static const int signonsz[] = {24000, 9000, 31000};
+	static uchar big[96 * 1024];
+	int dtsz = 90000, stsz = 45000;
+	for (int j = 0; j < countof(signonsz); ++j) {
+		h.signonlen += 1 + 4 + (fmt.demover >= 4) + fmt.nslots *
+				DEMO_CMDINFO_SZ + 8 + 4 + signonsz[j];
+	}
+	put(&h, sizeof(h));
+	for (int j = 0; j < countof(signonsz); ++j) {
+		rngbytes(big, signonsz[j]);
+		blobframe(DEMO_CMD_SIGNON, 0, big, signonsz[j]);
+	}
+	rngbytes(big, dtsz);
+	blobframe(DEMO_CMD_DATATABLES, 0, big, dtsz);
+	rngbytes(big, stsz);
+	framehdr(fmt.stringtables, 0);
+	put32(stsz);
+	put(big, stsz);
+	framehdr(DEMO_CMD_SYNC, 0);
+
+	rngstate = 0x9E3779B97F4A7C15ull * (seed + 1);
+	static uchar recs[64 * 1024];
+	int credit = 0;
+	for (int tick = 1; tick <= nticks; ++tick) {
+		// noise first, varying between half and one and a half times the mean
+		int noise = pktbytes ? pktbytes / 2 + rng() % (pktbytes + 1) : 0;
+		for (int j = 0; j < noise; ++j) bitbuf_appendbyte(&pkt, rng());
+		int nrecs = (credit += density) / 100;
+		credit %= 100;
+		// the key has to come before the records, as with writepubkey()
+		int len = tick == 1 ? gensessionkey(recs) : 0;
+		for (int j = 0; j < nrecs; ++j) len += genrecord(recs + len, tick);
+		if (len) appendblock(recs, len);
+		// as with demo_hdr, the engine doesn't actually care about alignment
+		bitbuf_roundup(&pkt);
+		blobframe(DEMO_CMD_PACKET, tick, (const uchar *)pkt.buf,
+				pkt.curbit / 8);
+		bitbuf_reset(&pkt);
+		uchar ucmd[64];
+		int ucmdlen = 20 + rng() % 40;
+		rngbytes(ucmd, ucmdlen);
+		framehdr(DEMO_CMD_USERCMD, tick);
+		put32(tick); // seqout
+		put32(ucmdlen);
+		put(ucmd, ucmdlen);
+	}
+	framehdr(DEMO_CMD_STOP, nticks);
+	flushout();
+	os_close(outfd);
+	printf("%d frames, %llu bytes\n", nframes, outtotal);
+	return 0;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,93 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/democache.h"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "../src/os.h"
+
+#ifdef _WIN32
+#define fS "S"
+#else
+#define fS "s"
+#endif
+
+/*
+ * Lists the demos in one or more directories, grouped into runs, using the same
+ * header cache as the sst_listdemos command (see democache.h).
+ *
+ *   lsdemos [-a] dirs...
+ *
+ * -a also lists each individual demo under its run.
+ */
+
+static cold noreturn die(int status, const char *s) {
+	fprintf(stderr, "lsdemos: fatal: %s\n", s);
+	exit(status);
+}
+
+static bool list(const os_char *dir, bool all) {
+	struct democache c;
+	if_cold (!democache_load(&c, dir)) {
+		fprintf(stderr, "lsdemos: %" fS ": couldn't list demos\n", dir);
+		return false;
+	}
+	printf("%" fS ":\n", dir);
+	struct democache_run r;
+	int nbad = 0;
+	char line[1024], tbuf[24];
+	for (int i = 0; democache_nextrun(&c, &i, &r);) {
+		democache_fmtrun(line, sizeof(line), &c, &r);
+		printf("  %s\n", line);
+		const struct democache_ent *first = c.ents + r.first;
+		for (const struct democache_ent *e = first; e < first + r.n; ++e) {
+			if_cold (!e->demover) {
+				fprintf(stderr, "lsdemos: %" fS "/%.*" fS ": bad header\n", dir,
+						e->namelen, democache_name(&c, e));
+				++nbad;
+				continue;
+			}
+			if (!all) continue;
+			democache_fmttime(tbuf, e->realtime);
+			printf("    %.*" fS ": %d ticks, %s, %.*s\n", e->namelen,
+					democache_name(&c, e), e->nticks, tbuf, e->maplen,
+					democache_map(&c, e));
+		}
+	}
+	democache_fmttotal(line, sizeof(line), &c);
+	printf("%s\n", line);
+	if_cold (c.stale) {
+		fprintf(stderr, "lsdemos: %" fS ": couldn't update the cache file\n",
+				dir);
+	}
+	democache_free(&c);
+	return !nbad;
+}
+
+int OS_MAIN(int argc, os_char *argv[]) {
+	bool all = false;
+	int i = 1;
+	if (argc > 1 && !os_strcmp(argv[1], OS_LIT("-a"))) { all = true; ++i; }
+	if_cold (i == argc) die(1, "no directories given");
+	bool ok = true;
+	for (; i < argc; ++i) ok &= list(argv[i], all);
+	return ok ? 0 : 2;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
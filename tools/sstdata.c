@@ -0,0 +1,237 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "../src/bitbuf.h"
+#include "../src/demodefs.h"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "../src/lz.h"
+#include "demofile.h"
+#include "sstdata.h"
+
+#define MSGTYPEBITS 6
+#define MSGTYPE_USERMSG 23
+#define USERMSG_HUDTEXT 2
+#define MAXMSGLEN 255 // engine limit on the size of a user message, in bytes
+#define MAXBLOCK (16 * 1024 * 1024) // sanity limit on uncompressed blocks
+
+void sstdata_scaninit(struct sstdata_scan *s, const uchar *pkt, int len,
+		int lenbits) {
+	s->pkt = pkt;
+	s->len = len;
+	s->lenbits = lenbits;
+	s->pos = 0;
+}
+
+// reads back the whole user message header, given a null byte and marker byte
+// at bit position b. returns the bit position of the end of the message if it
+// all checks out, or 0 if not.
+static uint confirm(const struct sstdata_scan *s, uint b,
+		struct sstdata_msg *m) {
+	uint hdrbits = MSGTYPEBITS + 8 + s->lenbits;
+	if (b < hdrbits) return 0;
+	uint start = b - hdrbits;
+	// the bit reader wants aligned cells, and we don't want it reading off the
+	// end of the mapped file, so copy the header out first. at most 7 bits of
+	// padding + 42 bits of header fits easily in 8 bytes
+	union { char x[8]; bitbuf_cell _align; } hdr = {0};
+	int n = s->len - (start >> 3);
+	if (n > ssizeof(hdr.x)) n = ssizeof(hdr.x);
+	memcpy(hdr.x, s->pkt + (start >> 3), n);
+	struct bitbuf_reader r = {
+		{hdr.x}, ssizeof(hdr.x), n * 8, start & 7, false, false, "SST"
+	};
+	if (bitbuf_readbits(&r, MSGTYPEBITS) != MSGTYPE_USERMSG) return 0;
+	if (bitbuf_readbyte(&r) != USERMSG_HUDTEXT) return 0;
+	uint datalen = bitbuf_readbits(&r, s->lenbits);
+	bitbuf_readbyte(&r); // null byte, already known to be there
+	int marker = bitbuf_readbyte(&r);
+	if (r.overflow) return 0;
+	uint datastart = (b + 16 + 7) & ~7u, end = b + datalen;
+	if (datalen > MAXMSGLEN * 8 || end < datastart) return 0;
+	if (end > (uint)s->len * 8 || (end - datastart) & 7) return 0;
+	m->data = s->pkt + (datastart >> 3);
+	m->len = (end - datastart) >> 3;
+	m->flags = marker & ~DEMO_SST_MARKERMASK;
+	m->bitoff = start;
+	return end;
+}
+
+// matches a null byte followed by a marker byte, as the low 16 bits of x
+static inline bool ismarker(uint x) {
+	return (x & (DEMO_SST_MARKERMASK << 8 | 0xFF)) == DEMO_SST_MARKER << 8;
+}
+
+#ifdef __SSE2__
+// Quick first pass over 16 bytes at p (needing 1 more byte after): the null byte
+// starts at some bit k of one byte, covering bits k-7 of that byte and bits 0 to
+// k-1 of the next. So the first byte must be less than the lowest set bit of the
+// next (less than 128 if there is none), which rules out most positions cheaply.
+static inline uint prefilter(const uchar *p) {
+	__m128i a = _mm_loadu_si128((const __m128i *)p);
+	__m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+	__m128i lowbit = _mm_and_si128(b, _mm_sub_epi8(_mm_setzero_si128(), b));
+	// lowbit - 1 wraps to 255 if b is 0, so clamp to 127 to cover that case
+	__m128i lim = _mm_min_epu8(_mm_sub_epi8(lowbit, _mm_set1_epi8(1)),
+			_mm_set1_epi8(127));
+	__m128i ok = _mm_cmpeq_epi8(_mm_subs_epu8(a, lim), _mm_setzero_si128());
+	return _mm_movemask_epi8(ok);
+}
+
+// Looks for the marker pattern starting at each bit of the 16 bytes at p, which
+// needs to have 2 more bytes readable after that. Sets bit j of masks[k] if
+// there's a match starting at bit k of byte j. For each bit shift, the shifted
+// bytes are built from 16-bit lanes, whose low byte comes out right after a
+// shift; even and odd bytes come from loads 1 byte apart.
+static inline uint findblock(const uchar *p, uint masks[static 8]) {
+	__m128i a = _mm_loadu_si128((const __m128i *)p);
+	__m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+	__m128i c = _mm_loadu_si128((const __m128i *)(p + 2));
+	__m128i lo = _mm_set1_epi16(0xFF), zero = _mm_setzero_si128();
+	__m128i mmask = _mm_set1_epi8((char)DEMO_SST_MARKERMASK);
+	__m128i mval = _mm_set1_epi8((char)DEMO_SST_MARKER);
+	uint any = 0;
+	for (int k = 0; k < 8; ++k) {
+		__m128i cnt = _mm_cvtsi32_si128(k);
+		__m128i sa = _mm_srl_epi16(a, cnt), sb = _mm_srl_epi16(b, cnt);
+		__m128i sc = _mm_srl_epi16(c, cnt);
+		// bytes 0-15 and 1-16 of the stream, shifted down by k bits
+		__m128i q0 = _mm_or_si128(_mm_and_si128(sa, lo), _mm_slli_epi16(sb, 8));
+		__m128i q1 = _mm_or_si128(_mm_and_si128(sb, lo), _mm_slli_epi16(sc, 8));
+		__m128i hit = _mm_and_si128(_mm_cmpeq_epi8(q0, zero),
+				_mm_cmpeq_epi8(_mm_and_si128(q1, mmask), mval));
+		masks[k] = _mm_movemask_epi8(hit);
+		any |= masks[k];
+	}
+	return any;
+}
+#endif
+
+bool sstdata_nextmsg(struct sstdata_scan *s, struct sstdata_msg *m) {
+	const uchar *p = s->pkt;
+	uint i = s->pos >> 3, n = s->len;
+#ifdef __SSE2__
+	for (; i + 18 <= n; i += 16) {
+		uint masks[8], any;
+		if_hot (!prefilter(p + i) || !(any = findblock(p + i, masks))) continue;
+		do {
+			int j = __builtin_ctz(any);
+			for (int k = 0; k < 8; ++k) {
+				if (!(masks[k] >> j & 1)) continue;
+				uint b = (i + j) * 8 + k, end;
+				if (b >= s->pos && (end = confirm(s, b, m))) {
+					s->pos = end;
+					return true;
+				}
+			}
+			any &= any - 1;
+		} while (any);
+	}
+#endif
+	for (; i + 2 <= n; ++i) {
+		uint x = p[i] | p[i + 1] << 8 | (i + 2 < n ? p[i + 2] << 16 : 0);
+		for (int k = 0; k < 8; ++k) {
+			uint b = i * 8 + k, end;
+			if (ismarker(x >> k) && b >= s->pos && (end = confirm(s, b, m))) {
+				s->pos = end;
+				return true;
+			}
+		}
+	}
+	s->pos = n * 8;
+	return false;
+}
+
+void sstdata_asminit(struct sstdata_asm *a) {
+	a->len = 0;
+	a->lzok = false;
+}
+
+void sstdata_asmfree(struct sstdata_asm *a) {
+	free(a->buf);
+	a->buf = 0;
+	a->cap = 0;
+}
+
+int sstdata_push(struct sstdata_asm *a, const struct sstdata_msg *m,
+		const uchar **out) {
+	if (!a->len) {
+		a->flags = m->flags;
+	}
+	else if_cold ((a->flags ^ m->flags) & DEMO_SSTF_LZ) {
+		a->len = 0; // chunks from two different blocks, somehow
+		return -1;
+	}
+	if (a->len + m->len > a->cap) {
+		if_cold (a->len + m->len > MAXBLOCK) { a->len = 0; return -1; }
+		int cap = a->cap ? a->cap * 2 : 4096;
+		while (cap < a->len + m->len) cap *= 2;
+		uchar *buf = realloc(a->buf, cap);
+		if_cold (!buf) { a->len = 0; return -1; }
+		a->buf = buf; a->cap = cap;
+	}
+	memcpy(a->buf + a->len, m->data, m->len);
+	a->len += m->len;
+	if (!(m->flags & DEMO_SSTF_LAST)) return 0;
+	int len = a->len;
+	a->len = 0;
+	if (!(a->flags & DEMO_SSTF_LZ)) { *out = a->buf; return len; }
+	if (a->flags & DEMO_SSTF_LZRESET) {
+		lz_dec_reset(&a->lz);
+		a->lzok = true;
+	}
+	// can't decompress anything if we missed the start of the stream
+	if_cold (!a->lzok) return -1;
+	int ret = lz_decompress(&a->lz, out, a->buf, len);
+	if_cold (ret < 0) a->lzok = false;
+	return ret;
+}
+
+const char *sstdata_walk(const struct demofile *d,
+		bool (*cb)(void *ctx, int tick, const uchar *buf, int len), void *ctx) {
+	struct sstdata_asm a = {0};
+	sstdata_asminit(&a);
+	int lenbits = sstdata_lenbits(d);
+	struct demo_iter it = {d};
+	struct demo_frame f;
+	const char *err = 0;
+	while (demofile_next(&it, &f)) {
+		// SST only ever writes its data in regular packets, not signon ones
+		if (f.cmd != DEMO_CMD_PACKET) continue;
+		struct sstdata_scan s;
+		sstdata_scaninit(&s, f.data, f.datalen, lenbits);
+		struct sstdata_msg m;
+		while (sstdata_nextmsg(&s, &m)) {
+			const uchar *buf;
+			int len = sstdata_push(&a, &m, &buf);
+			// a bad block only loses that block (and any compressed ones after
+			// it); the next reset or uncompressed block gets us going again
+			if_cold (len < 0) { err = "invalid custom data"; continue; }
+			if (len && !cb(ctx, f.tick, buf, len)) goto e;
+		}
+	}
+	if (it.err) err = it.err;
+e:	sstdata_asmfree(&a);
+	return err;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
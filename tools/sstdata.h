@@ -0,0 +1,97 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef INC_SSTDATA_H
+#define INC_SSTDATA_H
+
+#include "../src/intdefs.h"
+#include "../src/lz.h"
+#include "demofile.h"
+
+/*
+ * Extraction of SST's custom data (see democustom.c) from demos. Packet data is
+ * first searched for the null byte and marker byte at every bit offset at once,
+ * using SIMD where available, and then each hit is confirmed by reading back
+ * the whole user message header, so that stray bit patterns in other messages
+ * don't get picked up. The resulting chunks are then glued back together into
+ * whole blocks, and decompressed if need be.
+ */
+
+/* One user message's worth of custom data, pointing into the packet. */
+struct sstdata_msg {
+	const uchar *data;
+	int len;
+	int flags; // DEMO_SSTF_*
+	uint bitoff; // bit position of the start of the message in the packet
+};
+
+/* State for finding messages in a single packet. */
+struct sstdata_scan {
+	const uchar *pkt;
+	int len; // in bytes
+	int lenbits; // number of bits used for user message lengths
+	uint pos; // bit position to continue searching from
+};
+
+/* Returns the number of bits used for user message lengths in the demo. */
+static inline int sstdata_lenbits(const struct demofile *d) {
+	return d->proto == DEMO_PROTO_L4D2042 ? 11 : 12;
+}
+
+/* Sets up s to search len bytes of packet data. */
+void sstdata_scaninit(struct sstdata_scan *s, const uchar *pkt, int len,
+		int lenbits);
+
+/* Finds the next message in the packet. Returns false if there are no more. */
+bool sstdata_nextmsg(struct sstdata_scan *s, struct sstdata_msg *m);
+
+/* State for reassembling blocks from messages, across an entire demo. */
+struct sstdata_asm {
+	uchar *buf; // chunks of the current block so far
+	int len, cap;
+	int flags; // flags of the current block, if len is nonzero
+	bool lzok; // whether the decompressor has seen a reset
+	struct lz_dec lz;
+};
+
+/* Prepares a zero-initialised reassembler for a new demo. */
+void sstdata_asminit(struct sstdata_asm *a);
+
+/* Frees memory allocated by a reassembler. */
+void sstdata_asmfree(struct sstdata_asm *a);
+
+/*
+ * Adds a message to the current block. If this completes the block, points *out
+ * at the (decompressed) block data and returns its length, which is valid until
+ * the next call. Returns 0 if more messages are needed first, or -1 if the data
+ * doesn't make sense (in which case the partial block is thrown away).
+ */
+int sstdata_push(struct sstdata_asm *a, const struct sstdata_msg *m,
+		const uchar **out);
+
+/*
+ * Calls cb with each block of custom data in the demo, along with the tick of
+ * the packet that completed it, stopping early if it returns false. Blocks that
+ * don't make sense are skipped, and anything else that can still be read is
+ * passed along. Returns null if there were no problems, or else a description
+ * of the last one.
+ */
+const char *sstdata_walk(const struct demofile *d,
+		bool (*cb)(void *ctx, int tick, const uchar *buf, int len), void *ctx);
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
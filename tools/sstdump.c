@@ -0,0 +1,170 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/chunklets/msg.h"
+#include "../src/chunklets/msgdec.h"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "../src/os.h"
+#include "demofile.h"
+#include "sstdata.h"
+
+#include <demorecordsdec.gen.h> // generated by src/build/mkrecords.c
+
+#ifdef _WIN32
+#define fS "S"
+#else
+#define fS "s"
+#endif
+
+/*
+ * Prints all of SST's custom data from each demo given on the command line, one
+ * msgpack record per line, in a JSON-like form, prefixed by the demo tick. Bin
+ * values (e.g. sealed records) are printed as hex strings. Records described
+ * in demorecords.txt get their type and field names printed in place of their
+ * IDs. Exits with status 2 if any demo couldn't be read all the way through.
+ */
+
+static cold noreturn die(int status, const char *s) {
+	fprintf(stderr, "sstdump: fatal: %s\n", s);
+	exit(status);
+}
+
+static void putstr(const uchar *p, uint len) {
+	putchar('"');
+	for (const uchar *end = p + len; p < end; ++p) {
+		if (*p == '"' || *p == '\\') printf("\\%c", *p);
+		else if (*p < 32) printf("\\u%04x", *p);
+		else putchar(*p);
+	}
+	putchar('"');
+}
+
+static void puthex(const uchar *p, uint len) {
+	putchar('"');
+	for (const uchar *end = p + len; p < end; ++p) printf("%02x", *p);
+	putchar('"');
+}
+
+#define MAXDEPTH 32
+
+// if *p starts with a positive fixint that gives a name in this context, prints
+// the name in place of the number. p must not be at the end!
+static bool putname(const uchar **p, int rec) {
+	if (**p >= 0x80) return false;
+	const char *name = rec ? demorec_fieldname(rec, **p) : demorec_name(**p);
+	if (!name) return false;
+	putstr((const uchar *)name, strlen(name));
+	++*p;
+	return true;
+}
+
+// prints one msgpack value, returning false if it's malformed or truncated.
+// rec is the ID of the record whose fields are in this value, if it's a map
+static bool dump(const uchar **p, const uchar *end, int depth, int rec) {
+	if_cold (depth == MAXDEPTH) return false;
+	struct msgdec_val v;
+	if_cold (msgdec_get(p, end, &v) != MSGDEC_OK) return false;
+	switch (v.type) {
+		case MSGDEC_NIL: fputs("null", stdout); break;
+		case MSGDEC_BOOL: fputs(v.b ? "true" : "false", stdout); break;
+		case MSGDEC_UINT: printf("%llu", v.u); break;
+		case MSGDEC_SINT: printf("%lld", v.s); break;
+		case MSGDEC_FLOAT: printf("%.9g", v.f); break;
+		case MSGDEC_DOUBLE: printf("%.17g", v.d); break;
+		case MSGDEC_STR: putstr(v.data, v.datalen); break;
+		case MSGDEC_BIN: puthex(v.data, v.datalen); break;
+		case MSGDEC_EXT:
+			printf("{\"ext\": %d, \"data\": ", v.ext);
+			puthex(v.data, v.datalen);
+			putchar('}');
+			break;
+		case MSGDEC_ARRAY: case MSGDEC_MAP:;
+			bool map = v.type == MSGDEC_MAP;
+			int fieldsof = 0;
+			uint i = 0, n = v.n;
+			putchar(map ? '{' : '[');
+			// [id, {fields}] records get printed just like the older
+			// ["Name", {"field": ...}] ones, since that's far more readable
+			if (!depth && !map && n == 2 && *p != end) {
+				int id = **p;
+				if (putname(p, 0)) { fieldsof = id; i = 1; }
+			}
+			for (; i < n; ++i) {
+				if (i) fputs(", ", stdout);
+				if (map) {
+					if_cold (*p == end) return false;
+					if (!rec || !putname(p, rec)) {
+						if_cold (!dump(p, end, depth + 1, 0)) return false;
+					}
+					fputs(": ", stdout);
+				}
+				if_cold (!dump(p, end, depth + 1, fieldsof)) return false;
+			}
+			putchar(map ? '}' : ']');
+	}
+	return true;
+}
+
+struct ctx {
+	const os_char *path;
+	bool bad;
+};
+
+static bool dumpblock(void *ctx_, int tick, const uchar *buf, int len) {
+	struct ctx *ctx = ctx_;
+	for (const uchar *p = buf, *end = buf + len; p < end;) {
+		printf("%d\t", tick);
+		bool ok = dump(&p, end, 0, 0);
+		putchar('\n');
+		if_cold (!ok) {
+			fprintf(stderr, "sstdump: %" fS ": bad msgpack data at tick %d\n",
+					ctx->path, tick);
+			ctx->bad = true;
+			break; // rest of the block is unrecoverable, but keep going
+		}
+	}
+	return true;
+}
+
+static bool dofile(const os_char *path) {
+	struct demofile d;
+	if_cold (!demofile_open(&d, path)) {
+		fprintf(stderr, "sstdump: %" fS ": %s\n", path, d.err);
+		return false;
+	}
+	struct ctx ctx = {path, false};
+	const char *err = sstdata_walk(&d, &dumpblock, &ctx);
+	if_cold (err) fprintf(stderr, "sstdump: %" fS ": %s\n", path, err);
+	demofile_close(&d);
+	return !err && !ctx.bad;
+}
+
+int OS_MAIN(int argc, os_char *argv[]) {
+	if_cold (argc < 2) die(1, "no demo files given");
+	bool ok = true;
+	for (int i = 1; i < argc; ++i) {
+		if (argc > 2) printf("# %" fS "\n", argv[i]);
+		ok &= dofile(argv[i]);
+	}
+	return ok ? 0 : 2;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,319 @@
+/*
+ * Copyright © Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "../src/chunklets/msg.h"
+#include "../src/chunklets/msgdec.h"
+#include "../src/chunklets/pool.h"
+#include "../src/crypto.h"
+#include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "../src/os.h"
+#include "demofile.h"
+#include "demolist.h"
+#include "sstdata.h"
+
+#include <demorecordsdec.gen.h> // generated by src/build/mkrecords.c
+
+#ifdef _WIN32
+#define fS "S"
+#else
+#define fS "s"
+#endif
+
+/*
+ * Checks the MACs of all the sealed records written by ac.c, across any number
+ * of demos at once, using the leaderboard's private key. Each demo carries the
+ * session public key(s) it was recorded with, as a SessionKey record (see
+ * demorecords.txt); from that, the shared key is derived the same way ac.c does
+ * it, and then every top-level msgpack bin is taken to be a sealed record, with
+ * the nonce counting up from 1 after each session key. Failures are reported
+ * per record and per demo, and the exit status is 2 if there were any.
+ *
+ * Usage: sstverify -k keyfile [-j nthreads] files-or-dirs...
+ *
+ * The key file contains the private key as 64 hex digits, as printed by
+ * genkeypair. Anything other than hex digits is ignored.
+ */
+
+static cold noreturn die(int status, const char *s) {
+	fprintf(stderr, "sstverify: fatal: %s\n", s);
+	exit(status);
+}
+
+static uchar lbprv[32], lbpub[32];
+
+// a sealed record found before the demo's session key, kept for later
+struct pending {
+	uchar *data; // ciphertext + MAC
+	int len, idx, tick;
+};
+
+struct badrec {
+	int idx, tick; // index is 1-based, counting all sealed records in the demo
+	const char *why;
+};
+
+struct job {
+	const os_char *path;
+	const char *err; // problem with the demo as a whole, if any
+	usize sz;
+	int nrecs, nkeys;
+	uchar key[32];
+	uvlong nonce;
+	struct pending *pend;
+	int npend, pendcap;
+	struct badrec *bad;
+	int nbad, badcap;
+};
+
+static void addbad(struct job *j, int idx, int tick, const char *why) {
+	if (j->nbad == j->badcap) {
+		int cap = j->badcap ? j->badcap * 2 : 16;
+		struct badrec *bad = realloc(j->bad, cap * sizeof(*bad));
+		if_cold (!bad) { j->err = "out of memory"; return; }
+		j->bad = bad; j->badcap = cap;
+	}
+	j->bad[j->nbad++] = (struct badrec){idx, tick, why};
+}
+
+// same derivation as newsessionkeys() in ac.c, from the other side
+static void derive(uchar shr[static 32], const uchar pub[static 32]) {
+	uchar buf[96];
+	crypto_x25519(buf, lbprv, pub);
+	memcpy(buf + 32, pub, 32);
+	memcpy(buf + 64, lbpub, 32);
+	crypto_blake2b(shr, 32, buf, sizeof(buf));
+	crypto_wipe(buf, sizeof(buf));
+}
+
+static void checkrec(struct job *j, const uchar *p, int len, int idx,
+		int tick) {
+	if_cold (len < 16) { addbad(j, idx, tick, "too short"); return; }
+	uchar nonce[8];
+	++j->nonce;
+	for (int i = 0; i < 8; ++i) nonce[i] = j->nonce >> (i * 8);
+	if_cold (crypto_aead_check_djb(p + len - 16, j->key, nonce, 0, 0, p,
+			len - 16)) {
+		addbad(j, idx, tick, "bad MAC");
+	}
+}
+
+static void newkey(struct job *j, const uchar pub[static 32]) {
+	derive(j->key, pub);
+	j->nonce = 0;
+	++j->nkeys;
+}
+
+// if the record at p is a session key, returns a pointer to the key
+static const uchar *sessionkey(const uchar *p, usize len) {
+	if (*p != 0x92) return 0; // fast path: it's an array either way
+	// the string-keyed form written by SST versions before demorecords.txt
+	static const uchar pfx[] = {0x92, 0xAA, 'S', 'e', 's', 's', 'i', 'o', 'n',
+			'K', 'e', 'y', 0xC4, 32};
+	if (len == sizeof(pfx) + 32 && !memcmp(p, pfx, sizeof(pfx))) {
+		return p + sizeof(pfx);
+	}
+	struct demorec r;
+	if (demorec_get(&p, p + len, &r) == MSGDEC_OK &&
+			r.id == DEMOREC_SessionKey && r.has & DEMOREC_SessionKey_pub) {
+		return r.SessionKey.pub;
+	}
+	return 0;
+}
+
+static bool doblock(void *j_, int tick, const uchar *buf, int len) {
+	struct job *j = j_;
+	for (const uchar *p = buf, *end = buf + len; p < end;) {
+		const uchar *next = p;
+		if_cold (msgdec_skip(&next, end) != MSGDEC_OK) {
+			j->err = "bad msgpack data";
+			return false;
+		}
+		int sz = next - p;
+		const uchar *pub = sessionkey(p, sz);
+		if (pub) {
+			newkey(j, pub);
+			// anything posted before the key got written still used it
+			for (int i = 0; i < j->npend; ++i) {
+				const struct pending *r = j->pend + i;
+				checkrec(j, r->data, r->len, r->idx, r->tick);
+				free(r->data);
+			}
+			j->npend = 0;
+		}
+		else if (*p >= 0xC4 && *p <= 0xC6) { // a bin: sealed record
+			int lensz = 1 << (*p - 0xC4);
+			const uchar *data = p + 1 + lensz;
+			int datalen = sz - 1 - lensz;
+			++j->nrecs;
+			if (j->nkeys) {
+				checkrec(j, data, datalen, j->nrecs, tick);
+			}
+			else {
+				if (j->npend == j->pendcap) {
+					int cap = j->pendcap ? j->pendcap * 2 : 16;
+					struct pending *pend = realloc(j->pend, cap * sizeof(*pend));
+					if_cold (!pend) { j->err = "out of memory"; return false; }
+					j->pend = pend; j->pendcap = cap;
+				}
+				uchar *copy = malloc(datalen);
+				if_cold (!copy) { j->err = "out of memory"; return false; }
+				memcpy(copy, data, datalen);
+				j->pend[j->npend++] = (struct pending){copy, datalen, j->nrecs,
+						tick};
+			}
+		}
+		p = next;
+	}
+	return true;
+}
+
+static void dojob(void *j_) {
+	struct job *j = j_;
+	struct demofile d;
+	if_cold (!demofile_open(&d, j->path)) { j->err = d.err; return; }
+	j->sz = d.sz;
+	const char *err = sstdata_walk(&d, &doblock, j);
+	if_cold (err && !j->err) j->err = err;
+	demofile_close(&d);
+	if_cold (j->npend) {
+		for (int i = 0; i < j->npend; ++i) free(j->pend[i].data);
+		if (!j->err) j->err = "sealed records but no session key";
+	}
+	free(j->pend);
+	crypto_wipe(j->key, sizeof(j->key));
+}
+
+static int parsenum(const os_char *s) {
+	int ret = 0;
+	for (; *s; ++s) {
+		if_cold (*s < '0' || *s > '9' || ret > 9999) return -1;
+		ret = ret * 10 + *s - '0';
+	}
+	return ret;
+}
+
+static void readkey(const os_char *path) {
+	int f = os_open_read(path);
+	if_cold (f == -1) die(100, "couldn't open key file");
+	char buf[1024];
+	int n = os_read(f, buf, sizeof(buf));
+	os_close(f);
+	if_cold (n == -1) die(100, "couldn't read key file");
+	int ndigits = 0;
+	for (int i = 0; i < n; ++i) {
+		int c = buf[i], x;
+		if (c >= '0' && c <= '9') x = c - '0';
+		else if (c >= 'A' && c <= 'F') x = c - 'A' + 10;
+		else if (c >= 'a' && c <= 'f') x = c - 'a' + 10;
+		else continue;
+		if_cold (ndigits == 64) break;
+		lbprv[ndigits / 2] = lbprv[ndigits / 2] << 4 | x;
+		++ndigits;
+	}
+	crypto_wipe(buf, sizeof(buf));
+	if_cold (ndigits != 64) die(2, "key file must contain a 32-byte hex key");
+	crypto_x25519_public_key(lbpub, lbprv);
+}
+
+static double now() {
+#ifdef _WIN32
+	LARGE_INTEGER freq, t;
+	QueryPerformanceFrequency(&freq); QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / freq.QuadPart;
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
+int OS_MAIN(int argc, os_char *argv[]) {
+	int nthreads = 0;
+	bool havekey = false;
+	struct demolist l = {0};
+	for (int i = 1; i < argc; ++i) {
+		if (!os_strcmp(argv[i], OS_LIT("-j"))) {
+			if_cold (++i == argc) die(1, "missing thread count after -j");
+			nthreads = parsenum(argv[i]);
+			if_cold (nthreads < 0) die(1, "invalid thread count");
+			continue;
+		}
+		if (!os_strcmp(argv[i], OS_LIT("-k"))) {
+			if_cold (++i == argc) die(1, "missing key file after -k");
+			readkey(argv[i]);
+			havekey = true;
+			continue;
+		}
+		if_cold (!demolist_add(&l, argv[i])) {
+			fprintf(stderr, "sstverify: %" fS ": %s\n",
+					l.errpath ? l.errpath : argv[i], l.err);
+		}
+	}
+	if_cold (!havekey) die(1, "no key file given");
+	if_cold (!l.n) die(1, "no demo files given");
+	int njobs = l.n;
+	struct job *jobs = calloc(njobs, sizeof(*jobs));
+	if_cold (!jobs) die(100, "couldn't allocate memory");
+	for (int i = 0; i < njobs; ++i) jobs[i].path = l.paths[i];
+	double start = now();
+	struct pool *pool = pool_start(nthreads);
+	if_cold (!pool) die(100, "couldn't start worker threads");
+	nthreads = pool_nthreads(pool);
+	for (int i = 0; i < njobs; ++i) pool_submit(pool, &dojob, jobs + i);
+	pool_finish(pool);
+	double secs = now() - start;
+	crypto_wipe(lbprv, sizeof(lbprv));
+
+	int nbaddemos = 0;
+	vlong totalsz = 0, totalrecs = 0, totalbad = 0;
+	for (int i = 0; i < njobs; ++i) {
+		const struct job *j = jobs + i;
+		totalsz += j->sz;
+		totalrecs += j->nrecs;
+		totalbad += j->nbad;
+		for (int k = 0; k < j->nbad; ++k) {
+			printf("FAIL %" fS ": record %d (tick %d): %s\n", j->path,
+					j->bad[k].idx, j->bad[k].tick, j->bad[k].why);
+		}
+		bool ok = !j->err && !j->nbad;
+		nbaddemos += !ok;
+		printf("%s %" fS ": %d sealed records", ok ? "ok  " : "FAIL", j->path,
+				j->nrecs);
+		if (j->nbad) printf(", %d bad", j->nbad);
+		if (j->err) printf(": %s", j->err);
+		putchar('\n');
+		free(j->bad);
+	}
+	printf("%d demos, %d with problems; %lld sealed records, %lld bad; "
+			"%.1f MB in %.2f s (%.0f records/s) on %d threads\n", njobs,
+			nbaddemos, totalrecs, totalbad, totalsz / 1e6, secs,
+			totalrecs / secs, nthreads);
+	free(jobs);
+	demolist_free(&l);
+	return nbaddemos ? 2 : 0;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80